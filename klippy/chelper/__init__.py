@@ -18,15 +18,17 @@ COMPILE_ARGS = ("-Wall -g -O2 -shared -fPIC"
 SSE_FLAGS = "-mfpmath=sse -msse2"
 SOURCE_FILES = [
     'pyhelper.c', 'serialqueue.c', 'stepcompress.c', 'itersolve.c', 'trapq.c',
-    'pollreactor.c', 'msgblock.c', 'trdispatch.c',
+    'pollreactor.c', 'msgblock.c', 'trdispatch.c', 'latency.c', 'bedmesh.c',
+    'arcs.c', 'flushpool.c',
     'kin_cartesian.c', 'kin_corexy.c', 'kin_corexz.c', 'kin_delta.c',
     'kin_deltesian.c', 'kin_polar.c', 'kin_rotary_delta.c', 'kin_winch.c',
-    'kin_extruder.c', 'kin_shaper.c', 'kin_idex.c',
+    'kin_extruder.c', 'kin_shaper.c', 'kin_idex.c', 'kin_bedmesh.c',
 ]
 DEST_LIB = "c_helper.so"
 OTHER_FILES = [
     'list.h', 'serialqueue.h', 'stepcompress.h', 'itersolve.h', 'pyhelper.h',
-    'trapq.h', 'pollreactor.h', 'msgblock.h'
+    'trapq.h', 'pollreactor.h', 'msgblock.h', 'latency.h', 'bedmesh.h',
+    'flushpool.h'
 ]
 
 defs_stepcompress = """
@@ -39,6 +41,8 @@ defs_stepcompress = """
     struct stepcompress *stepcompress_alloc(uint32_t oid);
     void stepcompress_fill(struct stepcompress *sc, uint32_t max_error
         , int32_t queue_step_msgtag, int32_t set_next_step_dir_msgtag);
+    void stepcompress_fill_multi(struct stepcompress *sc
+        , int32_t queue_step_multi_msgtag);
     void stepcompress_set_invert_sdir(struct stepcompress *sc
         , uint32_t invert_sdir);
     void stepcompress_free(struct stepcompress *sc);
@@ -54,14 +58,28 @@ defs_stepcompress = """
     int stepcompress_extract_old(struct stepcompress *sc
         , struct pull_history_steps *p, int max
         , uint64_t start_clock, uint64_t end_clock);
+    int stepcompress_get_move_slots_peak(struct stepcompress *sc, int reset);
 
     struct steppersync *steppersync_alloc(struct serialqueue *sq
         , struct stepcompress **sc_list, int sc_num, int move_num);
     void steppersync_free(struct steppersync *ss);
     void steppersync_set_time(struct steppersync *ss
         , double time_offset, double mcu_freq);
+    void steppersync_set_latency_hists(struct steppersync *ss
+        , struct latency_hist *sc_flush_hist, struct latency_hist *flush_hist);
     int steppersync_flush(struct steppersync *ss, uint64_t move_clock
         , uint64_t clear_history_clock);
+    void steppersync_get_stats(struct steppersync *ss, char *buf, int len
+        , int reset);
+    int steppersync_get_queue_usage(struct steppersync *ss, uint64_t clock);
+"""
+
+defs_flushpool = """
+    struct flushpool *flushpool_alloc(int max_jobs);
+    void flushpool_free(struct flushpool *fp);
+    int flushpool_flush(struct flushpool *fp, struct steppersync **ss_list
+        , uint64_t *move_clocks, uint64_t *clear_history_clocks
+        , int *results, int num);
 """
 
 defs_itersolve = """
@@ -101,6 +119,7 @@ defs_trapq = """
         , double pos_x, double pos_y, double pos_z);
     int trapq_extract_old(struct trapq *tq, struct pull_move *p, int max
         , double start_time, double end_time);
+    void trapq_set_latency_hist(struct trapq *tq, struct latency_hist *lh);
 """
 
 defs_kin_cartesian = """
@@ -164,6 +183,15 @@ defs_kin_idex = """
     struct stepper_kinematics * dual_carriage_alloc(void);
 """
 
+defs_kin_bedmesh = """
+    int bed_mesh_kin_set_sk(struct stepper_kinematics *sk
+        , struct stepper_kinematics *orig_sk);
+    void bed_mesh_kin_set_mesh(struct stepper_kinematics *sk
+        , struct bed_mesh *bm, double fade_start, double fade_end
+        , double fade_target, double tool_offset, double z_shift);
+    struct stepper_kinematics * bed_mesh_kin_alloc(void);
+"""
+
 defs_serialqueue = """
     #define MESSAGE_MAX 64
     struct pull_queue_message {
@@ -177,6 +205,8 @@ defs_serialqueue = """
         , int client_id);
     void serialqueue_exit(struct serialqueue *sq);
     void serialqueue_free(struct serialqueue *sq);
+    int serialqueue_set_sched(struct serialqueue *sq, int policy
+        , int priority, int *cpus, int cpu_count);
     struct command_queue *serialqueue_alloc_commandqueue(void);
     void serialqueue_free_commandqueue(struct command_queue *cq);
     void serialqueue_send(struct serialqueue *sq, struct command_queue *cq
@@ -188,6 +218,8 @@ defs_serialqueue = """
         , double frequency);
     void serialqueue_set_receive_window(struct serialqueue *sq
         , int receive_window);
+    void serialqueue_set_latency_hist(struct serialqueue *sq
+        , struct latency_hist *lh);
     void serialqueue_set_clock_est(struct serialqueue *sq, double est_freq
         , double conv_time, uint64_t conv_clock, uint64_t last_clock);
     void serialqueue_get_stats(struct serialqueue *sq, char *buf, int len);
@@ -208,21 +240,59 @@ defs_trdispatch = """
         , uint64_t expire_ticks, uint64_t min_extend_ticks);
 """
 
+defs_latency = """
+    struct pull_latency_summary {
+        uint64_t count;
+        double avg, max, p50, p99, p999;
+    };
+
+    uint64_t latency_get_time(void);
+    struct latency_hist *latency_hist_alloc(void);
+    void latency_hist_note(struct latency_hist *lh, uint64_t start_time);
+    void latency_hist_summary(struct latency_hist *lh
+        , struct pull_latency_summary *ls, int reset);
+"""
+
 defs_pyhelper = """
     void set_python_logging_callback(void (*func)(const char *));
     double get_monotonic(void);
+    int sched_lock_memory(int prefault_size);
+    void sched_measure_jitter(int count, double interval, double *results);
 """
 
 defs_std = """
     void free(void*);
 """
 
+defs_bedmesh = """
+    struct bed_mesh *bed_mesh_alloc(void);
+    void bed_mesh_free(struct bed_mesh *bm);
+    int bed_mesh_set_grid(struct bed_mesh *bm, double min_x, double min_y
+        , double dist_x, double dist_y, int count_x, int count_y
+        , double *z_matrix);
+    void bed_mesh_set_offsets(struct bed_mesh *bm, double offset_x
+        , double offset_y);
+    double bed_mesh_calc_z(struct bed_mesh *bm, double x, double y);
+    int bed_mesh_split_move(struct bed_mesh *bm, double *prev_pos
+        , double *next_pos, double factor, double fade_offset
+        , double move_check_distance, double split_delta_z
+        , double *out, int max_points);
+"""
+
+defs_arcs = """
+    int arc_plan(double *start_pos, double *target_pos
+        , double offset_alpha, double offset_beta, int clockwise
+        , int alpha_axis, int beta_axis, int helical_axis
+        , double mm_per_arc_segment, double *out, int max_points);
+"""
+
 defs_all = [
     defs_pyhelper, defs_serialqueue, defs_std, defs_stepcompress,
-    defs_itersolve, defs_trapq, defs_trdispatch,
+    defs_itersolve, defs_trapq, defs_trdispatch, defs_latency, defs_bedmesh,
+    defs_arcs, defs_flushpool,
     defs_kin_cartesian, defs_kin_corexy, defs_kin_corexz, defs_kin_delta,
     defs_kin_deltesian, defs_kin_polar, defs_kin_rotary_delta, defs_kin_winch,
-    defs_kin_extruder, defs_kin_shaper, defs_kin_idex,
+    defs_kin_extruder, defs_kin_shaper, defs_kin_idex, defs_kin_bedmesh,
 ]
 
 # Update filenames to an absolute path
@@ -0,0 +1,82 @@
+// Conversion of G2/G3 arc moves into linear segments
+//
+// Copyright (C) 2026  agent <agent@local>
+//
+// This file may be distributed under the terms of the GNU GPLv3 license.
+
+// The arc is approximated by generating many small linear segments.
+// This code originates from Marlin's plan_arc() (via the earlier
+// python implementation in klippy/extras/gcode_arcs.py).
+
+#include <math.h> // atan2
+#include "compiler.h" // __visible
+
+// Calculate the segment end positions of an arc.  The 'start_pos',
+// 'target_pos', and 'out' arrays contain x, y, z coordinates.  The
+// 'alpha_axis' and 'beta_axis' (0=x, 1=y, 2=z) specify the plane of
+// the arc and 'helical_axis' is the axis with linear travel.  The
+// number of segments is returned (the final segment ends at
+// 'target_pos').  Positions are only stored if the number of segments
+// is not greater than 'max_points'.
+int __visible
+arc_plan(double *start_pos, double *target_pos
+         , double offset_alpha, double offset_beta, int clockwise
+         , int alpha_axis, int beta_axis, int helical_axis
+         , double mm_per_arc_segment, double *out, int max_points)
+{
+    // Radius vector from center to current location
+    double r_p = -offset_alpha, r_q = -offset_beta;
+
+    // Determine angular travel
+    double center_p = start_pos[alpha_axis] - r_p;
+    double center_q = start_pos[beta_axis] - r_q;
+    double rt_alpha = target_pos[alpha_axis] - center_p;
+    double rt_beta = target_pos[beta_axis] - center_q;
+    double angular_travel = atan2(r_p * rt_beta - r_q * rt_alpha
+                                  , r_p * rt_alpha + r_q * rt_beta);
+    if (angular_travel < 0.)
+        angular_travel += 2. * M_PI;
+    if (clockwise)
+        angular_travel -= 2. * M_PI;
+
+    if (angular_travel == 0.
+        && start_pos[alpha_axis] == target_pos[alpha_axis]
+        && start_pos[beta_axis] == target_pos[beta_axis])
+        // Make a circle if the angular rotation is 0 and the
+        // target is current position
+        angular_travel = 2. * M_PI;
+
+    // Determine number of segments
+    double linear_travel = target_pos[helical_axis] - start_pos[helical_axis];
+    double radius = hypot(r_p, r_q);
+    double flat_mm = radius * angular_travel;
+    double mm_of_travel = linear_travel ? hypot(flat_mm, linear_travel)
+                                        : fabs(flat_mm);
+    double segments = floor(mm_of_travel / mm_per_arc_segment);
+    if (segments < 1.)
+        segments = 1.;
+    int count = segments;
+    if (count > max_points)
+        return count;
+
+    // Generate coordinates
+    double theta_per_segment = angular_travel / segments;
+    double linear_per_segment = linear_travel / segments;
+    int i;
+    for (i = 1; i < count; i++) {
+        double dist_helical = i * linear_per_segment;
+        double cos_ti = cos(i * theta_per_segment);
+        double sin_ti = sin(i * theta_per_segment);
+        r_p = -offset_alpha * cos_ti + offset_beta * sin_ti;
+        r_q = -offset_alpha * sin_ti - offset_beta * cos_ti;
+        double *c = &out[(i - 1) * 3];
+        c[alpha_axis] = center_p + r_p;
+        c[beta_axis] = center_q + r_q;
+        c[helical_axis] = start_pos[helical_axis] + dist_helical;
+    }
+    double *c = &out[(count - 1) * 3];
+    c[0] = target_pos[0];
+    c[1] = target_pos[1];
+    c[2] = target_pos[2];
+    return count;
+}
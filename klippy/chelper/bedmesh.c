@@ -0,0 +1,174 @@
+// Bed mesh z adjustment lookup and move splitting
+//
+// Copyright (C) 2026  agent <agent@local>
+//
+// This file may be distributed under the terms of the GNU GPLv3 license.
+
+// The bed_mesh module interpolates the probed points into a finer
+// grid (using the configured lagrange or bicubic algorithm).  This
+// code stores that grid as a flat array and performs the bilinear
+// lookups of the grid, along with the splitting of moves into
+// segments that follow the mesh.
+
+#include <math.h> // floor
+#include <stdlib.h> // malloc
+#include <string.h> // memset
+#include "bedmesh.h" // struct bed_mesh
+#include "compiler.h" // __visible
+
+struct bed_mesh * __visible
+bed_mesh_alloc(void)
+{
+    struct bed_mesh *bm = malloc(sizeof(*bm));
+    memset(bm, 0, sizeof(*bm));
+    return bm;
+}
+
+void __visible
+bed_mesh_free(struct bed_mesh *bm)
+{
+    if (!bm)
+        return;
+    free(bm->z_matrix);
+    free(bm);
+}
+
+// Load the mesh grid (z_matrix is count_y rows of count_x entries)
+int __visible
+bed_mesh_set_grid(struct bed_mesh *bm, double min_x, double min_y
+                  , double dist_x, double dist_y
+                  , int count_x, int count_y, double *z_matrix)
+{
+    free(bm->z_matrix);
+    bm->z_matrix = NULL;
+    bm->count_x = bm->count_y = 0;
+    if (!z_matrix)
+        return 0;
+    if (count_x < 2 || count_y < 2)
+        return -1;
+    int size = count_x * count_y * sizeof(double);
+    bm->z_matrix = malloc(size);
+    if (!bm->z_matrix)
+        return -1;
+    memcpy(bm->z_matrix, z_matrix, size);
+    bm->min_x = min_x;
+    bm->min_y = min_y;
+    bm->dist_x = dist_x;
+    bm->dist_y = dist_y;
+    bm->count_x = count_x;
+    bm->count_y = count_y;
+    return 0;
+}
+
+void __visible
+bed_mesh_set_offsets(struct bed_mesh *bm, double offset_x, double offset_y)
+{
+    bm->offset_x = offset_x;
+    bm->offset_y = offset_y;
+}
+
+static inline double
+lerp(double t, double v0, double v1)
+{
+    return (1. - t) * v0 + t * v1;
+}
+
+// Find the grid index and interpolation factor of a coordinate
+static inline int
+linear_index(double coord, double mesh_min, double mesh_dist, int mesh_cnt
+             , double *pt)
+{
+    int idx = floor((coord - mesh_min) / mesh_dist);
+    if (idx < 0)
+        idx = 0;
+    else if (idx > mesh_cnt - 2)
+        idx = mesh_cnt - 2;
+    double t = (coord - (mesh_min + mesh_dist * idx)) / mesh_dist;
+    *pt = t < 0. ? 0. : (t > 1. ? 1. : t);
+    return idx;
+}
+
+// Return the mesh z adjustment at the given position
+double __visible
+bed_mesh_calc_z(struct bed_mesh *bm, double x, double y)
+{
+    if (!bm->z_matrix)
+        return 0.;
+    double tx, ty;
+    int xidx = linear_index(x + bm->offset_x, bm->min_x, bm->dist_x
+                            , bm->count_x, &tx);
+    int yidx = linear_index(y + bm->offset_y, bm->min_y, bm->dist_y
+                            , bm->count_y, &ty);
+    double *row0 = &bm->z_matrix[yidx * bm->count_x + xidx];
+    double *row1 = row0 + bm->count_x;
+    double z0 = lerp(tx, row0[0], row0[1]);
+    double z1 = lerp(tx, row1[0], row1[1]);
+    return lerp(ty, z0, z1);
+}
+
+static inline double
+calc_z_offset(struct bed_mesh *bm, double x, double y, double factor
+              , double fade_offset)
+{
+    double z = bed_mesh_calc_z(bm, x, y);
+    return factor * (z - fade_offset) + fade_offset;
+}
+
+// Split a move (from prev_pos to next_pos, each x,y,z,e) into segments
+// that follow the mesh.  The move is checked every move_check_distance
+// and a new segment is started wherever the z adjustment changed by
+// at least split_delta_z.  The adjusted end position of each segment
+// is stored in 'out' (4 entries per segment) and the number of
+// segments is returned (or -1 if 'out' is too small).
+int __visible
+bed_mesh_split_move(struct bed_mesh *bm, double *prev_pos, double *next_pos
+                    , double factor, double fade_offset
+                    , double move_check_distance, double split_delta_z
+                    , double *out, int max_points)
+{
+    double axes_d[4];
+    int axis_move[4], i, count = 0;
+    for (i=0; i<4; i++) {
+        axes_d[i] = next_pos[i] - prev_pos[i];
+        axis_move[i] = fabs(axes_d[i]) > 1e-10;
+    }
+    if (axis_move[0] || axis_move[1]) {
+        double total_move_length = sqrt(axes_d[0]*axes_d[0]
+                                        + axes_d[1]*axes_d[1]
+                                        + axes_d[2]*axes_d[2]);
+        double z_offset = calc_z_offset(bm, prev_pos[0], prev_pos[1]
+                                        , factor, fade_offset);
+        double pos[4] = { prev_pos[0], prev_pos[1], prev_pos[2]
+                          , prev_pos[3] };
+        double distance_checked = 0.;
+        while (distance_checked + move_check_distance < total_move_length) {
+            distance_checked += move_check_distance;
+            double t = distance_checked / total_move_length;
+            for (i=0; i<4; i++)
+                if (axis_move[i])
+                    pos[i] = lerp(t, prev_pos[i], next_pos[i]);
+            double next_z = calc_z_offset(bm, pos[0], pos[1]
+                                          , factor, fade_offset);
+            if (fabs(next_z - z_offset) < split_delta_z)
+                continue;
+            z_offset = next_z;
+            if (count >= max_points - 1)
+                return -1;
+            double *o = &out[count++ * 4];
+            o[0] = pos[0];
+            o[1] = pos[1];
+            o[2] = pos[2] + z_offset;
+            o[3] = pos[3];
+        }
+    }
+    // End of move reached
+    if (count >= max_points)
+        return -1;
+    double *o = &out[count++ * 4];
+    o[0] = next_pos[0];
+    o[1] = next_pos[1];
+    o[2] = next_pos[2] + calc_z_offset(bm, next_pos[0], next_pos[1]
+                                       , factor, fade_offset);
+    o[3] = next_pos[3];
+    return count;
+}
@@ -0,0 +1,24 @@
+#ifndef BEDMESH_H
+#define BEDMESH_H
+
+struct bed_mesh {
+    double min_x, min_y, dist_x, dist_y;
+    double offset_x, offset_y;
+    int count_x, count_y;
+    double *z_matrix;
+};
+
+struct bed_mesh *bed_mesh_alloc(void);
+void bed_mesh_free(struct bed_mesh *bm);
+int bed_mesh_set_grid(struct bed_mesh *bm, double min_x, double min_y
+                      , double dist_x, double dist_y
+                      , int count_x, int count_y, double *z_matrix);
+void bed_mesh_set_offsets(struct bed_mesh *bm, double offset_x
+                          , double offset_y);
+double bed_mesh_calc_z(struct bed_mesh *bm, double x, double y);
+int bed_mesh_split_move(struct bed_mesh *bm, double *prev_pos
+                        , double *next_pos, double factor
+                        , double fade_offset, double move_check_distance
+                        , double split_delta_z, double *out, int max_points);
+
+#endif // bedmesh.h
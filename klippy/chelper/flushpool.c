@@ -0,0 +1,156 @@
+// Flush the step queues of multiple micro-controllers in parallel
+//
+// Copyright (C) 2026  agent <agent@local>
+//
+// This file may be distributed under the terms of the GNU GPLv3 license.
+//
+// Each micro-controller has its own steppersync object (with its own
+// stepcompress objects and serialqueue), so the flush of one mcu does
+// not depend on the flush of another.  The calling thread runs jobs
+// alongside a small set of worker threads and returns once all the
+// jobs of a batch are complete.
+
+#include <pthread.h> // pthread_mutex_lock
+#include <stdlib.h> // malloc
+#include <string.h> // memset
+#include "compiler.h" // __visible
+#include "flushpool.h" // flushpool_alloc
+#include "pyhelper.h" // report_errno
+#include "stepcompress.h" // steppersync_flush
+
+struct flush_job {
+    struct steppersync *ss;
+    uint64_t move_clock, clear_history_clock;
+    int ret;
+};
+
+struct flushpool {
+    pthread_t *threads;
+    int num_threads, max_jobs;
+
+    pthread_mutex_t lock; // protects variables below
+    pthread_cond_t cond, done_cond;
+    int must_exit;
+    struct flush_job *jobs;
+    int num_jobs, next_job, jobs_done;
+};
+
+// Run the next pending job (called with the lock held)
+static void
+run_job(struct flushpool *fp)
+{
+    struct flush_job *job = &fp->jobs[fp->next_job++];
+    pthread_mutex_unlock(&fp->lock);
+    int ret = steppersync_flush(job->ss, job->move_clock
+                                , job->clear_history_clock);
+    pthread_mutex_lock(&fp->lock);
+    job->ret = ret;
+    fp->jobs_done++;
+    if (fp->jobs_done >= fp->num_jobs)
+        pthread_cond_signal(&fp->done_cond);
+}
+
+// Main code for worker threads
+static void *
+flushpool_thread(void *data)
+{
+    struct flushpool *fp = data;
+    pthread_mutex_lock(&fp->lock);
+    while (!fp->must_exit) {
+        if (fp->next_job < fp->num_jobs)
+            run_job(fp);
+        else
+            pthread_cond_wait(&fp->cond, &fp->lock);
+    }
+    pthread_mutex_unlock(&fp->lock);
+    return NULL;
+}
+
+// Create a pool able to flush 'max_jobs' steppersync objects at once
+struct flushpool * __visible
+flushpool_alloc(int max_jobs)
+{
+    struct flushpool *fp = malloc(sizeof(*fp));
+    memset(fp, 0, sizeof(*fp));
+    fp->max_jobs = max_jobs;
+    fp->jobs = malloc(sizeof(*fp->jobs) * max_jobs);
+    memset(fp->jobs, 0, sizeof(*fp->jobs) * max_jobs);
+    pthread_mutex_init(&fp->lock, NULL);
+    pthread_cond_init(&fp->cond, NULL);
+    pthread_cond_init(&fp->done_cond, NULL);
+    // The calling thread also runs jobs, so one fewer thread is needed
+    int num_threads = max_jobs > 1 ? max_jobs - 1 : 0;
+    fp->threads = malloc(sizeof(*fp->threads) * (num_threads + 1));
+    int i;
+    for (i=0; i<num_threads; i++) {
+        int ret = pthread_create(&fp->threads[i], NULL, flushpool_thread, fp);
+        if (ret) {
+            report_errno("pthread_create", ret);
+            break;
+        }
+        fp->num_threads++;
+    }
+    return fp;
+}
+
+// Stop the worker threads and free all resources
+void __visible
+flushpool_free(struct flushpool *fp)
+{
+    if (!fp)
+        return;
+    pthread_mutex_lock(&fp->lock);
+    fp->must_exit = 1;
+    pthread_cond_broadcast(&fp->cond);
+    pthread_mutex_unlock(&fp->lock);
+    int i;
+    for (i=0; i<fp->num_threads; i++) {
+        int ret = pthread_join(fp->threads[i], NULL);
+        if (ret)
+            report_errno("pthread_join", ret);
+    }
+    pthread_mutex_destroy(&fp->lock);
+    pthread_cond_destroy(&fp->cond);
+    pthread_cond_destroy(&fp->done_cond);
+    free(fp->threads);
+    free(fp->jobs);
+    free(fp);
+}
+
+// Run steppersync_flush() on each of the given steppersync objects and
+// wait for all of them to complete.  The return code of each flush is
+// stored in 'results'.  Returns non-zero if any flush failed.
+int __visible
+flushpool_flush(struct flushpool *fp, struct steppersync **ss_list
+                , uint64_t *move_clocks, uint64_t *clear_history_clocks
+                , int *results, int num)
+{
+    if (num > fp->max_jobs)
+        return -1;
+    pthread_mutex_lock(&fp->lock);
+    int i;
+    for (i=0; i<num; i++) {
+        struct flush_job *job = &fp->jobs[i];
+        job->ss = ss_list[i];
+        job->move_clock = move_clocks[i];
+        job->clear_history_clock = clear_history_clocks[i];
+        job->ret = 0;
+    }
+    fp->num_jobs = num;
+    fp->next_job = fp->jobs_done = 0;
+    if (num > 1)
+        pthread_cond_broadcast(&fp->cond);
+    while (fp->next_job < fp->num_jobs)
+        run_job(fp);
+    while (fp->jobs_done < fp->num_jobs)
+        pthread_cond_wait(&fp->done_cond, &fp->lock);
+    int res = 0;
+    for (i=0; i<num; i++) {
+        results[i] = fp->jobs[i].ret;
+        if (results[i])
+            res = results[i];
+    }
+    fp->num_jobs = fp->next_job = fp->jobs_done = 0;
+    pthread_mutex_unlock(&fp->lock);
+    return res;
+}
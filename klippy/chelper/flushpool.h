@@ -0,0 +1,13 @@
+#ifndef FLUSHPOOL_H
+#define FLUSHPOOL_H
+
+#include <stdint.h> // uint64_t
+
+struct steppersync;
+struct flushpool *flushpool_alloc(int max_jobs);
+void flushpool_free(struct flushpool *fp);
+int flushpool_flush(struct flushpool *fp, struct steppersync **ss_list
+                    , uint64_t *move_clocks, uint64_t *clear_history_clocks
+                    , int *results, int num);
+
+#endif // flushpool.h
@@ -0,0 +1,111 @@
+// Bed mesh z adjustment applied during step generation
+//
+// Copyright (C) 2026  agent <agent@local>
+//
+// This file may be distributed under the terms of the GNU GPLv3 license.
+
+// This wraps the kinematics of each stepper that moves the z axis.
+// The toolhead moves are left unmodified and the mesh (and fade)
+// adjustment is added to the requested z position at each step time
+// based on the toolhead xy position.  The toolhead z position is
+// offset from the requested (gcode) z position by a constant
+// 'z_shift' so that enabling the adjustment does not require a
+// change of the toolhead position.
+
+#include <stddef.h> // offsetof
+#include <stdlib.h> // malloc
+#include <string.h> // memset
+#include "bedmesh.h" // bed_mesh_calc_z
+#include "compiler.h" // __visible
+#include "itersolve.h" // struct stepper_kinematics
+#include "trapq.h" // struct move
+
+#define DUMMY_T 500.0
+
+struct bed_mesh_stepper {
+    struct stepper_kinematics sk;
+    struct stepper_kinematics *orig_sk;
+    struct move m;
+    struct bed_mesh *bm;
+    double fade_start, fade_end, fade_target, tool_offset, z_shift;
+};
+
+// Calculate the z adjustment at the given toolhead position
+static double
+calc_z_adjust(struct bed_mesh_stepper *bms, struct coord *c)
+{
+    double fade_z = c->z + bms->tool_offset, factor = 1.;
+    if (fade_z >= bms->fade_end)
+        factor = 0.;
+    else if (fade_z >= bms->fade_start)
+        factor = ((bms->fade_end - fade_z)
+                  / (bms->fade_end - bms->fade_start));
+    double z_adj = bms->fade_target;
+    if (factor)
+        z_adj += factor * (bed_mesh_calc_z(bms->bm, c->x, c->y)
+                           - bms->fade_target);
+    return z_adj;
+}
+
+static double
+bed_mesh_calc_position(struct stepper_kinematics *sk, struct move *m
+                       , double move_time)
+{
+    struct bed_mesh_stepper *bms = container_of(
+            sk, struct bed_mesh_stepper, sk);
+    if (!bms->bm)
+        return bms->orig_sk->calc_position_cb(bms->orig_sk, m, move_time);
+    struct coord pos = move_get_coord(m, move_time);
+    pos.z += bms->z_shift;
+    pos.z += calc_z_adjust(bms, &pos);
+    bms->m.start_pos = pos;
+    return bms->orig_sk->calc_position_cb(bms->orig_sk, &bms->m, DUMMY_T);
+}
+
+int __visible
+bed_mesh_kin_set_sk(struct stepper_kinematics *sk
+                    , struct stepper_kinematics *orig_sk)
+{
+    struct bed_mesh_stepper *bms = container_of(
+            sk, struct bed_mesh_stepper, sk);
+    if (!(orig_sk->active_flags & AF_Z))
+        return -1;
+    bms->sk.calc_position_cb = bed_mesh_calc_position;
+    bms->sk.active_flags = orig_sk->active_flags;
+    bms->orig_sk = orig_sk;
+    bms->sk.commanded_pos = orig_sk->commanded_pos;
+    bms->sk.last_flush_time = orig_sk->last_flush_time;
+    bms->sk.last_move_time = orig_sk->last_move_time;
+    return 0;
+}
+
+// Set the mesh to apply (or NULL to disable the z adjustment).  The
+// caller must flush step generation before changing the mesh.
+void __visible
+bed_mesh_kin_set_mesh(struct stepper_kinematics *sk, struct bed_mesh *bm
+                      , double fade_start, double fade_end
+                      , double fade_target, double tool_offset
+                      , double z_shift)
+{
+    struct bed_mesh_stepper *bms = container_of(
+            sk, struct bed_mesh_stepper, sk);
+    bms->bm = bm;
+    bms->fade_start = fade_start;
+    bms->fade_end = fade_end;
+    bms->fade_target = fade_target;
+    bms->tool_offset = tool_offset;
+    bms->z_shift = z_shift;
+    // With a mesh the stepper also moves during xy only moves
+    bms->sk.active_flags = bms->orig_sk->active_flags;
+    if (bm)
+        bms->sk.active_flags |= AF_X | AF_Y;
+}
+
+struct stepper_kinematics * __visible
+bed_mesh_kin_alloc(void)
+{
+    struct bed_mesh_stepper *bms = malloc(sizeof(*bms));
+    memset(bms, 0, sizeof(*bms));
+    bms->m.move_t = 2. * DUMMY_T;
+    return &bms->sk;
+}
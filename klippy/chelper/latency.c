@@ -0,0 +1,138 @@
+// Low overhead latency histograms for host pipeline instrumentation
+//
+// Copyright (C) 2026  agent <agent@local>
+//
+// This file may be distributed under the terms of the GNU GPLv3 license.
+
+// This code records the duration of host processing phases (gcode
+// handling, lookahead flushing, step generation, step compression,
+// serial transmit) into log-linear histograms.  Each histogram is
+// only updated from a single thread, so updates are just a few
+// relaxed atomic adds.  A reader (typically the main thread) may
+// summarize and reset a histogram at any time.
+
+#include <stdlib.h> // malloc
+#include <string.h> // memset
+#include <time.h> // clock_gettime
+#include "compiler.h" // __visible
+#include "latency.h" // struct latency_hist
+
+// Return the current monotonic time in nanoseconds.  This uses the
+// vdso clock_gettime() which avoids a syscall (and is implemented via
+// the cpu timestamp counter where one is available).
+uint64_t __visible
+latency_get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Allocate a new (zero'd) histogram
+struct latency_hist * __visible
+latency_hist_alloc(void)
+{
+    struct latency_hist *lh = malloc(sizeof(*lh));
+    memset(lh, 0, sizeof(*lh));
+    return lh;
+}
+
+// Determine the histogram bucket for a given duration
+static inline int
+bucket_index(uint64_t duration)
+{
+    if (duration < LATENCY_EXACT)
+        return duration;
+    int exp = 63 - __builtin_clzll(duration);
+    int sub = duration >> (exp - LATENCY_SUB_BITS);
+    sub &= (1 << LATENCY_SUB_BITS) - 1;
+    return LATENCY_EXACT + ((exp - 4) << LATENCY_SUB_BITS) + sub;
+}
+
+// Return the largest duration that is stored in a given bucket
+static uint64_t
+bucket_max(int idx)
+{
+    if (idx < LATENCY_EXACT)
+        return idx;
+    idx -= LATENCY_EXACT;
+    int exp = (idx >> LATENCY_SUB_BITS) + 4;
+    int sub = idx & ((1<<LATENCY_SUB_BITS)-1);
+    uint64_t width = 1ULL << (exp - LATENCY_SUB_BITS);
+    return ((1ULL << LATENCY_SUB_BITS) + sub) * width + width - 1;
+}
+
+// Record a duration (in nanoseconds)
+void __visible
+latency_hist_add(struct latency_hist *lh, uint64_t duration)
+{
+    if (!lh)
+        return;
+    __atomic_fetch_add(&lh->counts[bucket_index(duration)], 1
+                       , __ATOMIC_RELAXED);
+    __atomic_fetch_add(&lh->sum, duration, __ATOMIC_RELAXED);
+    if (duration > __atomic_load_n(&lh->max, __ATOMIC_RELAXED))
+        __atomic_store_n(&lh->max, duration, __ATOMIC_RELAXED);
+}
+
+// Record the time elapsed since 'start_time' (from latency_get_time())
+void __visible
+latency_hist_note(struct latency_hist *lh, uint64_t start_time)
+{
+    if (!lh)
+        return;
+    latency_hist_add(lh, latency_get_time() - start_time);
+}
+
+// Find the duration (in seconds) at a given quantile
+static double
+find_quantile(uint32_t *counts, uint64_t total, uint64_t max, double q)
+{
+    uint64_t rank = q * total + .5, seen = 0;
+    if (!rank)
+        rank = 1;
+    int i;
+    for (i=0; i<LATENCY_BUCKETS; i++) {
+        seen += counts[i];
+        if (seen >= rank)
+            break;
+    }
+    uint64_t val = bucket_max(i);
+    if (val > max)
+        val = max;
+    return val * .000000001;
+}
+
+// Report count, average, max, and p50/p99/p99.9 of a histogram
+void __visible
+latency_hist_summary(struct latency_hist *lh, struct pull_latency_summary *ls
+                     , int reset)
+{
+    memset(ls, 0, sizeof(*ls));
+    uint32_t counts[LATENCY_BUCKETS];
+    uint64_t total = 0, sum, max;
+    int i;
+    for (i=0; i<LATENCY_BUCKETS; i++) {
+        if (reset)
+            counts[i] = __atomic_exchange_n(&lh->counts[i], 0
+                                            , __ATOMIC_RELAXED);
+        else
+            counts[i] = __atomic_load_n(&lh->counts[i], __ATOMIC_RELAXED);
+        total += counts[i];
+    }
+    if (reset) {
+        sum = __atomic_exchange_n(&lh->sum, 0, __ATOMIC_RELAXED);
+        max = __atomic_exchange_n(&lh->max, 0, __ATOMIC_RELAXED);
+    } else {
+        sum = __atomic_load_n(&lh->sum, __ATOMIC_RELAXED);
+        max = __atomic_load_n(&lh->max, __ATOMIC_RELAXED);
+    }
+    if (!total)
+        return;
+    ls->count = total;
+    ls->avg = (double)sum / total * .000000001;
+    ls->max = max * .000000001;
+    ls->p50 = find_quantile(counts, total, max, .50);
+    ls->p99 = find_quantile(counts, total, max, .99);
+    ls->p999 = find_quantile(counts, total, max, .999);
+}
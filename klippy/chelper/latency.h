@@ -0,0 +1,28 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h> // uint64_t
+
+// Log-linear histogram: 16 exact buckets, then 8 buckets per power of 2
+#define LATENCY_EXACT 16
+#define LATENCY_SUB_BITS 3
+#define LATENCY_BUCKETS (LATENCY_EXACT + (64 - 4) * (1 << LATENCY_SUB_BITS))
+
+struct latency_hist {
+    uint32_t counts[LATENCY_BUCKETS];
+    uint64_t sum, max;
+};
+
+struct pull_latency_summary {
+    uint64_t count;
+    double avg, max, p50, p99, p999;
+};
+
+uint64_t latency_get_time(void);
+struct latency_hist *latency_hist_alloc(void);
+void latency_hist_add(struct latency_hist *lh, uint64_t duration);
+void latency_hist_note(struct latency_hist *lh, uint64_t start_time);
+void latency_hist_summary(struct latency_hist *lh
+                          , struct pull_latency_summary *ls, int reset);
+
+#endif // latency.h
@@ -5,11 +5,15 @@
 // This file may be distributed under the terms of the GNU GPLv3 license.
 
 #include <errno.h> // errno
+#include <malloc.h> // mallopt
 #include <stdarg.h> // va_start
 #include <stdint.h> // uint8_t
 #include <stdio.h> // fprintf
+#include <stdlib.h> // malloc
 #include <string.h> // strerror
+#include <sys/mman.h> // mlockall
 #include <time.h> // struct timespec
+#include <unistd.h> // sysconf
 #include "compiler.h" // __visible
 #include "pyhelper.h" // get_monotonic
 
@@ -34,6 +38,64 @@ fill_time(double time)
     return (struct timespec) {t, (time - t)*1000000000. };
 }
 
+// Lock all current and future memory of the process into ram.  If
+// 'prefault_size' is set then that amount of heap memory is touched
+// and retained so that later allocations do not incur page faults.
+int __visible
+sched_lock_memory(int prefault_size)
+{
+    if (prefault_size) {
+        // Keep freed memory in the heap and avoid mmap based allocations
+        mallopt(M_TRIM_THRESHOLD, -1);
+        mallopt(M_MMAP_MAX, 0);
+    }
+    int ret = mlockall(MCL_CURRENT | MCL_FUTURE);
+    if (ret) {
+        report_errno("mlockall", ret);
+        return ret;
+    }
+    if (!prefault_size)
+        return 0;
+    volatile char *buf = malloc(prefault_size);
+    if (!buf) {
+        errorf("Unable to allocate prefault memory");
+        return -1;
+    }
+    long page_size = sysconf(_SC_PAGESIZE), i;
+    for (i=0; i<prefault_size; i+=page_size)
+        buf[i] = 0;
+    free((void*)buf);
+    return 0;
+}
+
+// Measure how late the calling thread wakes from 'count' sleeps of
+// 'interval' seconds.  Stores the average and maximum in 'results'.
+void __visible
+sched_measure_jitter(int count, double interval, double *results)
+{
+    struct timespec ts, now;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    long interval_ns = interval * 1000000000.;
+    double total = 0., max = 0.;
+    int i;
+    for (i=0; i<count; i++) {
+        ts.tv_nsec += interval_ns;
+        while (ts.tv_nsec >= 1000000000) {
+            ts.tv_nsec -= 1000000000;
+            ts.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double late = ((double)(now.tv_sec - ts.tv_sec)
+                       + (double)(now.tv_nsec - ts.tv_nsec) * .000000001);
+        total += late;
+        if (late > max)
+            max = late;
+    }
+    results[0] = count ? total / count : 0.;
+    results[1] = max;
+}
+
 static void
 default_logger(const char *msg)
 {
@@ -3,6 +3,8 @@
 
 double get_monotonic(void);
 struct timespec fill_time(double time);
+int sched_lock_memory(int prefault_size);
+void sched_measure_jitter(int count, double interval, double *results);
 void set_python_logging_callback(void (*func)(const char *));
 void errorf(const char *fmt, ...) __attribute__ ((format (printf, 1, 2)));
 void report_errno(char *where, int rc);
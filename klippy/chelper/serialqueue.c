@@ -12,9 +12,11 @@
 // clock times, prioritizes commands, and handles retransmissions.  A
 // background thread is launched to do this work and minimize latency.
 
+#define _GNU_SOURCE // pthread_setaffinity_np
 #include <linux/can.h> // // struct can_frame
 #include <math.h> // fabs
 #include <pthread.h> // pthread_mutex_lock
+#include <sched.h> // CPU_SET
 #include <stddef.h> // offsetof
 #include <stdint.h> // uint64_t
 #include <stdio.h> // snprintf
@@ -23,6 +25,7 @@
 #include <termios.h> // tcflush
 #include <unistd.h> // pipe
 #include "compiler.h" // __visible
+#include "latency.h" // latency_hist_note
 #include "list.h" // list_add_tail
 #include "msgblock.h" // message_alloc
 #include "pollreactor.h" // pollreactor_alloc
@@ -72,6 +75,7 @@ struct serialqueue {
     struct list_head old_sent, old_receive;
     // Stats
     uint32_t bytes_write, bytes_read, bytes_retransmit, bytes_invalid;
+    struct latency_hist *transmit_hist;
 };
 
 #define SQPF_SERIAL 0
@@ -582,9 +586,10 @@ check_send_command(struct serialqueue *sq, int pending, double eventtime)
 static double
 command_event(struct serialqueue *sq, double eventtime)
 {
+    uint64_t start_time = latency_get_time();
     pthread_mutex_lock(&sq->lock);
     uint8_t buf[MESSAGE_MAX * MAX_PENDING_BLOCKS];
-    int buflen = 0;
+    int buflen = 0, did_write = 0;
     double waketime;
     for (;;) {
         waketime = check_send_command(sq, buflen, eventtime);
@@ -597,12 +602,15 @@ command_event(struct serialqueue *sq, double eventtime)
                                    ? eventtime : sq->idle_time);
                 sq->idle_time = idletime + calculate_bittime(sq, buflen);
                 buflen = 0;
+                did_write = 1;
             }
             if (waketime != PR_NOW)
                 break;
         }
         buflen += build_and_send_command(sq, &buf[buflen], buflen, eventtime);
     }
+    if (did_write)
+        latency_hist_note(sq->transmit_hist, start_time);
     pthread_mutex_unlock(&sq->lock);
     return waketime;
 }
@@ -692,6 +700,31 @@ fail:
     return NULL;
 }
 
+// Set the scheduling policy, priority, and allowed cpus of the
+// background thread
+int __visible
+serialqueue_set_sched(struct serialqueue *sq, int policy, int priority
+                      , int *cpus, int cpu_count)
+{
+    struct sched_param param = { .sched_priority = priority };
+    int ret = pthread_setschedparam(sq->tid, policy, &param);
+    if (ret) {
+        errorf("Unable to set serialqueue thread priority: %s", strerror(ret));
+        return ret;
+    }
+    if (!cpu_count)
+        return 0;
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    int i;
+    for (i=0; i<cpu_count; i++)
+        CPU_SET(cpus[i], &cpuset);
+    ret = pthread_setaffinity_np(sq->tid, sizeof(cpuset), &cpuset);
+    if (ret)
+        errorf("Unable to set serialqueue thread cpus: %s", strerror(ret));
+    return ret;
+}
+
 // Request that the background thread exit
 void __visible
 serialqueue_exit(struct serialqueue *sq)
@@ -896,6 +929,15 @@ serialqueue_set_receive_window(struct serialqueue *sq, int receive_window)
     pthread_mutex_unlock(&sq->lock);
 }
 
+// Record the time spent building and writing message blocks
+void __visible
+serialqueue_set_latency_hist(struct serialqueue *sq, struct latency_hist *lh)
+{
+    pthread_mutex_lock(&sq->lock);
+    sq->transmit_hist = lh;
+    pthread_mutex_unlock(&sq->lock);
+}
+
 // Set the estimated clock rate of the mcu on the other end of the
 // serial port
 void __visible
@@ -28,6 +28,8 @@ struct pull_queue_message {
 struct serialqueue;
 struct serialqueue *serialqueue_alloc(int serial_fd, char serial_fd_type
                                       , int client_id);
+int serialqueue_set_sched(struct serialqueue *sq, int policy, int priority
+                          , int *cpus, int cpu_count);
 void serialqueue_exit(struct serialqueue *sq);
 void serialqueue_free(struct serialqueue *sq);
 struct command_queue *serialqueue_alloc_commandqueue(void);
@@ -44,6 +46,9 @@ void serialqueue_send(struct serialqueue *sq, struct command_queue *cq
 void serialqueue_pull(struct serialqueue *sq, struct pull_queue_message *pqm);
 void serialqueue_set_wire_frequency(struct serialqueue *sq, double frequency);
 void serialqueue_set_receive_window(struct serialqueue *sq, int receive_window);
+struct latency_hist;
+void serialqueue_set_latency_hist(struct serialqueue *sq
+                                  , struct latency_hist *lh);
 void serialqueue_set_clock_est(struct serialqueue *sq, double est_freq
                                , double conv_time, uint64_t conv_clock
                                , uint64_t last_clock);
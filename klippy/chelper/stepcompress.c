@@ -21,6 +21,7 @@
 #include <stdlib.h> // malloc
 #include <string.h> // memset
 #include "compiler.h" // DIV_ROUND_UP
+#include "latency.h" // latency_hist_note
 #include "pyhelper.h" // errorf
 #include "serialqueue.h" // struct queue_message
 #include "stepcompress.h" // stepcompress_alloc
@@ -40,12 +41,17 @@ struct stepcompress {
     uint32_t oid;
     int32_t queue_step_msgtag, set_next_step_dir_msgtag;
     int sdir, invert_sdir;
+    // Encoded queue_step and queue_step_multi message prefixes
+    uint8_t step_prefix[MESSAGE_MAX], multi_prefix[MESSAGE_MAX];
+    int step_prefix_len, multi_prefix_len;
     // Step+dir+step filter
     uint64_t next_step_clock;
     int next_step_dir;
     // History tracking
     int64_t last_position;
     struct list_head history_list;
+    // Mcu move queue usage tracking
+    int move_slots, move_slots_peak;
 };
 
 struct step_move {
@@ -264,6 +270,30 @@ stepcompress_fill(struct stepcompress *sc, uint32_t max_error
     sc->set_next_step_dir_msgtag = set_next_step_dir_msgtag;
 }
 
+// Store the encoded form of a "msgtag oid" message prefix
+static int
+encode_prefix(uint8_t *buf, int32_t msgtag, uint32_t oid)
+{
+    uint32_t msg[2] = { msgtag, oid };
+    struct queue_message *qm = message_alloc_and_encode(msg, 2);
+    int len = qm->len;
+    memcpy(buf, qm->msg, len);
+    message_free(qm);
+    return len;
+}
+
+// Enable combining of consecutive queue_step commands into a single
+// queue_step_multi command
+void __visible
+stepcompress_fill_multi(struct stepcompress *sc
+                        , int32_t queue_step_multi_msgtag)
+{
+    sc->step_prefix_len = encode_prefix(sc->step_prefix
+                                        , sc->queue_step_msgtag, sc->oid);
+    sc->multi_prefix_len = encode_prefix(sc->multi_prefix
+                                         , queue_step_multi_msgtag, sc->oid);
+}
+
 // Set the inverted stepper direction flag
 void __visible
 stepcompress_set_invert_sdir(struct stepcompress *sc, uint32_t invert_sdir)
@@ -321,6 +351,18 @@ stepcompress_get_step_dir(struct stepcompress *sc)
     return sc->next_step_dir;
 }
 
+// Return the peak number of the most recently assigned mcu move queue
+// slots that were assigned to this stepper.  When the mcu move queue
+// is full this is the number of queue entries held by the stepper.
+int __visible
+stepcompress_get_move_slots_peak(struct stepcompress *sc, int reset)
+{
+    int peak = sc->move_slots_peak;
+    if (reset)
+        sc->move_slots_peak = sc->move_slots;
+    return peak;
+}
+
 // Determine the "print time" of the last_step_clock
 static void
 calc_last_step_print_time(struct stepcompress *sc)
@@ -683,9 +725,17 @@ struct steppersync {
     // Storage for associated stepcompress objects
     struct stepcompress **sc_list;
     int sc_num;
-    // Storage for list of pending move clocks
+    // Storage for list of pending move clocks (and the stepper that
+    // last used each mcu move queue slot)
     uint64_t *move_clocks;
+    struct stepcompress **move_owners;
     int num_move_clocks;
+    // Statistics on combined queue_step_multi commands
+    uint32_t multi_msgs, multi_moves, multi_bytes_saved;
+    // Latency tracking
+    struct latency_hist *sc_flush_hist, *flush_hist;
+    uint64_t flush_time_sum, flush_time_max;
+    uint32_t flush_count;
 };
 
 // Allocate a new 'steppersync' object
@@ -701,9 +751,14 @@ steppersync_alloc(struct serialqueue *sq, struct stepcompress **sc_list
     ss->sc_list = malloc(sizeof(*sc_list)*sc_num);
     memcpy(ss->sc_list, sc_list, sizeof(*sc_list)*sc_num);
     ss->sc_num = sc_num;
+    int i;
+    for (i=0; i<sc_num; i++)
+        sc_list[i]->move_slots = sc_list[i]->move_slots_peak = 0;
 
     ss->move_clocks = malloc(sizeof(*ss->move_clocks)*move_num);
     memset(ss->move_clocks, 0, sizeof(*ss->move_clocks)*move_num);
+    ss->move_owners = malloc(sizeof(*ss->move_owners)*move_num);
+    memset(ss->move_owners, 0, sizeof(*ss->move_owners)*move_num);
     ss->num_move_clocks = move_num;
 
     return ss;
@@ -717,6 +772,7 @@ steppersync_free(struct steppersync *ss)
         return;
     free(ss->sc_list);
     free(ss->move_clocks);
+    free(ss->move_owners);
     serialqueue_free_commandqueue(ss->cq);
     free(ss);
 }
@@ -733,6 +789,17 @@ steppersync_set_time(struct steppersync *ss, double time_offset
     }
 }
 
+// Record time spent flushing stepcompress objects (sc_flush_hist) and
+// time spent in all of steppersync_flush() (flush_hist)
+void __visible
+steppersync_set_latency_hists(struct steppersync *ss
+                              , struct latency_hist *sc_flush_hist
+                              , struct latency_hist *flush_hist)
+{
+    ss->sc_flush_hist = sc_flush_hist;
+    ss->flush_hist = flush_hist;
+}
+
 // Expire the stepcompress history before the given clock time
 static void
 steppersync_history_expire(struct steppersync *ss, uint64_t end_clock)
@@ -745,36 +812,124 @@ steppersync_history_expire(struct steppersync *ss, uint64_t end_clock)
     }
 }
 
+// Note that a stepper has taken over the mcu move queue slot that was
+// previously used by another stepper
+static void
+note_move_owner(struct stepcompress *prev, struct stepcompress *sc)
+{
+    if (prev)
+        prev->move_slots--;
+    sc->move_slots++;
+    if (sc->move_slots > sc->move_slots_peak)
+        sc->move_slots_peak = sc->move_slots;
+}
+
 // Implement a binary heap algorithm to track when the next available
 // 'struct move' in the mcu will be available
 static void
-heap_replace(struct steppersync *ss, uint64_t req_clock)
+heap_replace(struct steppersync *ss, uint64_t req_clock
+             , struct stepcompress *sc)
 {
     uint64_t *mc = ss->move_clocks;
+    struct stepcompress **mo = ss->move_owners;
     int nmc = ss->num_move_clocks, pos = 0;
+    note_move_owner(mo[0], sc);
     for (;;) {
         int child1_pos = 2*pos+1, child2_pos = 2*pos+2;
         uint64_t child2_clock = child2_pos < nmc ? mc[child2_pos] : UINT64_MAX;
         uint64_t child1_clock = child1_pos < nmc ? mc[child1_pos] : UINT64_MAX;
         if (req_clock <= child1_clock && req_clock <= child2_clock) {
             mc[pos] = req_clock;
+            mo[pos] = sc;
             break;
         }
         if (child1_clock < child2_clock) {
             mc[pos] = child1_clock;
+            mo[pos] = mo[child1_pos];
             pos = child1_pos;
         } else {
             mc[pos] = child2_clock;
+            mo[pos] = mo[child2_pos];
             pos = child2_pos;
         }
     }
 }
 
+// Check if a message is a queue_step command for the given stepper
+static int
+is_step_msg(struct stepcompress *sc, struct queue_message *qm)
+{
+    return (qm->len > sc->step_prefix_len
+            && !memcmp(qm->msg, sc->step_prefix, sc->step_prefix_len));
+}
+
+// Combine a queue_step command with any queue_step commands of the
+// same stepper that would otherwise be transmitted immediately after
+// it.  Each combined move still uses an mcu move queue slot, so a
+// move is only combined if its slot is already available at the
+// transmit time ('next_avail') of the first message.
+static void
+merge_step_msgs(struct steppersync *ss, struct stepcompress *sc
+                , struct queue_message *qm, uint64_t move_clock
+                , uint64_t next_avail)
+{
+    if (!sc->multi_prefix_len || !is_step_msg(sc, qm)
+        || list_is_last(&qm->node, &sc->msg_queue))
+        return;
+    // Find the next message of any other stepper
+    uint64_t other_clock = MAX_CLOCK;
+    int i;
+    for (i=0; i<ss->sc_num; i++) {
+        struct stepcompress *osc = ss->sc_list[i];
+        if (osc != sc && !list_empty(&osc->msg_queue)) {
+            struct queue_message *m = list_first_entry(
+                &osc->msg_queue, struct queue_message, node);
+            if (m->req_clock < other_clock)
+                other_clock = m->req_clock;
+        }
+    }
+    // Build "queue_step_multi oid=%c data=%*s" command
+    uint8_t buf[MESSAGE_PAYLOAD_MAX];
+    int data_pos = sc->multi_prefix_len + 1, prefix_len = sc->step_prefix_len;
+    int len = qm->len - prefix_len, orig_len = qm->len, moves = 1;
+    if (data_pos + len > MESSAGE_PAYLOAD_MAX)
+        return;
+    memcpy(&buf[data_pos], &qm->msg[prefix_len], len);
+    len += data_pos;
+    while (!list_is_last(&qm->node, &sc->msg_queue)) {
+        struct queue_message *m = list_next_entry(qm, node);
+        int mlen = m->len - prefix_len;
+        if (!m->min_clock || m->req_clock > move_clock
+            || m->req_clock > other_clock || !is_step_msg(sc, m)
+            || len + mlen > MESSAGE_PAYLOAD_MAX
+            || ss->move_clocks[0] > next_avail)
+            break;
+        memcpy(&buf[len], &m->msg[prefix_len], mlen);
+        len += mlen;
+        orig_len += m->len;
+        moves++;
+        heap_replace(ss, m->min_clock, sc);
+        list_del(&m->node);
+        message_free(m);
+    }
+    if (moves == 1)
+        return;
+    memcpy(buf, sc->multi_prefix, sc->multi_prefix_len);
+    buf[data_pos - 1] = len - data_pos;
+    memcpy(qm->msg, buf, len);
+    qm->len = len;
+    ss->multi_msgs++;
+    ss->multi_moves += moves;
+    ss->multi_bytes_saved += orig_len - len;
+}
+
 // Find and transmit any scheduled steps prior to the given 'move_clock'
 int __visible
 steppersync_flush(struct steppersync *ss, uint64_t move_clock
                   , uint64_t clear_history_clock)
 {
+    uint64_t start_time = latency_get_time();
+
     // Flush each stepcompress to the specified move_clock
     int i;
     for (i=0; i<ss->sc_num; i++) {
@@ -782,6 +937,7 @@ steppersync_flush(struct steppersync *ss, uint64_t move_clock
         if (ret)
             return ret;
     }
+    latency_hist_note(ss->sc_flush_hist, start_time);
 
     // Order commands by the reqclock of each pending command
     struct list_head msgs;
@@ -790,6 +946,7 @@ steppersync_flush(struct steppersync *ss, uint64_t move_clock
         // Find message with lowest reqclock
         uint64_t req_clock = MAX_CLOCK;
         struct queue_message *qm = NULL;
+        struct stepcompress *qm_sc = NULL;
         for (i=0; i<ss->sc_num; i++) {
             struct stepcompress *sc = ss->sc_list[i];
             if (!list_empty(&sc->msg_queue)) {
@@ -797,6 +954,7 @@ steppersync_flush(struct steppersync *ss, uint64_t move_clock
                     &sc->msg_queue, struct queue_message, node);
                 if (m->req_clock < req_clock) {
                     qm = m;
+                    qm_sc = sc;
                     req_clock = m->req_clock;
                 }
             }
@@ -805,11 +963,13 @@ steppersync_flush(struct steppersync *ss, uint64_t move_clock
             break;
 
         uint64_t next_avail = ss->move_clocks[0];
-        if (qm->min_clock)
+        if (qm->min_clock) {
             // The qm->min_clock field is overloaded to indicate that
             // the command uses the 'move queue' and to store the time
             // that move queue item becomes available.
-            heap_replace(ss, qm->min_clock);
+            heap_replace(ss, qm->min_clock, qm_sc);
+            merge_step_msgs(ss, qm_sc, qm, move_clock, next_avail);
+        }
         // Reset the min_clock to its normal meaning (minimum transmit time)
         qm->min_clock = next_avail;
 
@@ -823,5 +983,42 @@ steppersync_flush(struct steppersync *ss, uint64_t move_clock
         serialqueue_send_batch(ss->sq, ss->cq, &msgs);
 
     steppersync_history_expire(ss, clear_history_clock);
+    latency_hist_note(ss->flush_hist, start_time);
+    uint64_t flush_time = latency_get_time() - start_time;
+    ss->flush_time_sum += flush_time;
+    if (flush_time > ss->flush_time_max)
+        ss->flush_time_max = flush_time;
+    ss->flush_count++;
     return 0;
 }
+
+// Report statistics on combined queue_step_multi commands and on the
+// time spent in steppersync_flush() (optionally resetting the flush
+// time statistics)
+void __visible
+steppersync_get_stats(struct steppersync *ss, char *buf, int len, int reset)
+{
+    double flush_avg = 0.;
+    if (ss->flush_count)
+        flush_avg = (double)ss->flush_time_sum / ss->flush_count;
+    snprintf(buf, len, "step_multi_msgs=%u step_multi_moves=%u"
+             " step_bytes_saved=%u flush_avg=%.6f flush_max=%.6f"
+             , ss->multi_msgs, ss->multi_moves, ss->multi_bytes_saved
+             , flush_avg * .000000001, ss->flush_time_max * .000000001);
+    if (reset) {
+        ss->flush_time_sum = ss->flush_time_max = 0;
+        ss->flush_count = 0;
+    }
+}
+
+// Return the number of mcu move queue slots that are still in use at
+// the given clock
+int __visible
+steppersync_get_queue_usage(struct steppersync *ss, uint64_t clock)
+{
+    int i, count = 0;
+    for (i=0; i<ss->num_move_clocks; i++)
+        if (ss->move_clocks[i] > clock)
+            count++;
+    return count;
+}
@@ -15,11 +15,14 @@ struct stepcompress *stepcompress_alloc(uint32_t oid);
 void stepcompress_fill(struct stepcompress *sc, uint32_t max_error
                        , int32_t queue_step_msgtag
                        , int32_t set_next_step_dir_msgtag);
+void stepcompress_fill_multi(struct stepcompress *sc
+                             , int32_t queue_step_multi_msgtag);
 void stepcompress_set_invert_sdir(struct stepcompress *sc
                                   , uint32_t invert_sdir);
 void stepcompress_free(struct stepcompress *sc);
 uint32_t stepcompress_get_oid(struct stepcompress *sc);
 int stepcompress_get_step_dir(struct stepcompress *sc);
+int stepcompress_get_move_slots_peak(struct stepcompress *sc, int reset);
 int stepcompress_append(struct stepcompress *sc, int sdir
                         , double print_time, double step_time);
 int stepcompress_commit(struct stepcompress *sc);
@@ -42,7 +45,14 @@ struct steppersync *steppersync_alloc(
 void steppersync_free(struct steppersync *ss);
 void steppersync_set_time(struct steppersync *ss, double time_offset
                           , double mcu_freq);
+struct latency_hist;
+void steppersync_set_latency_hists(struct steppersync *ss
+                                   , struct latency_hist *sc_flush_hist
+                                   , struct latency_hist *flush_hist);
 int steppersync_flush(struct steppersync *ss, uint64_t move_clock
                       , uint64_t clear_history_clock);
+void steppersync_get_stats(struct steppersync *ss, char *buf, int len
+                           , int reset);
+int steppersync_get_queue_usage(struct steppersync *ss, uint64_t clock);
 
 #endif // stepcompress.h
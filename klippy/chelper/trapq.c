@@ -9,6 +9,7 @@
 #include <stdlib.h> // malloc
 #include <string.h> // memset
 #include "compiler.h" // unlikely
+#include "latency.h" // latency_hist_note
 #include "trapq.h" // move_get_coord
 
 // Allocate a new 'move' object
@@ -123,6 +124,7 @@ trapq_append(struct trapq *tq, double print_time
              , double axes_r_x, double axes_r_y, double axes_r_z
              , double start_v, double cruise_v, double accel)
 {
+    uint64_t start_time = tq->append_hist ? latency_get_time() : 0;
     struct coord start_pos = { .x=start_pos_x, .y=start_pos_y, .z=start_pos_z };
     struct coord axes_r = { .x=axes_r_x, .y=axes_r_y, .z=axes_r_z };
     if (accel_t) {
@@ -161,6 +163,7 @@ trapq_append(struct trapq *tq, double print_time
         m->axes_r = axes_r;
         trapq_add_move(tq, m);
     }
+    latency_hist_note(tq->append_hist, start_time);
 }
 
 // Expire any moves older than `print_time` from the trapezoid velocity queue
@@ -254,3 +257,10 @@ trapq_extract_old(struct trapq *tq, struct pull_move *p, int max
     }
     return res;
 }
+
+// Record the time spent in trapq_append() in the given histogram
+void __visible
+trapq_set_latency_hist(struct trapq *tq, struct latency_hist *lh)
+{
+    tq->append_hist = lh;
+}
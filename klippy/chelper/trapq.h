@@ -20,8 +20,10 @@ struct move {
     struct list_node node;
 };
 
+struct latency_hist;
 struct trapq {
     struct list_head moves, history;
+    struct latency_hist *append_hist;
 };
 
 struct pull_move {
@@ -49,5 +51,6 @@ void trapq_set_position(struct trapq *tq, double print_time
                         , double pos_x, double pos_y, double pos_z);
 int trapq_extract_old(struct trapq *tq, struct pull_move *p, int max
                       , double start_time, double end_time);
+void trapq_set_latency_hist(struct trapq *tq, struct latency_hist *lh);
 
 #endif // trapq.h
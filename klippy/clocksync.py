@@ -8,6 +8,10 @@ import logging, math
 RTT_AGE = .000010 / (60. * 60.)
 DECAY = 1. / 30.
 TRANSMIT_EXTRA = .001
+# Kalman filter noise model (as a fraction of the mcu frequency)
+FREQ_DRIFT = .000000200
+SAMPLE_JITTER = .000020
+INITIAL_FREQ_ERROR = .001
 
 class ClockSync:
     def __init__(self, reactor):
@@ -22,9 +26,15 @@ class ClockSync:
         # Minimum round-trip-time tracking
         self.min_half_rtt = 999999999.9
         self.min_rtt_time = 0.
-        # Linear regression of mcu clock and system sent_time
-        self.time_avg = self.time_variance = 0.
-        self.clock_avg = self.clock_covariance = 0.
+        # Kalman filter of mcu clock and frequency at system sent_time.
+        # The frequency is modeled as a random walk (crystal drift) and
+        # each sample has a timing noise that grows with its round-trip
+        # time (transmission jitter).
+        self.kf_time = self.kf_clock = 0.
+        self.kf_freq = 1.
+        self.kf_cov = (0., 0., 0.)
+        self.innovation_ratio = 1.
+        self.drift_variance = self.jitter_variance = 0.
         self.prediction_variance = 0.
         self.last_prediction_time = 0.
     def connect(self, serial):
@@ -33,9 +43,14 @@ class ClockSync:
         # Load initial clock and frequency
         params = serial.send_with_response('get_uptime', 'uptime')
         self.last_clock = (params['high'] << 32) | params['clock']
-        self.clock_avg = self.last_clock
-        self.time_avg = params['#sent_time']
-        self.clock_est = (self.time_avg, self.clock_avg, self.mcu_freq)
+        self.kf_clock = self.last_clock
+        self.kf_time = params['#sent_time']
+        self.kf_freq = self.mcu_freq
+        self.kf_cov = ((.001 * self.mcu_freq)**2, 0.,
+                       (INITIAL_FREQ_ERROR * self.mcu_freq)**2)
+        self.drift_variance = (FREQ_DRIFT * self.mcu_freq)**2
+        self.jitter_variance = (SAMPLE_JITTER * self.mcu_freq)**2
+        self.clock_est = (self.kf_time, self.kf_clock, self.mcu_freq)
         self.prediction_variance = (.001 * self.mcu_freq)**2
         # Enable periodic get_clock timer
         for i in range(8):
@@ -80,45 +95,63 @@ class ClockSync:
             self.min_rtt_time = sent_time
             logging.debug("new minimum rtt %.3f: hrtt=%.6f freq=%d",
                           sent_time, half_rtt, self.clock_est[2])
+        # Predict the clock at sent_time and the variance of that prediction
+        exp_clock, p00, p01, p11 = self._predict(sent_time)
+        excess_rtt = half_rtt - self.min_half_rtt
+        sample_variance = self.jitter_variance + (excess_rtt*self.mcu_freq)**2
+        clock_diff = clock - exp_clock
+        clock_diff2 = clock_diff**2
         # Filter out samples that are extreme outliers
-        exp_clock = ((sent_time - self.time_avg) * self.clock_est[2]
-                     + self.clock_avg)
-        clock_diff2 = (clock - exp_clock)**2
-        if (clock_diff2 > 25. * self.prediction_variance
+        if (clock_diff2 > 25. * max(self.prediction_variance,
+                                    p00 + sample_variance)
             and clock_diff2 > (.000500 * self.mcu_freq)**2):
             if clock > exp_clock and sent_time < self.last_prediction_time+10.:
                 logging.debug("Ignoring clock sample %.3f:"
                               " freq=%d diff=%d stddev=%.3f",
-                              sent_time, self.clock_est[2], clock - exp_clock,
+                              sent_time, self.clock_est[2], clock_diff,
                               math.sqrt(self.prediction_variance))
                 return
             logging.info("Resetting prediction variance %.3f:"
                          " freq=%d diff=%d stddev=%.3f",
-                         sent_time, self.clock_est[2], clock - exp_clock,
+                         sent_time, self.clock_est[2], clock_diff,
                          math.sqrt(self.prediction_variance))
             self.prediction_variance = (.001 * self.mcu_freq)**2
+            p00, p01 = self.prediction_variance, 0.
         else:
             self.last_prediction_time = sent_time
             self.prediction_variance = (
                 (1. - DECAY) * (self.prediction_variance + clock_diff2 * DECAY))
-        # Add clock and sent_time to linear regression
-        diff_sent_time = sent_time - self.time_avg
-        self.time_avg += DECAY * diff_sent_time
-        self.time_variance = (1. - DECAY) * (
-            self.time_variance + diff_sent_time**2 * DECAY)
-        diff_clock = clock - self.clock_avg
-        self.clock_avg += DECAY * diff_clock
-        self.clock_covariance = (1. - DECAY) * (
-            self.clock_covariance + diff_sent_time * diff_clock * DECAY)
-        # Update prediction from linear regression
-        new_freq = self.clock_covariance / self.time_variance
+        # Track how well the noise model matches the observed samples
+        innovation_variance = p00 + sample_variance
+        self.innovation_ratio = (1. - DECAY) * self.innovation_ratio + DECAY * (
+            clock_diff2 / innovation_variance)
+        # Apply sample to Kalman filter
+        gain_clock = p00 / innovation_variance
+        gain_freq = p01 / innovation_variance
+        self.kf_time = sent_time
+        self.kf_clock = exp_clock + gain_clock * clock_diff
+        self.kf_freq += gain_freq * clock_diff
+        self.kf_cov = ((1. - gain_clock) * p00, (1. - gain_clock) * p01,
+                       p11 - gain_freq * p01)
+        # Update prediction
+        new_freq = self.kf_freq
         pred_stddev = math.sqrt(self.prediction_variance)
-        self.serial.set_clock_est(new_freq, self.time_avg + TRANSMIT_EXTRA,
-                                  int(self.clock_avg - 3. * pred_stddev), clock)
-        self.clock_est = (self.time_avg + self.min_half_rtt,
-                          self.clock_avg, new_freq)
-        #logging.debug("regr %.3f: freq=%.3f d=%d(%.3f)",
-        #              sent_time, new_freq, clock - exp_clock, pred_stddev)
+        self.serial.set_clock_est(new_freq, self.kf_time + TRANSMIT_EXTRA,
+                                  int(self.kf_clock - 3. * pred_stddev), clock)
+        self.clock_est = (self.kf_time + self.min_half_rtt,
+                          self.kf_clock, new_freq)
+        #logging.debug("kalman %.3f: freq=%.3f d=%d(%.3f)",
+        #              sent_time, new_freq, clock_diff, pred_stddev)
+    def _predict(self, sample_time):
+        # Extrapolate the filter state and covariance to sample_time
+        dt = sample_time - self.kf_time
+        adt = abs(dt)
+        p00, p01, p11 = self.kf_cov
+        q = self.drift_variance
+        return (self.kf_clock + dt * self.kf_freq,
+                p00 + 2. * dt * p01 + dt**2 * p11 + q * adt**3 / 3.,
+                p01 + dt * p11 + q * dt * adt / 2.,
+                p11 + q * adt)
     # clock frequency conversions
     def print_time_to_clock(self, print_time):
         return int(print_time * self.mcu_freq)
@@ -133,6 +166,15 @@ class ClockSync:
         return float(reqclock - clock)/freq + sample_time
     def estimated_print_time(self, eventtime):
         return self.clock_to_print_time(self.get_clock(eventtime))
+    def get_clock_error(self, eventtime):
+        # Return a three sigma bound (in seconds) on the error of the
+        # estimated mcu clock at the given system time
+        if self.serial is None or not self.kf_time:
+            return 0.
+        p00 = self._predict(eventtime - self.min_half_rtt)[1]
+        # Widen the bound if samples deviate more than the model expects
+        p00 *= max(1., self.innovation_ratio)
+        return 3. * math.sqrt(max(0., p00)) / self.mcu_freq
     # misc commands
     def clock32_to_clock64(self, clock32):
         last_clock = self.last_clock
@@ -145,16 +187,17 @@ class ClockSync:
         sample_time, clock, freq = self.clock_est
         return ("clocksync state: mcu_freq=%d last_clock=%d"
                 " clock_est=(%.3f %d %.3f) min_half_rtt=%.6f min_rtt_time=%.3f"
-                " time_avg=%.3f(%.3f) clock_avg=%.3f(%.3f)"
+                " kf=(%.3f %.3f %.3f) kf_cov=(%.3f %.3f %.3f)"
                 " pred_variance=%.3f" % (
                     self.mcu_freq, self.last_clock, sample_time, clock, freq,
                     self.min_half_rtt, self.min_rtt_time,
-                    self.time_avg, self.time_variance,
-                    self.clock_avg, self.clock_covariance,
+                    self.kf_time, self.kf_clock, self.kf_freq,
+                    self.kf_cov[0], self.kf_cov[1], self.kf_cov[2],
                     self.prediction_variance))
     def stats(self, eventtime):
         sample_time, clock, freq = self.clock_est
-        return "freq=%d" % (freq,)
+        return "freq=%d clock_err=%.6f" % (
+            freq, self.get_clock_error(eventtime))
     def calibrate_clock(self, print_time, eventtime):
         return (0., self.mcu_freq)
 
@@ -184,6 +227,11 @@ class SecondarySync(ClockSync):
     def clock_to_print_time(self, clock):
         adjusted_offset, adjusted_freq = self.clock_adj
         return clock / adjusted_freq + adjusted_offset
+    def get_clock_error(self, eventtime):
+        # Errors in both clock estimates contribute to the print_time error
+        local_err = ClockSync.get_clock_error(self, eventtime)
+        main_err = self.main_sync.get_clock_error(eventtime)
+        return math.sqrt(local_err**2 + main_err**2)
     # misc commands
     def dump_debug(self):
         adjusted_offset, adjusted_freq = self.clock_adj
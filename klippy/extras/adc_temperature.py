@@ -28,6 +28,11 @@ class PrinterADCtoTemperature:
         self.temperature_callback = temperature_callback
     def get_report_time_delta(self):
         return REPORT_TIME
+    def setup_mcu_control(self, report_time):
+        # Measurements are handled by an mcu based heater control loop
+        self.mcu_adc.setup_adc_callback(report_time, None)
+        return (self.mcu_adc, self.adc_convert, SAMPLE_COUNT * SAMPLE_TIME,
+                SAMPLE_COUNT)
     def adc_callback(self, read_time, read_value):
         temp = self.adc_convert.calc_temp(read_value)
         self.temperature_callback(read_time + SAMPLE_COUNT * SAMPLE_TIME, temp)
@@ -30,6 +30,9 @@ SCALE_Z  = 0.003906 * FREEFALL_ACCEL # 1 / 256 (at 3.3V) mg/LSB
 Accel_Measurement = collections.namedtuple(
     'Accel_Measurement', ('time', 'accel_x', 'accel_y', 'accel_z'))
 
+CAPTURE_COLUMNS = [('time', 'f8'), ('accel_x', 'f4'), ('accel_y', 'f4'),
+                   ('accel_z', 'f4')]
+
 # Helper class to obtain measurements
 class AccelQueryHelper:
     def __init__(self, printer):
@@ -37,22 +40,62 @@ class AccelQueryHelper:
         self.is_finished = False
         print_time = printer.lookup_object('toolhead').get_last_move_time()
         self.request_start_time = self.request_end_time = print_time
+        self.is_end_time_set = False
         self.msgs = []
         self.samples = []
+        self.keep_msgs = True
+        self.sample_handlers = []
+        self.streamed_count = 0
+        self.capture = None
+    def add_sample_handler(self, handler, keep_msgs=False):
+        # Pass the samples to 'handler' as they arrive (and only retain
+        # the raw messages if 'keep_msgs' is set)
+        self.sample_handlers.append(handler)
+        self.keep_msgs = keep_msgs
+    def start_capture(self, filename, fmt, metadata=None):
+        # Write the samples to a file as they arrive
+        self.capture = bulk_sensor.CaptureWriter(filename, CAPTURE_COLUMNS,
+                                                 metadata, fmt)
+        self.add_sample_handler(self.capture.add_samples)
+    def finish_capture(self, filename=None):
+        # Complete the capture file (optionally renaming it)
+        capture = self.capture
+        self.capture = None
+        return capture.finish(filename)
     def finish_measurements(self):
         toolhead = self.printer.lookup_object('toolhead')
         self.request_end_time = toolhead.get_last_move_time()
+        self.is_end_time_set = True
         toolhead.wait_moves()
         self.is_finished = True
+    def _stream_samples(self, data):
+        start_time = self.request_start_time
+        if self.is_end_time_set:
+            end_time = self.request_end_time
+            samples = [s for s in data if start_time <= s[0] <= end_time]
+        else:
+            samples = [s for s in data if s[0] >= start_time]
+        if samples:
+            self.streamed_count += len(samples)
+            for handler in self.sample_handlers:
+                handler(samples)
     def handle_batch(self, msg):
         if self.is_finished:
             return False
-        if len(self.msgs) >= 10000:
-            # Avoid filling up memory with too many samples
+        if self.keep_msgs and len(self.msgs) >= 10000:
+            # Avoid filling up memory with too many samples - stop the
+            # capture so the kept messages match the streamed samples
+            logging.warning("Accelerometer capture stopped after %d messages",
+                            len(self.msgs))
             return False
-        self.msgs.append(msg)
+        if self.sample_handlers:
+            self._stream_samples(msg['data'])
+        if self.keep_msgs:
+            self.msgs.append(msg)
         return True
     def has_valid_samples(self):
+        if self.streamed_count:
+            return True
         for msg in self.msgs:
             data = msg['data']
             first_sample_time = data[0][0]
@@ -109,6 +152,7 @@ class AccelCommandHelper:
         self.printer = config.get_printer()
         self.chip = chip
         self.bg_client = None
+        self.capture_ext = ".bin"
         name_parts = config.get_name().split()
         self.base_name = name_parts[0]
         self.name = name_parts[-1]
@@ -133,9 +177,26 @@ class AccelCommandHelper:
                                    desc=self.cmd_ACCELEROMETER_DEBUG_WRITE_help)
     cmd_ACCELEROMETER_MEASURE_help = "Start/stop accelerometer"
     def cmd_ACCELEROMETER_MEASURE(self, gcmd):
+        if self.base_name == self.name:
+            prefix = "/tmp/%s-" % (self.base_name,)
+        else:
+            prefix = "/tmp/%s-%s-" % (self.base_name, self.name)
         if self.bg_client is None:
-            # Start measurements
-            self.bg_client = self.chip.start_internal_client()
+            # Start measurements (recorded to a temporary file)
+            fmt = gcmd.get("FORMAT", "binary").lower()
+            if fmt not in bulk_sensor.CAPTURE_FORMATS:
+                raise gcmd.error("Invalid FORMAT parameter")
+            bg_client = self.chip.start_internal_client()
+            try:
+                bg_client.start_capture(
+                    prefix + "capture.tmp", fmt,
+                    {'sensor': self.base_name, 'name': self.name})
+            except (IOError, OSError) as e:
+                bg_client.finish_measurements()
+                raise gcmd.error("Unable to create capture file: %s"
+                                 % (str(e),))
+            self.bg_client = bg_client
+            self.capture_ext = ".csv" if fmt == "csv" else ".bin"
             gcmd.respond_info("accelerometer measurements started")
             return
         # End measurements
@@ -145,12 +206,11 @@ class AccelCommandHelper:
         bg_client = self.bg_client
         self.bg_client = None
         bg_client.finish_measurements()
-        # Write data to file
-        if self.base_name == self.name:
-            filename = "/tmp/%s-%s.csv" % (self.base_name, name)
-        else:
-            filename = "/tmp/%s-%s-%s.csv" % (self.base_name, self.name, name)
-        bg_client.write_to_file(filename)
+        filename = prefix + name + self.capture_ext
+        try:
+            bg_client.finish_capture(filename)
+        except (IOError, OSError) as e:
+            raise gcmd.error("Error writing %s: %s" % (filename, str(e)))
         gcmd.respond_info("Writing raw accelerometer data to %s file"
                           % (filename,))
     cmd_ACCELEROMETER_QUERY_help = "Query accelerometer for the current values"
@@ -3,7 +3,7 @@
 # Copyright (C) 2021,2022  Kevin O'Connor <kevin@koconnor.net>
 #
 # This file may be distributed under the terms of the GNU GPLv3 license.
-import logging, math
+import importlib, logging, math
 from . import bus, bulk_sensor
 
 MIN_MSG_TIME = 0.100
@@ -20,6 +20,7 @@ class AngleCalibration:
         self.printer = config.get_printer()
         self.name = config.get_name()
         self.stepper_name = config.get('stepper', None)
+        self.calibration = []
         if self.stepper_name is None:
             # No calibration
             return
@@ -34,7 +35,6 @@ class AngleCalibration:
         self.mcu_pos_offset = None
         self.angle_phase_offset = 0.
         self.calibration_reversed = False
-        self.calibration = []
         cal = config.get('calibrate', None)
         if cal is not None:
             data = [d.strip() for d in cal.split(',')]
@@ -96,6 +96,31 @@ class AngleCalibration:
             if self.mcu_pos_offset is None:
                 return None
         return self.mcu_stepper.mcu_to_commanded_position(self.mcu_pos_offset)
+    def apply_calibration_array(self, np, times, angles):
+        # Numpy version of apply_calibration() - returns the calibrated
+        # angles array and the position offset
+        if not self.calibration:
+            return angles, None
+        calibration = np.array(self.calibration, dtype=np.int64)
+        interp_bits = ANGLE_BITS - CALIBRATION_BITS
+        interp_mask = (1 << interp_bits) - 1
+        interp_round = 1 << (interp_bits - 1)
+        bucket = (angles & 0xffff) >> interp_bits
+        cal1 = calibration[bucket]
+        cal2 = calibration[bucket + 1]
+        adj = (angles & interp_mask) * (cal2 - cal1)
+        adj = cal1 + ((adj + interp_round) >> interp_bits)
+        angle_diff = (adj - angles) & 0xffff
+        angle_diff -= (angle_diff & 0x8000) << 1
+        new_angles = angles + angle_diff
+        if self.calibration_reversed:
+            new_angles = -new_angles
+        if self.mcu_pos_offset is None:
+            self.calc_mcu_pos_offset((float(times[0]), int(new_angles[0])))
+            if self.mcu_pos_offset is None:
+                return new_angles, None
+        offset = self.mcu_stepper.mcu_to_commanded_position(self.mcu_pos_offset)
+        return new_angles, offset
     def load_calibration(self, angles):
         # Calculate linear intepolation calibration buckets by solving
         # linear equations
@@ -422,6 +447,11 @@ class Angle:
         self.printer = config.get_printer()
         self.sample_period = config.getfloat('sample_period', SAMPLE_PERIOD,
                                              above=0.)
+        # Use numpy (if available) to process samples
+        try:
+            self.numpy = importlib.import_module('numpy')
+        except ImportError:
+            self.numpy = None
         self.calibration = AngleCalibration(config)
         # Measurement conversion
         self.start_clock = self.time_shift = self.sample_ticks = 0
@@ -522,6 +552,64 @@ class Angle:
         self.last_angle = last_angle
         del samples[count:]
         return samples, error_count
+    def _extract_samples_array(self, raw_samples):
+        # Numpy version of _extract_samples() - returns arrays of the
+        # sample times and angles
+        np = self.numpy
+        # Gather the data of every message in raw_samples
+        last_sequence = self.last_sequence
+        sequences = []
+        counts = []
+        data = []
+        for params in raw_samples:
+            seq_diff = (params['sequence'] - last_sequence) & 0xffff
+            last_sequence += seq_diff
+            d = bytes(params['data'])
+            count = len(d) // BYTES_PER_SAMPLE
+            sequences.append(last_sequence)
+            counts.append(count)
+            data.append(d[:count * BYTES_PER_SAMPLE])
+        self.last_sequence = last_sequence
+        d = np.frombuffer(b"".join(data), dtype=np.uint8).astype(np.int64)
+        d = d.reshape(-1, BYTES_PER_SAMPLE)
+        counts = np.array(counts, dtype=np.int64)
+        msg_starts = np.cumsum(counts) - counts
+        samp_count = (np.repeat(np.array(sequences, dtype=np.int64)
+                                * SAMPLES_PER_BLOCK - msg_starts, counts)
+                      + np.arange(d.shape[0]))
+        # Discard errors
+        tcode = d[:, 0]
+        valid = tcode != TCODE_ERROR
+        error_count = int(d.shape[0] - np.count_nonzero(valid))
+        tcode = tcode[valid]
+        raw_angle = d[valid, 1] | (d[valid, 2] << 8)
+        mclock = self.start_clock + samp_count[valid] * self.sample_ticks
+        if not raw_angle.shape[0]:
+            return raw_angle, raw_angle, error_count
+        # Unwrap angles
+        angle_diff = np.diff(raw_angle, prepend=self.last_angle) & 0xffff
+        angle_diff -= (angle_diff & 0x8000) << 1
+        angles = self.last_angle + np.cumsum(angle_diff)
+        self.last_angle = int(angles[-1])
+        # Calculate sample times
+        if self.sensor_helper.is_tcode_absolute:
+            # tcode is tle5012b frame counter
+            tparams = self.sensor_helper.get_tcode_params()
+            last_chip_mcu_clock, last_chip_clock, chip_freq = tparams
+            mdiff = mclock - last_chip_mcu_clock
+            chip_mclock = last_chip_clock + np.trunc(
+                mdiff * chip_freq + .5).astype(np.int64)
+            cdiff = ((tcode << 10) - chip_mclock) & 0xffff
+            cdiff -= (cdiff & 0x8000) << 1
+            sclock = mclock + (cdiff - 0x800) * (1. / chip_freq)
+            static_delay = 0.
+        else:
+            # tcode is mcu clock offset shifted by time_shift
+            sclock = mclock + (tcode << self.time_shift)
+            static_delay = self.sensor_helper.get_static_delay()
+        ptimes = np.round(self.mcu.clock_to_print_time(sclock)
+                          - static_delay, 6)
+        return ptimes, angles, error_count
     # Start, stop, and process message batches
     def _is_measuring(self):
         return self.start_clock != 0
@@ -550,12 +638,23 @@ class Angle:
         raw_samples = self.bulk_queue.pull_queue()
         if not raw_samples:
             return {}
+        if self.numpy is not None:
+            return self._process_samples_array(raw_samples)
         samples, error_count = self._extract_samples(raw_samples)
         if not samples:
             return {}
         offset = self.calibration.apply_calibration(samples)
         return {'data': samples, 'errors': error_count,
                 'position_offset': offset}
+    def _process_samples_array(self, raw_samples):
+        ptimes, angles, error_count = self._extract_samples_array(raw_samples)
+        if not angles.shape[0]:
+            return {}
+        angles, offset = self.calibration.apply_calibration_array(
+            self.numpy, ptimes, angles)
+        samples = list(zip(ptimes.tolist(), angles.tolist()))
+        return {'data': samples, 'errors': error_count,
+                'position_offset': offset}
 
 def load_config_prefix(config):
     return Angle(config)
@@ -4,6 +4,7 @@
 #
 # This file may be distributed under the terms of the GNU GPLv3 license.
 import logging, math, json, collections
+import chelper
 from . import probe
 
 PROFILE_VERSION = 1
@@ -105,6 +106,22 @@ class BedMesh:
         self.tool_offset = 0.
         self.gcode = self.printer.lookup_object('gcode')
         self.splitter = MoveSplitter(config, self.gcode)
+        # Optionally apply the z adjustment during step generation
+        self.adjust_method = config.getchoice(
+            'adjust_method', ['split', 'kinematic'], 'split')
+        self.kin_stepper_kinematics = []
+        self.kin_active = self.kin_updating = False
+        self.kin_z_shift = 0.
+        self.kin_max_speed = None
+        if self.adjust_method == 'kinematic':
+            self.printer.register_event_handler("klippy:mcu_identify",
+                                                self._setup_kinematic_adjust)
+            self.printer.register_event_handler("toolhead:set_position",
+                                                self._handle_set_position)
+            self.printer.register_event_handler("toolhead:manual_move_begin",
+                                                self._handle_kin_interrupt)
+            self.printer.register_event_handler("homing:homing_move_begin",
+                                                self._handle_kin_interrupt)
         # setup persistent storage
         self.pmgr = ProfileManager(config, self)
         self.save_profile = self.pmgr.save_profile
@@ -129,7 +146,87 @@ class BedMesh:
     def handle_connect(self):
         self.toolhead = self.printer.lookup_object('toolhead')
         self.bmc.print_generated_points(logging.info)
+    # Kinematic z adjustment
+    def _setup_kinematic_adjust(self):
+        # Wrap the kinematics of all steppers that move the z axis.  This
+        # is done prior to "klippy:connect" so that any input shaper
+        # wrapper is layered on top of the mesh wrapper.
+        ffi_main, ffi_lib = chelper.get_ffi()
+        toolhead = self.printer.lookup_object('toolhead')
+        for s in toolhead.get_kinematics().get_steppers():
+            if s.get_trapq() is None or not s.is_active_axis('z'):
+                continue
+            orig_sk = s.get_stepper_kinematics()
+            bm_sk = ffi_main.gc(ffi_lib.bed_mesh_kin_alloc(), ffi_lib.free)
+            if ffi_lib.bed_mesh_kin_set_sk(bm_sk, orig_sk) < 0:
+                continue
+            s.set_stepper_kinematics(bm_sk)
+            self.kin_stepper_kinematics.append((orig_sk, bm_sk))
+    def _calc_adjusted_pos(self, pos):
+        # Return the z stepper position for a given gcode position
+        x, y, z, e = pos
+        if self.z_mesh is None:
+            return [x, y, z + self.fade_target, e]
+        z_adj = self.z_mesh.calc_z(x, y) - self.fade_target
+        return [x, y, z + self.fade_target + self.get_z_factor(z) * z_adj, e]
+    def _update_kin_mesh(self, c_mesh):
+        ffi_main, ffi_lib = chelper.get_ffi()
+        for orig_sk, bm_sk in self.kin_stepper_kinematics:
+            ffi_lib.bed_mesh_kin_set_mesh(
+                bm_sk, c_mesh, self.fade_start, self.fade_end,
+                self.fade_target, self.tool_offset, self.kin_z_shift)
+    def _kin_activate(self):
+        # Start adding the z-adjustment during step generation.  The
+        # toolhead position is retained - the difference between it and
+        # the gcode z position is tracked in 'kin_z_shift'.
+        if self.kin_active:
+            return
+        self.toolhead.flush_step_generation()
+        pos = self.toolhead.get_position()
+        self.kin_z_shift = self._calc_unadjusted_pos(pos)[2] - pos[2]
+        self._update_kin_mesh(self.z_mesh.get_c_mesh())
+        self.kin_active = True
+        # The toolhead does not see the z motion added by the mesh, so
+        # limit the speed of moves such that the steepest part of the
+        # mesh does not exceed max_z_velocity
+        self.kin_max_speed = None
+        kin = self.toolhead.get_kinematics()
+        max_z_velocity = getattr(kin, 'max_z_velocity', None)
+        max_slope = self.z_mesh.get_max_slope()
+        if max_z_velocity is not None and max_slope:
+            self.kin_max_speed = max_z_velocity / max_slope
+    def _kin_deactivate(self, adjusted_pos=None):
+        # Restore a toolhead position that includes the z-adjustment so
+        # that homing, probing, and similar code see the true position
+        if not self.kin_active:
+            return
+        self.toolhead.flush_step_generation()
+        if adjusted_pos is None:
+            x, y, z, e = self.toolhead.get_position()
+            adjusted_pos = self._calc_adjusted_pos(
+                [x, y, z + self.kin_z_shift, e])
+        ffi_main, ffi_lib = chelper.get_ffi()
+        self._update_kin_mesh(ffi_main.NULL)
+        self.kin_active = False
+        self.kin_updating = True
+        try:
+            self.toolhead.set_position(adjusted_pos)
+        finally:
+            self.kin_updating = False
+    def _handle_set_position(self):
+        # A position set by other code already includes the z-adjustment
+        if not self.kin_updating:
+            self._kin_deactivate(self.toolhead.get_position())
+    def _handle_kin_interrupt(self, *args):
+        self._kin_deactivate()
     def set_mesh(self, mesh):
+        self._kin_deactivate()
+        self._set_mesh(mesh)
+        # cache the current position before a transform takes place
+        gcode_move = self.printer.lookup_object('gcode_move')
+        gcode_move.reset_last_position()
+        self.update_status()
+    def _set_mesh(self, mesh):
         if mesh is not None and self.fade_end != self.FADE_DISABLE:
             self.log_fade_complete = True
             if self.base_fade_target is None:
@@ -161,10 +258,6 @@ class BedMesh:
         self.tool_offset = 0.
         self.z_mesh = mesh
         self.splitter.initialize(mesh, self.fade_target)
-        # cache the current position before a transform takes place
-        gcode_move = self.printer.lookup_object('gcode_move')
-        gcode_move.reset_last_position()
-        self.update_status()
     def get_z_factor(self, z_pos):
         z_pos += self.tool_offset
         if z_pos >= self.fade_end:
@@ -175,13 +268,22 @@ class BedMesh:
             return 1.
     def get_position(self):
         # Return last, non-transformed position
+        if self.kin_active:
+            # The toolhead position does not include the z-adjustment
+            self.last_position[:] = self.toolhead.get_position()
+            self.last_position[2] += self.kin_z_shift
+        else:
+            self.last_position[:] = self._calc_unadjusted_pos(
+                self.toolhead.get_position())
+        return list(self.last_position)
+    def _calc_unadjusted_pos(self, pos):
         if self.z_mesh is None:
             # No mesh calibrated, so send toolhead position
-            self.last_position[:] = self.toolhead.get_position()
-            self.last_position[2] -= self.fade_target
+            x, y, z, e = pos
+            return [x, y, z - self.fade_target, e]
         else:
             # return current position minus the current z-adjustment
-            x, y, z, e = self.toolhead.get_position()
+            x, y, z, e = pos
             max_adj = self.z_mesh.calc_z(x, y)
             factor = 1.
             z_adj = max_adj - self.fade_target
@@ -197,11 +299,17 @@ class BedMesh:
                           (self.fade_dist - z_adj))
                 factor = constrain(factor, 0., 1.)
             final_z_adj = factor * z_adj + self.fade_target
-            self.last_position[:] = [x, y, z - final_z_adj, e]
-        return list(self.last_position)
+            return [x, y, z - final_z_adj, e]
     def move(self, newpos, speed):
         factor = self.get_z_factor(newpos[2])
-        if self.z_mesh is None or not factor:
+        if self.z_mesh is not None and self.kin_stepper_kinematics:
+            # The z-adjustment is added during step generation
+            self._kin_activate()
+            if self.kin_max_speed is not None:
+                speed = min(speed, self.kin_max_speed)
+            x, y, z, e = newpos
+            self.toolhead.move([x, y, z - self.kin_z_shift, e], speed)
+        elif self.z_mesh is None or not factor:
             # No mesh calibrated, or mesh leveling phased out.
             x, y, z, e = newpos
             if self.log_fade_complete:
@@ -211,15 +319,27 @@ class BedMesh:
                     % (z, self.fade_target))
             self.toolhead.move([x, y, z + self.fade_target, e], speed)
         else:
-            self.splitter.build_move(self.last_position, newpos, factor)
-            while not self.splitter.traverse_complete:
-                split_move = self.splitter.split()
-                if split_move:
-                    self.toolhead.move(split_move, speed)
-                else:
-                    raise self.gcode.error(
-                        "Mesh Leveling: Error splitting move ")
+            split_moves = self.splitter.split_move(self.last_position, newpos,
+                                                   factor)
+            for split_move in split_moves:
+                self.toolhead.move(split_move, speed)
         self.last_position[:] = newpos
+    def move_batch(self, positions, speed):
+        if not positions:
+            return
+        if self.z_mesh is None or not self.kin_stepper_kinematics:
+            for newpos in positions:
+                self.move(newpos, speed)
+            return
+        # The z-adjustment is added during step generation, so the
+        # whole batch can be passed to the toolhead unsplit
+        self._kin_activate()
+        if self.kin_max_speed is not None:
+            speed = min(speed, self.kin_max_speed)
+        z_shift = self.kin_z_shift
+        self.toolhead.move_batch([[x, y, z - z_shift, e]
+                                  for x, y, z, e in positions], speed)
+        self.last_position[:] = positions[-1]
     def get_status(self, eventtime=None):
         return self.status
     def update_status(self):
@@ -274,6 +394,7 @@ class BedMesh:
             offsets = [None, None]
             for i, axis in enumerate(['X', 'Y']):
                 offsets[i] = gcmd.get_float(axis, None)
+            self._kin_deactivate()
             self.z_mesh.set_mesh_offsets(offsets)
             tool_offset = gcmd.get_float("ZFADE", None)
             if tool_offset is not None:
@@ -904,59 +1025,30 @@ class MoveSplitter:
         self.z_mesh = None
         self.fade_offset = 0.
         self.gcode = gcode
+        self.max_points = 0
+        self.split_buf = None
     def initialize(self, mesh, fade_offset):
         self.z_mesh = mesh
         self.fade_offset = fade_offset
-    def build_move(self, prev_pos, next_pos, factor):
-        self.prev_pos = tuple(prev_pos)
-        self.next_pos = tuple(next_pos)
-        self.current_pos = list(prev_pos)
-        self.z_factor = factor
-        self.z_offset = self._calc_z_offset(prev_pos)
-        self.traverse_complete = False
-        self.distance_checked = 0.
-        axes_d = [self.next_pos[i] - self.prev_pos[i] for i in range(4)]
-        self.total_move_length = math.sqrt(sum([d*d for d in axes_d[:3]]))
-        self.axis_move = [not isclose(d, 0., abs_tol=1e-10) for d in axes_d]
-    def _calc_z_offset(self, pos):
-        z = self.z_mesh.calc_z(pos[0], pos[1])
-        offset = self.fade_offset
-        return self.z_factor * (z - offset) + offset
-    def _set_next_move(self, distance_from_prev):
-        t = distance_from_prev / self.total_move_length
-        if t > 1. or t < 0.:
-            raise self.gcode.error(
-                "bed_mesh: Slice distance is negative "
-                "or greater than entire move length")
-        for i in range(4):
-            if self.axis_move[i]:
-                self.current_pos[i] = lerp(
-                    t, self.prev_pos[i], self.next_pos[i])
-    def split(self):
-        if not self.traverse_complete:
-            if self.axis_move[0] or self.axis_move[1]:
-                # X and/or Y axis move, traverse if necessary
-                while self.distance_checked + self.move_check_distance \
-                        < self.total_move_length:
-                    self.distance_checked += self.move_check_distance
-                    self._set_next_move(self.distance_checked)
-                    next_z = self._calc_z_offset(self.current_pos)
-                    if abs(next_z - self.z_offset) >= self.split_delta_z:
-                        self.z_offset = next_z
-                        return self.current_pos[0], self.current_pos[1], \
-                            self.current_pos[2] + self.z_offset, \
-                            self.current_pos[3]
-            # end of move reached
-            self.current_pos[:] = self.next_pos
-            self.z_offset = self._calc_z_offset(self.current_pos)
-            # Its okay to add Z-Offset to the final move, since it will not be
-            # used again.
-            self.current_pos[2] += self.z_offset
-            self.traverse_complete = True
-            return self.current_pos
-        else:
-            # Traverse complete
-            return None
+    def split_move(self, prev_pos, next_pos, factor):
+        # Calculate the mesh adjusted end positions of each segment of
+        # the move (the splitting is done in C code)
+        ffi_main, ffi_lib = chelper.get_ffi()
+        move_d = math.sqrt(sum([(next_pos[i] - prev_pos[i])**2
+                                for i in range(3)]))
+        max_points = int(move_d / self.move_check_distance) + 2
+        if max_points > self.max_points:
+            self.max_points = max_points
+            self.split_buf = ffi_main.new('double[]', max_points * 4)
+        buf = self.split_buf
+        count = ffi_lib.bed_mesh_split_move(
+            self.z_mesh.get_c_mesh(), list(prev_pos[:4]), list(next_pos[:4]),
+            factor, self.fade_offset, self.move_check_distance,
+            self.split_delta_z, buf, max_points)
+        if count <= 0:
+            raise self.gcode.error("Mesh Leveling: Error splitting move ")
+        return [[buf[i], buf[i+1], buf[i+2], buf[i+3]]
+                for i in range(0, count * 4, 4)]
 
 
 class ZMesh:
@@ -998,6 +1090,26 @@ class ZMesh:
                            (self.mesh_x_count - 1)
         self.mesh_y_dist = (self.mesh_y_max - self.mesh_y_min) / \
                            (self.mesh_y_count - 1)
+        # The mesh matrix is also stored in C code for fast lookups
+        ffi_main, ffi_lib = chelper.get_ffi()
+        self.c_mesh = ffi_main.gc(ffi_lib.bed_mesh_alloc(),
+                                  ffi_lib.bed_mesh_free)
+    def _update_c_mesh(self):
+        ffi_main, ffi_lib = chelper.get_ffi()
+        if self.mesh_matrix is None:
+            ffi_lib.bed_mesh_set_grid(self.c_mesh, 0., 0., 0., 0., 0, 0,
+                                      ffi_main.NULL)
+            return
+        z_matrix = [z for line in self.mesh_matrix for z in line]
+        ret = ffi_lib.bed_mesh_set_grid(
+            self.c_mesh, self.mesh_x_min, self.mesh_y_min,
+            self.mesh_x_dist, self.mesh_y_dist,
+            self.mesh_x_count, self.mesh_y_count, z_matrix)
+        if ret:
+            raise BedMeshError("bed_mesh: Unable to load mesh matrix")
+        ffi_lib.bed_mesh_set_offsets(self.c_mesh, *self.mesh_offsets)
+    def get_c_mesh(self):
+        return self.c_mesh
     def get_mesh_matrix(self):
         if self.mesh_matrix is not None:
             return [[round(z, 6) for z in line]
@@ -1046,6 +1158,7 @@ class ZMesh:
     def build_mesh(self, z_matrix):
         self.probed_matrix = z_matrix
         self._sample(z_matrix)
+        self._update_c_mesh()
         self.print_mesh(logging.debug)
     def set_zero_reference(self, xpos, ypos):
         offset = self.calc_z(xpos, ypos)
@@ -1057,25 +1170,19 @@ class ZMesh:
             for yidx in range(len(matrix)):
                 for xidx in range(len(matrix[yidx])):
                     matrix[yidx][xidx] -= offset
+        self._update_c_mesh()
     def set_mesh_offsets(self, offsets):
         for i, o in enumerate(offsets):
             if o is not None:
                 self.mesh_offsets[i] = o
+        self._update_c_mesh()
     def get_x_coordinate(self, index):
         return self.mesh_x_min + self.mesh_x_dist * index
     def get_y_coordinate(self, index):
         return self.mesh_y_min + self.mesh_y_dist * index
     def calc_z(self, x, y):
-        if self.mesh_matrix is not None:
-            tbl = self.mesh_matrix
-            tx, xidx = self._get_linear_index(x + self.mesh_offsets[0], 0)
-            ty, yidx = self._get_linear_index(y + self.mesh_offsets[1], 1)
-            z0 = lerp(tx, tbl[yidx][xidx], tbl[yidx][xidx+1])
-            z1 = lerp(tx, tbl[yidx+1][xidx], tbl[yidx+1][xidx+1])
-            return lerp(ty, z0, z1)
-        else:
-            # No mesh table generated, no z-adjustment
-            return 0.
+        ffi_main, ffi_lib = chelper.get_ffi()
+        return ffi_lib.bed_mesh_calc_z(self.c_mesh, x, y)
     def get_z_range(self):
         if self.mesh_matrix is not None:
             mesh_min = min([min(x) for x in self.mesh_matrix])
@@ -1083,6 +1190,21 @@ class ZMesh:
             return mesh_min, mesh_max
         else:
             return 0., 0.
+    def get_max_slope(self):
+        # Return the largest z change per xy distance between adjacent
+        # points of the mesh
+        if self.mesh_matrix is None:
+            return 0.
+        max_x_slope = max_y_slope = 0.
+        matrix = self.mesh_matrix
+        for y, line in enumerate(matrix):
+            for x, z in enumerate(line):
+                if x:
+                    max_x_slope = max(max_x_slope, abs(z - line[x-1]))
+                if y:
+                    max_y_slope = max(max_y_slope, abs(z - matrix[y-1][x]))
+        return math.sqrt((max_x_slope / self.mesh_x_dist)**2
+                         + (max_y_slope / self.mesh_y_dist)**2)
     def get_z_average(self):
         if self.mesh_matrix is not None:
             avg_z = (sum([sum(x) for x in self.mesh_matrix]) /
@@ -1093,24 +1215,6 @@ class ZMesh:
             return round(avg_z, 2)
         else:
             return 0.
-    def _get_linear_index(self, coord, axis):
-        if axis == 0:
-            # X-axis
-            mesh_min = self.mesh_x_min
-            mesh_cnt = self.mesh_x_count
-            mesh_dist = self.mesh_x_dist
-            cfunc = self.get_x_coordinate
-        else:
-            # Y-axis
-            mesh_min = self.mesh_y_min
-            mesh_cnt = self.mesh_y_count
-            mesh_dist = self.mesh_y_dist
-            cfunc = self.get_y_coordinate
-        t = 0.
-        idx = int(math.floor((coord - mesh_min) / mesh_dist))
-        idx = constrain(idx, 0, mesh_cnt - 2)
-        t = (coord - cfunc(idx)) / mesh_dist
-        return constrain(t, 0., 1.), idx
     def _sample_direct(self, z_matrix):
         self.mesh_matrix = z_matrix
     def _sample_lagrange(self, z_matrix):
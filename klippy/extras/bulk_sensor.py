@@ -3,7 +3,7 @@
 # Copyright (C) 2020-2023  Kevin O'Connor <kevin@koconnor.net>
 #
 # This file may be distributed under the terms of the GNU GPLv3 license.
-import logging, threading, struct
+import logging, threading, struct, json, os, queue, zlib
 
 # This "bulk sensor" module facilitates the processing of sensor chip
 # measurements that do not require the host to respond with low
@@ -132,6 +132,142 @@ class BulkDataQueue:
         self.pull_queue()
 
 
+######################################################################
+# Capture files
+######################################################################
+
+# Measurements may be recorded to a binary "capture" file.  The file
+# starts with CAPTURE_MAGIC, a 32bit little-endian length, and a json
+# header describing the sensor and the columns.  This is followed by a
+# series of blocks - each block has a header containing the number of
+# rows and the length of its data followed by the data of each column
+# stored contiguously (optionally zlib compressed).  Headers and blocks
+# are padded to 8 byte boundaries so that readers can map the data
+# directly into memory.
+
+CAPTURE_MAGIC = b"KLIPCAP1"
+CAPTURE_BLOCK_ROWS = 4096
+CAPTURE_FORMATS = ['binary', 'binary_zlib', 'csv']
+CAPTURE_TYPES = {'f4': 'f', 'f8': 'd'}
+
+def _capture_pad(data):
+    return data + b"\0" * (-len(data) % 8)
+
+# Helper to record measurements (in a background thread) as they arrive
+class CaptureWriter:
+    def __init__(self, filename, columns, metadata=None, fmt='binary'):
+        # The columns are a list of (name, type) with type 'f8' or 'f4'
+        self.filename = filename
+        self.columns = columns
+        self.fmt = fmt
+        self.row_count = 0
+        self.error = None
+        self.queue = queue.Queue()
+        self.file = open(filename, "wb")
+        if fmt == 'csv':
+            header = "#" + ",".join([n for n, t in columns]) + "\n"
+            self.file.write(header.encode())
+        else:
+            header = dict(metadata or {})
+            header['columns'] = columns
+            header['compression'] = 'zlib' if fmt == 'binary_zlib' else None
+            jheader = json.dumps(header).encode()
+            self.file.write(_capture_pad(
+                CAPTURE_MAGIC + struct.pack("<I", len(jheader)) + jheader))
+        self.thread = threading.Thread(target=self._write_thread)
+        self.thread.daemon = True
+        self.thread.start()
+    def add_samples(self, samples):
+        self.queue.put(samples)
+    def finish(self, filename=None):
+        # Wait for all samples to be written (and optionally rename file)
+        self.queue.put(None)
+        self.thread.join()
+        if self.error is not None:
+            raise IOError(self.error)
+        if filename is not None and filename != self.filename:
+            os.rename(self.filename, filename)
+            self.filename = filename
+        return self.row_count
+    # Background writing
+    def _write_block(self, rows):
+        if self.fmt == 'csv':
+            fmt = ",".join(["%.6f"] * len(self.columns)) + "\n"
+            self.file.write("".join([fmt % tuple(r) for r in rows]).encode())
+            return
+        num_rows = len(rows)
+        data = b"".join([
+            struct.pack("<%d%s" % (num_rows, CAPTURE_TYPES[ctype]), *col)
+            for (cname, ctype), col in zip(self.columns, zip(*rows))])
+        if self.fmt == 'binary_zlib':
+            data = zlib.compress(data)
+        self.file.write(struct.pack("<II", num_rows, len(data))
+                        + _capture_pad(data))
+    def _write_thread(self):
+        rows = []
+        try:
+            while 1:
+                samples = self.queue.get()
+                if samples is not None:
+                    rows.extend(samples)
+                    self.row_count += len(samples)
+                while len(rows) >= CAPTURE_BLOCK_ROWS or (
+                        samples is None and rows):
+                    self._write_block(rows[:CAPTURE_BLOCK_ROWS])
+                    del rows[:CAPTURE_BLOCK_ROWS]
+                if samples is None:
+                    break
+        except (IOError, OSError) as e:
+            logging.exception("Error writing capture file %s", self.filename)
+            self.error = str(e)
+            # Discard remaining samples
+            while self.queue.get() is not None:
+                pass
+        self.file.close()
+
+def is_capture_file(filename):
+    with open(filename, "rb") as f:
+        return f.read(len(CAPTURE_MAGIC)) == CAPTURE_MAGIC
+
+# Read a capture file - returns the json header and a list of blocks
+# (each a list with a numpy array per recorded field).  The arrays of
+# uncompressed blocks are views of the memory mapped file - only zlib
+# compressed blocks are copied.
+def read_capture(filename, np):
+    mm = np.memmap(filename, dtype=np.uint8, mode='r')
+    if bytes(mm[:len(CAPTURE_MAGIC)]) != CAPTURE_MAGIC:
+        raise ValueError("%s is not a capture file" % (filename,))
+    pos = len(CAPTURE_MAGIC)
+    hlen = struct.unpack("<I", bytes(mm[pos:pos+4]))[0]
+    pos += 4
+    header = json.loads(bytes(mm[pos:pos+hlen]).decode())
+    pos += hlen
+    pos += -pos % 8
+    dtypes = [np.dtype('<' + ctype) for cname, ctype in header['columns']]
+    compressed = header.get('compression') == 'zlib'
+    blocks = []
+    while pos + 8 <= len(mm):
+        num_rows, data_len = struct.unpack("<II", bytes(mm[pos:pos+8]))
+        data = mm[pos+8:pos+8+data_len]
+        if compressed:
+            data = zlib.decompress(bytes(data))
+        columns = []
+        offset = 0
+        for dtype in dtypes:
+            columns.append(np.frombuffer(data, dtype, num_rows, offset))
+            offset += num_rows * dtype.itemsize
+        blocks.append(columns)
+        pos += 8 + data_len + (-data_len % 8)
+    return header, blocks
+
+# Combine the blocks of a capture file into a 2d numpy array (with one
+# column per recorded field)
+def capture_to_array(header, blocks, np):
+    if not blocks:
+        return np.empty((0, len(header['columns'])))
+    return np.column_stack([np.concatenate(cols) for cols in zip(*blocks)])
+
+
 ######################################################################
 # Clock synchronization
 ######################################################################
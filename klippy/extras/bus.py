@@ -102,6 +102,15 @@ class MCU_SPI:
         return self.spi_transfer_cmd.send_with_preface(
             self.spi_send_cmd, [self.oid, preface_data], [self.oid, data],
             minclock=minclock, reqclock=reqclock)
+    def spi_transfer_multi(self, data_list, preface_data=None,
+                           minclock=0, reqclock=0):
+        preface_cmd = None
+        if preface_data is not None:
+            preface_cmd = self.spi_send_cmd
+            preface_data = [self.oid, preface_data]
+        return self.spi_transfer_cmd.send_multi(
+            [[self.oid, data] for data in data_list], preface_cmd,
+            preface_data, minclock=minclock, reqclock=reqclock)
 
 # Helper to setup an spi bus from settings in a config section
 def MCU_SPI_from_config(config, mode, pin_option="cs_pin",
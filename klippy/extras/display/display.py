@@ -74,14 +74,46 @@ class DisplayGroup:
             if c.get('text'):
                 template = gcode_macro.load_template(c, 'text')
                 self.data_items.append((row, col, template))
+        # Results of the last render of each item, along with the
+        # status fields that render depended on
+        self.memos = [None] * len(self.data_items)
     def show(self, display, templates, eventtime):
         context = self.data_items[0][2].create_template_context(eventtime)
-        context['draw_progress_bar'] = display.draw_progress_bar
+        status = context['printer']
+        progress_bars = []
+        def draw_progress_bar(*args):
+            progress_bars.append(args)
+            return display.draw_progress_bar(*args)
+        context['draw_progress_bar'] = draw_progress_bar
         def render(name, **kwargs):
             return templates[name].render(context, **kwargs)
         context['render'] = render
-        for row, col, template in self.data_items:
-            text = template.render(context)
+        # Renders with side effects can not be reused
+        def untracked(func):
+            def wrapper(*args, **kwargs):
+                status.note_untracked()
+                return func(*args, **kwargs)
+            return wrapper
+        for name in list(context.keys()):
+            if name.startswith('action_'):
+                context[name] = untracked(context[name])
+        for i, (row, col, template) in enumerate(self.data_items):
+            memo = self.memos[i]
+            if memo is not None and status.check_reads(memo[0]):
+                # Inputs unchanged - reuse the previous render
+                reads, text, bars = memo
+                for args in bars:
+                    display.draw_progress_bar(*args)
+            else:
+                self.memos[i] = None
+                reads = status.start_tracking()
+                del progress_bars[:]
+                try:
+                    text = template.render(context)
+                finally:
+                    is_trackable = status.stop_tracking()
+                if is_trackable:
+                    self.memos[i] = (reads, text, list(progress_bars))
             display.draw_text(row, col, text.replace('\n', ''), eventtime)
         context.clear() # Remove circular references for better gc
 
@@ -14,6 +14,11 @@ TextGlyphs = { 'right_arrow': b'\x7e' }
 
 HD44780_DELAY = .000040
 
+# Maximum number of framebuffer bytes in a single update
+MAX_UPDATE_DATA = 32
+# Maximum size of a message sent to the mcu update queue
+MAX_QUEUE_SIZE = 48
+
 class HD44780:
     def __init__(self, config):
         self.printer = config.get_printer()
@@ -34,7 +39,7 @@ class HD44780:
         self.mcu = mcu
         self.oid = self.mcu.create_oid()
         self.mcu.register_config_callback(self.build_config)
-        self.send_data_cmd = self.send_cmds_cmd = None
+        self.send_data_cmd = self.send_cmds_cmd = self.queue_cmd = None
         self.icons = {}
         # framebuffers
         self.text_framebuffers = [bytearray(b' '*2*self.line_length),
@@ -60,14 +65,36 @@ class HD44780:
             "hd44780_send_cmds oid=%c cmds=%*s", cq=cmd_queue)
         self.send_data_cmd = self.mcu.lookup_command(
             "hd44780_send_data oid=%c data=%*s", cq=cmd_queue)
+        queue_fmt = "hd44780_queue oid=%c data=%*s"
+        if self.mcu.try_lookup_command(queue_fmt) is not None:
+            self.queue_cmd = self.mcu.lookup_command(queue_fmt, cq=cmd_queue)
     def send(self, cmds, is_data=False):
         cmd_type = self.send_cmds_cmd
         if is_data:
             cmd_type = self.send_data_cmd
         cmd_type.send([self.oid, cmds], reqclock=BACKGROUND_PRIORITY_CLOCK)
         #logging.debug("hd44780 %d %s", is_data, repr(cmds))
+    def send_updates(self, updates):
+        if self.queue_cmd is None:
+            for cmds, data in updates:
+                self.send(cmds)
+                self.send(data, is_data=True)
+            return
+        # Pack the updates into as few mcu queue messages as possible
+        msg = []
+        for cmds, data in updates:
+            segs = [len(cmds)] + cmds + [0x80 | len(data)] + list(data)
+            if msg and len(msg) + len(segs) > MAX_QUEUE_SIZE:
+                self.queue_cmd.send([self.oid, msg],
+                                    reqclock=BACKGROUND_PRIORITY_CLOCK)
+                msg = []
+            msg.extend(segs)
+        if msg:
+            self.queue_cmd.send([self.oid, msg],
+                                reqclock=BACKGROUND_PRIORITY_CLOCK)
     def flush(self):
         # Find all differences in the framebuffers and send them to the chip
+        updates = []
         for new_data, old_data, fb_id in self.all_framebuffers:
             if new_data == old_data:
                 continue
@@ -81,12 +108,15 @@ class HD44780:
                 if pos + 4 >= nextpos and nextcount < 16:
                     diffs[i][1] = nextcount + (nextpos - pos)
                     del diffs[i+1]
-            # Transmit changes
+            # Generate address commands and data for each change
             for pos, count in diffs:
-                chip_pos = pos
-                self.send([fb_id + chip_pos])
-                self.send(new_data[pos:pos+count], is_data=True)
+                end_pos = pos + count
+                for chip_pos in range(pos, end_pos, MAX_UPDATE_DATA):
+                    data = new_data[chip_pos:min(chip_pos + MAX_UPDATE_DATA,
+                                                 end_pos)]
+                    updates.append(([fb_id + chip_pos], data))
             old_data[:] = new_data
+        self.send_updates(updates)
     def init(self):
         curtime = self.printer.get_reactor().monotonic()
         print_time = self.mcu.estimated_print_time(curtime)
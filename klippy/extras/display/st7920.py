@@ -13,6 +13,11 @@ BACKGROUND_PRIORITY_CLOCK = 0x7fffffff00000000
 ST7920_CMD_DELAY  = .000020
 ST7920_SYNC_DELAY = .000045
 
+# Maximum number of framebuffer bytes in a single update
+MAX_UPDATE_DATA = 32
+# Maximum size of a message sent to the mcu update queue
+MAX_QUEUE_SIZE = 48
+
 TextGlyphs = { 'right_arrow': b'\x1a' }
 CharGlyphs = { 'degrees': bytearray(font8x14.VGA_FONT[0xf8]) }
 
@@ -34,6 +39,7 @@ class DisplayBase:
         self.icons = {}
     def flush(self):
         # Find all differences in the framebuffers and send them to the chip
+        updates = []
         for new_data, old_data, fb_id in self.all_framebuffers:
             if new_data == old_data:
                 continue
@@ -47,19 +53,29 @@ class DisplayBase:
                 if pos + 5 >= nextpos and nextcount < 16:
                     diffs[i][1] = nextcount + (nextpos - pos)
                     del diffs[i+1]
-            # Transmit changes
+            # Generate address commands and data for each change
             for pos, count in diffs:
                 count += pos & 0x01
                 count += count & 0x01
                 pos = pos & ~0x01
-                chip_pos = pos >> 1
-                if fb_id < 0x40:
-                    # Graphics framebuffer update
-                    self.send([0x80 + fb_id, 0x80 + chip_pos], is_extended=True)
-                else:
-                    self.send([fb_id + chip_pos])
-                self.send(new_data[pos:pos+count], is_data=True)
+                end_pos = pos + count
+                for chunk_pos in range(pos, end_pos, MAX_UPDATE_DATA):
+                    chunk_end = min(chunk_pos + MAX_UPDATE_DATA, end_pos)
+                    data = new_data[chunk_pos:chunk_end]
+                    chip_pos = chunk_pos >> 1
+                    if fb_id < 0x40:
+                        # Graphics framebuffer update
+                        updates.append(([0x80 + fb_id, 0x80 + chip_pos],
+                                        True, data))
+                    else:
+                        updates.append(([fb_id + chip_pos], False, data))
             old_data[:] = new_data
+        self.send_updates(updates)
+    def send_updates(self, updates):
+        # Transmit changes
+        for cmds, is_extended, data in updates:
+            self.send(cmds, is_extended=is_extended)
+            self.send(data, is_data=True)
     def init(self):
         cmds = [0x24, # Enter extended mode
                 0x40, # Clear vertical scroll address
@@ -154,7 +170,7 @@ class ST7920(DisplayBase):
         self.mcu = mcu
         self.oid = self.mcu.create_oid()
         self.mcu.register_config_callback(self.build_config)
-        self.send_data_cmd = self.send_cmds_cmd = None
+        self.send_data_cmd = self.send_cmds_cmd = self.queue_cmd = None
         self.is_extended = False
         # init display base
         DisplayBase.__init__(self)
@@ -171,18 +187,42 @@ class ST7920(DisplayBase):
             "st7920_send_cmds oid=%c cmds=%*s", cq=cmd_queue)
         self.send_data_cmd = self.mcu.lookup_command(
             "st7920_send_data oid=%c data=%*s", cq=cmd_queue)
-    def send(self, cmds, is_data=False, is_extended=False):
-        cmd_type = self.send_cmds_cmd
-        if is_data:
-            cmd_type = self.send_data_cmd
-        elif self.is_extended != is_extended:
+        queue_fmt = "st7920_queue oid=%c data=%*s"
+        if self.mcu.try_lookup_command(queue_fmt) is not None:
+            self.queue_cmd = self.mcu.lookup_command(queue_fmt, cq=cmd_queue)
+    def _check_mode(self, cmds, is_extended):
+        if self.is_extended != is_extended:
             add_cmd = 0x22
             if is_extended:
                 add_cmd = 0x26
             cmds = [add_cmd] + cmds
             self.is_extended = is_extended
+        return cmds
+    def send(self, cmds, is_data=False, is_extended=False):
+        cmd_type = self.send_cmds_cmd
+        if is_data:
+            cmd_type = self.send_data_cmd
+        else:
+            cmds = self._check_mode(cmds, is_extended)
         cmd_type.send([self.oid, cmds], reqclock=BACKGROUND_PRIORITY_CLOCK)
         #logging.debug("st7920 %d %s", is_data, repr(cmds))
+    def send_updates(self, updates):
+        if self.queue_cmd is None:
+            DisplayBase.send_updates(self, updates)
+            return
+        # Pack the updates into as few mcu queue messages as possible
+        msg = []
+        for cmds, is_extended, data in updates:
+            cmds = self._check_mode(cmds, is_extended)
+            segs = [len(cmds)] + cmds + [0x80 | len(data)] + list(data)
+            if msg and len(msg) + len(segs) > MAX_QUEUE_SIZE:
+                self.queue_cmd.send([self.oid, msg],
+                                    reqclock=BACKGROUND_PRIORITY_CLOCK)
+                msg = []
+            msg.extend(segs)
+        if msg:
+            self.queue_cmd.send([self.oid, msg],
+                                reqclock=BACKGROUND_PRIORITY_CLOCK)
 
 # Helper code for toggling the en pin on startup
 class EnableHelper:
@@ -7,6 +7,8 @@ from . import bus
 
 BACKGROUND_PRIORITY_CLOCK = 0x7fffffff00000000
 
+MAX_SEND_SIZE = 48  # Maximum bytes in a spi_send command
+
 class PrinterDotstar:
     def __init__(self, config):
         self.printer = printer = config.get_printer()
@@ -47,7 +49,8 @@ class PrinterDotstar:
         minclock = 0
         if print_time is not None:
             minclock = self.spi.get_mcu().print_time_to_clock(print_time)
-        for d in [data[i:i+20] for i in range(0, len(data), 20)]:
+        for d in [data[i:i+MAX_SEND_SIZE]
+                  for i in range(0, len(data), MAX_SEND_SIZE)]:
             self.spi.spi_send(d, minclock=minclock,
                               reqclock=BACKGROUND_PRIORITY_CLOCK)
     def get_status(self, eventtime):
@@ -6,9 +6,9 @@
 # Copyright (C) 2011 Camiel Gubbels / Erik van der Zalm
 #
 # This file may be distributed under the terms of the GNU GPLv3 license.
-import math
+import chelper
 
-# Coordinates created by this are converted into G1 commands.
+# Coordinates created by this are queued as a batch of G1 style moves.
 #
 # supports XY, XZ & YZ planes with remaining axis as helical
 
@@ -44,6 +44,11 @@ class ArcSupport:
         # backwards compatibility, prior implementation only supported XY
         self.plane = ARC_PLANE_X_Y
 
+        # Arc segment generation (see chelper/arcs.c)
+        self.ffi_main, ffi_lib = chelper.get_ffi()
+        self.arc_plan = ffi_lib.arc_plan
+        self.arc_buf = self.ffi_main.new('double[]', 3 * 1024)
+
     def cmd_G2(self, gcmd):
         self._cmd_inner(gcmd, True)
 
@@ -88,7 +93,7 @@ class ArcSupport:
             raise gcmd.error("G2/G3 requires IJ, IK or JK parameters")
 
         asE = gcmd.get_float("E", None)
-        asF = gcmd.get_float("F", None)
+        asF = gcmd.get_float("F", None, above=0.)
 
         # Build list of linear coordinates to move
         coords = self.planArc(currentPos, asTarget, asPlanar,
@@ -99,21 +104,17 @@ class ArcSupport:
                 e_base = currentPos[3]
             e_per_move = (asE - e_base) / len(coords)
 
-        # Convert coords into G1 commands
+        # Queue the moves (as if each were a G1 command)
+        moves = []
         for coord in coords:
-            g1_params = {'X': coord[0], 'Y': coord[1], 'Z': coord[2]}
+            e = None
             if e_per_move:
-                g1_params['E'] = e_base + e_per_move
+                e = e_base + e_per_move
                 if gcodestatus['absolute_extrude']:
                     e_base += e_per_move
-            if asF is not None:
-                g1_params['F'] = asF
-            g1_gcmd = self.gcode.create_gcode_command("G1", "G1", g1_params)
-            self.gcode_move.cmd_G1(g1_gcmd)
+            moves.append((coord[0], coord[1], coord[2], e))
+        self.gcode_move.move_batch(moves, asF)
 
-    # function planArc() originates from marlin plan_arc()
-    # https://github.com/MarlinFirmware/Marlin
-    #
     # The arc is approximated by generating many small linear segments.
     # The length of each segment is configured in MM_PER_ARC_SEGMENT
     # Arcs smaller then this value, will be a Line only
@@ -121,61 +122,17 @@ class ArcSupport:
     # alpha and beta axes are the current plane, helical axis is linear travel
     def planArc(self, currentPos, targetPos, offset, clockwise,
                 alpha_axis, beta_axis, helical_axis):
-        # todo: sometimes produces full circles
-
-        # Radius vector from center to current location
-        r_P = -offset[0]
-        r_Q = -offset[1]
-
-        # Determine angular travel
-        center_P = currentPos[alpha_axis] - r_P
-        center_Q = currentPos[beta_axis] - r_Q
-        rt_Alpha = targetPos[alpha_axis] - center_P
-        rt_Beta = targetPos[beta_axis] - center_Q
-        angular_travel = math.atan2(r_P * rt_Beta - r_Q * rt_Alpha,
-                                    r_P * rt_Alpha + r_Q * rt_Beta)
-        if angular_travel < 0.:
-            angular_travel += 2. * math.pi
-        if clockwise:
-            angular_travel -= 2. * math.pi
-
-        if (angular_travel == 0.
-            and currentPos[alpha_axis] == targetPos[alpha_axis]
-            and currentPos[beta_axis] == targetPos[beta_axis]):
-            # Make a circle if the angular rotation is 0 and the
-            # target is current position
-            angular_travel = 2. * math.pi
-
-        # Determine number of segments
-        linear_travel = targetPos[helical_axis] - currentPos[helical_axis]
-        radius = math.hypot(r_P, r_Q)
-        flat_mm = radius * angular_travel
-        if linear_travel:
-            mm_of_travel = math.hypot(flat_mm, linear_travel)
-        else:
-            mm_of_travel = math.fabs(flat_mm)
-        segments = max(1., math.floor(mm_of_travel / self.mm_per_arc_segment))
-
-        # Generate coordinates
-        theta_per_segment = angular_travel / segments
-        linear_per_segment = linear_travel / segments
-        coords = []
-        for i in range(1, int(segments)):
-            dist_Helical = i * linear_per_segment
-            cos_Ti = math.cos(i * theta_per_segment)
-            sin_Ti = math.sin(i * theta_per_segment)
-            r_P = -offset[0] * cos_Ti + offset[1] * sin_Ti
-            r_Q = -offset[0] * sin_Ti - offset[1] * cos_Ti
-
-            # Coord doesn't support index assignment, create list
-            c = [None, None, None, None]
-            c[alpha_axis] = center_P + r_P
-            c[beta_axis] = center_Q + r_Q
-            c[helical_axis] = currentPos[helical_axis] + dist_Helical
-            coords.append(self.Coord(*c))
-
-        coords.append(targetPos)
-        return coords
+        start_pos = [currentPos[0], currentPos[1], currentPos[2]]
+        target_pos = [targetPos[0], targetPos[1], targetPos[2]]
+        args = (start_pos, target_pos, offset[0], offset[1], clockwise,
+                alpha_axis, beta_axis, helical_axis, self.mm_per_arc_segment)
+        count = self.arc_plan(*(args + (self.arc_buf, len(self.arc_buf)//3)))
+        if count > len(self.arc_buf) // 3:
+            # Arc has more segments than the buffer - grow buffer and retry
+            self.arc_buf = self.ffi_main.new('double[]', count * 3)
+            self.arc_plan(*(args + (self.arc_buf, count)))
+        buf = self.arc_buf
+        return [(buf[i], buf[i+1], buf[i+2]) for i in range(0, count*3, 3)]
 
 def load_config(config):
     return ArcSupport(config)
@@ -5,29 +5,132 @@
 # This file may be distributed under the terms of the GNU GPLv3 license.
 import traceback, logging, ast, copy, json
 import jinja2
+import chelper
 
 
 ######################################################################
 # Template handling
 ######################################################################
 
+# Copy a get_status() result so that templates can not alter it.  This
+# is a faster equivalent of copy.deepcopy() for the types commonly
+# found in status reports.
+IMMUTABLE_TYPES = (str, int, float, bool, type(None))
+def copy_status(val):
+    vtype = type(val)
+    if vtype in IMMUTABLE_TYPES:
+        return val
+    if vtype is dict:
+        return {k: copy_status(v) for k, v in val.items()}
+    if vtype is list:
+        return [copy_status(v) for v in val]
+    if vtype is tuple:
+        return tuple([copy_status(v) for v in val])
+    return copy.deepcopy(val)
+
+# Status dictionary that records which fields a template accesses
+MISSING = object()
+class TrackedStatus(dict):
+    def __init__(self, name, status, reads):
+        dict.__init__(self, status)
+        self.__name = name
+        self.__status = status
+        self.__reads = reads
+    def __note(self, key):
+        val = self.__status.get(key, MISSING)
+        self.__reads.append((self.__name, key, val))
+        return val
+    def __note_all(self):
+        self.__reads.append((self.__name, None, self.__status))
+    def __getitem__(self, key):
+        val = self.__note(key)
+        if val is MISSING:
+            raise KeyError(key)
+        return val
+    def __contains__(self, key):
+        return self.__note(key) is not MISSING
+    def get(self, key, default=None):
+        val = self.__note(key)
+        if val is MISSING:
+            return default
+        return val
+    def __iter__(self):
+        self.__note_all()
+        return dict.__iter__(self)
+    def __len__(self):
+        self.__note_all()
+        return dict.__len__(self)
+    def keys(self):
+        self.__note_all()
+        return dict.keys(self)
+    def values(self):
+        self.__note_all()
+        return dict.values(self)
+    def items(self):
+        self.__note_all()
+        return dict.items(self)
+    def copy(self):
+        self.__note_all()
+        return dict(self.__status)
+
 # Wrapper for access to printer object get_status() methods
 class GetStatusWrapper:
-    def __init__(self, printer, eventtime=None):
+    def __init__(self, printer, eventtime=None, snapshot=None):
         self.printer = printer
         self.eventtime = eventtime
+        self.snapshot = snapshot
         self.cache = {}
-    def __getitem__(self, val):
+        # Read tracking (used to determine if a render can be reused)
+        self.reads = None
+        self.tracked = {}
+        self.is_trackable = True
+    def _get_status(self, val):
         sval = str(val).strip()
         if sval in self.cache:
-            return self.cache[sval]
+            return sval, self.cache[sval]
         po = self.printer.lookup_object(sval, None)
         if po is None or not hasattr(po, 'get_status'):
             raise KeyError(val)
         if self.eventtime is None:
             self.eventtime = self.printer.get_reactor().monotonic()
-        self.cache[sval] = res = copy.deepcopy(po.get_status(self.eventtime))
-        return res
+        if self.snapshot is not None:
+            res = self.snapshot(sval, po, self.eventtime)
+        else:
+            res = copy_status(po.get_status(self.eventtime))
+        self.cache[sval] = res
+        return sval, res
+    def __getitem__(self, val):
+        sval, res = self._get_status(val)
+        if self.reads is None or type(res) is not dict:
+            return res
+        tres = self.tracked.get(sval)
+        if tres is None:
+            tres = self.tracked[sval] = TrackedStatus(sval, res, self.reads)
+        return tres
+    def start_tracking(self):
+        self.reads = []
+        self.tracked = {}
+        self.is_trackable = True
+        return self.reads
+    def stop_tracking(self):
+        self.reads = None
+        self.tracked = {}
+        return self.is_trackable
+    def note_untracked(self):
+        self.is_trackable = False
+    def check_reads(self, reads):
+        # Check if the status fields noted by start_tracking() still
+        # have the same values
+        for name, key, val in reads:
+            try:
+                sval, res = self._get_status(name)
+            except KeyError as e:
+                return False
+            if key is not None:
+                res = res.get(key, MISSING)
+            if res != val:
+                return False
+        return True
     def __contains__(self, val):
         try:
             self.__getitem__(val)
@@ -47,14 +150,25 @@ class TemplateWrapper:
         self.gcode = self.printer.lookup_object('gcode')
         gcode_macro = self.printer.lookup_object('gcode_macro')
         self.create_template_context = gcode_macro.create_template_context
+        self.latency_get_time = gcode_macro.latency_get_time
+        self.latency_note = gcode_macro.latency_note
+        self.render_latency = gcode_macro.render_latency
         try:
-            self.template = env.from_string(script)
+            self.template = gcode_macro.compile_template(env, script)
         except Exception as e:
             msg = "Error loading template '%s': %s" % (
                  name, traceback.format_exception_only(type(e), e)[-1])
             logging.exception(msg)
             raise printer.config_error(msg)
+        # Scripts without any template syntax always render the same text
+        self.static_text = None
+        if '{' not in script:
+            self.static_text = str(self.template.render())
     def render(self, context=None):
+        start_time = self.latency_get_time()
+        if self.static_text is not None:
+            self.latency_note(self.render_latency, start_time)
+            return self.static_text
         if context is None:
             context = self.create_template_context()
         try:
@@ -64,6 +178,8 @@ class TemplateWrapper:
                 self.name, traceback.format_exception_only(type(e), e)[-1])
             logging.exception(msg)
             raise self.gcode.error(msg)
+        finally:
+            self.latency_note(self.render_latency, start_time)
     def run_gcode_from_command(self, context=None):
         self.gcode.run_script_from_command(self.render(context))
 
@@ -72,6 +188,33 @@ class PrinterGCodeMacro:
     def __init__(self, config):
         self.printer = config.get_printer()
         self.env = jinja2.Environment('{%', '%}', '{', '}')
+        # Compiled templates (keyed by environment and script)
+        self.templates = {}
+        # Status snapshots shared by all contexts with the same eventtime
+        self.snapshot_time = None
+        self.snapshots = {}
+        # Render time tracking
+        ffi_main, ffi_lib = chelper.get_ffi()
+        self.latency_get_time = ffi_lib.latency_get_time
+        self.latency_note = ffi_lib.latency_hist_note
+        self.render_latency = ffi_main.gc(ffi_lib.latency_hist_alloc(),
+                                          ffi_lib.free)
+    def compile_template(self, env, script):
+        template = self.templates.get((env, script))
+        if template is None:
+            template = self.templates[(env, script)] = env.from_string(script)
+        return template
+    def get_latency_histograms(self):
+        return [("gcode_macro_render", self.render_latency)]
+    def _get_status_snapshot(self, name, obj, eventtime):
+        if eventtime != self.snapshot_time:
+            self.snapshot_time = eventtime
+            self.snapshots = {}
+        res = self.snapshots.get(name)
+        if res is None:
+            res = copy_status(obj.get_status(eventtime))
+            self.snapshots[name] = res
+        return res
     def load_template(self, config, option, default=None):
         name = "%s:%s" % (config.get_name(), option)
         if default is None:
@@ -96,7 +239,8 @@ class PrinterGCodeMacro:
         return ""
     def create_template_context(self, eventtime=None):
         return {
-            'printer': GetStatusWrapper(self.printer, eventtime),
+            'printer': GetStatusWrapper(self.printer, eventtime,
+                                        self._get_status_snapshot),
             'action_emergency_stop': self._action_emergency_stop,
             'action_respond_info': self._action_respond_info,
             'action_raise_error': self._action_raise_error,
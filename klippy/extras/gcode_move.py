@@ -48,12 +48,14 @@ class GCodeMove:
         # G-Code state
         self.saved_states = {}
         self.move_transform = self.move_with_transform = None
+        self.move_batch_with_transform = None
         self.position_with_transform = (lambda: [0., 0., 0., 0.])
     def _handle_ready(self):
         self.is_printer_ready = True
         if self.move_transform is None:
             toolhead = self.printer.lookup_object('toolhead')
             self.move_with_transform = toolhead.move
+            self.move_batch_with_transform = toolhead.move_batch
             self.position_with_transform = toolhead.get_position
         self.reset_last_position()
     def _handle_shutdown(self):
@@ -84,8 +86,13 @@ class GCodeMove:
             old_transform = self.printer.lookup_object('toolhead', None)
         self.move_transform = transform
         self.move_with_transform = transform.move
+        self.move_batch_with_transform = getattr(
+            transform, 'move_batch', self._move_batch_fallback)
         self.position_with_transform = transform.get_position
         return old_transform
+    def _move_batch_fallback(self, positions, speed):
+        for pos in positions:
+            self.move_with_transform(pos, speed)
     def _get_gcode_position(self):
         p = [lp - bp for lp, bp in zip(self.last_position, self.base_position)]
         p[3] /= self.extrude_factor
@@ -141,6 +148,26 @@ class GCodeMove:
             raise gcmd.error("Unable to parse move '%s'"
                              % (gcmd.get_commandline(),))
         self.move_with_transform(self.last_position, self.speed)
+    def move_batch(self, coords, gcode_speed=None):
+        # Queue a series of absolute moves (as if each were a G1 with
+        # the given X, Y, Z, and optional E parameters)
+        if gcode_speed is not None:
+            self.speed = gcode_speed * self.speed_factor
+        bx, by, bz, be = self.base_position
+        ef = self.extrude_factor
+        last_e = self.last_position[3]
+        positions = []
+        for x, y, z, e in coords:
+            if e is not None:
+                if self.absolute_extrude:
+                    last_e = e * ef + be
+                else:
+                    last_e += e * ef
+            positions.append([x + bx, y + by, z + bz, last_e])
+        if not positions:
+            return
+        self.last_position = list(positions[-1])
+        self.move_batch_with_transform(positions, self.speed)
     # G-Code coordinate manipulation
     def cmd_G20(self, gcmd):
         # Set units to inches
@@ -49,13 +49,18 @@ class Heater:
         algo = config.getchoice('control', algos)
         self.control = algo(self, config)
         # Setup output heater pin
-        heater_pin = config.get('heater_pin')
-        ppins = self.printer.lookup_object('pins')
-        self.mcu_pwm = ppins.setup_pin('pwm', heater_pin)
         pwm_cycle_time = config.getfloat('pwm_cycle_time', 0.100, above=0.,
                                          maxval=self.pwm_delay)
-        self.mcu_pwm.setup_cycle_time(pwm_cycle_time)
-        self.mcu_pwm.setup_max_duration(MAX_HEAT_TIME)
+        if config.getboolean('mcu_control', False):
+            self.control = ControlMCU(self, config, self.control,
+                                      pwm_cycle_time)
+            self.mcu_pwm = self.control
+        else:
+            heater_pin = config.get('heater_pin')
+            ppins = self.printer.lookup_object('pins')
+            self.mcu_pwm = ppins.setup_pin('pwm', heater_pin)
+            self.mcu_pwm.setup_cycle_time(pwm_cycle_time)
+            self.mcu_pwm.setup_max_duration(MAX_HEAT_TIME)
         # Load additional modules
         self.printer.load_object(config, "verify_heater %s" % (short_name,))
         self.printer.load_object(config, "pid_calibrate")
@@ -226,6 +231,157 @@ class ControlPID:
                 or abs(self.prev_temp_deriv) > PID_SETTLE_SLOPE)
 
 
+######################################################################
+# Micro-controller based control
+######################################################################
+
+# The pid/watermark algorithm runs on the micro-controller (see
+# src/heater_control.c) at each adc measurement.  The host only sends
+# the target temperature and supervises the reported temperatures.
+MCU_VALUE_SCALE = 1 << 16
+MCU_TEMP_SCALE = 100.
+MCU_DERIV_SCALE = 256.
+MCU_TABLE_SIZE = 32
+MCU_MAX_GAIN = 0x7fffffff
+MCU_MODE_OFF, MCU_MODE_PID, MCU_MODE_WATERMARK, MCU_MODE_DIRECT = range(4)
+
+class ControlMCU:
+    def __init__(self, heater, config, control, pwm_cycle_time):
+        self.printer = config.get_printer()
+        self.heater = heater
+        self.control = control
+        self.is_pid = isinstance(control, ControlPID)
+        self.pwm_cycle_time = pwm_cycle_time
+        sensor = heater.sensor
+        if not hasattr(sensor, 'setup_mcu_control'):
+            raise config.error("Sensor type of '%s' does not support"
+                               " mcu_control" % (config.get_name(),))
+        self.control_time = config.getfloat(
+            'mcu_control_time', 0.100, minval=0.010,
+            maxval=heater.get_pwm_delay())
+        (self.mcu_adc, self.adc_convert, self.sample_duration,
+         self.sample_count) = sensor.setup_mcu_control(self.control_time)
+        self.mcu = self.mcu_adc.get_mcu()
+        ppins = self.printer.lookup_object('pins')
+        pin_params = ppins.lookup_pin(config.get('heater_pin'),
+                                      can_invert=True)
+        if pin_params['chip'] is not self.mcu:
+            raise config.error("mcu_control in '%s' requires the heater_pin"
+                               " and sensor_pin to be on the same mcu"
+                               % (config.get_name(),))
+        self.pin = pin_params['pin']
+        self.invert = pin_params['invert']
+        self.min_temp = heater.min_temp
+        self.max_temp = heater.max_temp
+        self.mcu_params = self._calc_params()
+        self.oid = self.update_cmd = None
+        self.last_update = None
+        self.next_update_time = 0.
+        self.last_power = self.last_deriv = 0.
+        self.mcu.register_config_callback(self._build_config)
+    def _calc_params(self):
+        # Convert the gains into the fixed point units used by the mcu
+        dt = self.control_time
+        kp = ki = kd = integ_max = deriv_alpha = max_delta = 0.
+        if self.is_pid:
+            c = self.control
+            kp = c.Kp * MCU_VALUE_SCALE / MCU_TEMP_SCALE
+            ki = c.Ki * dt * MCU_VALUE_SCALE / MCU_TEMP_SCALE
+            kd = c.Kd * MCU_VALUE_SCALE / (MCU_TEMP_SCALE * MCU_DERIV_SCALE
+                                           * dt)
+            integ_max = min(c.temp_integ_max * MCU_TEMP_SCALE / dt,
+                            MCU_MAX_GAIN)
+            deriv_alpha = min(1., dt / c.min_deriv_time) * MCU_VALUE_SCALE
+        else:
+            max_delta = self.control.max_delta * MCU_TEMP_SCALE
+        max_gain = max(kp, ki, kd)
+        if max_gain >= MCU_MAX_GAIN:
+            raise self.printer.config_error(
+                "Heater %s gains too large for mcu_control"
+                % (self.heater.get_name(),))
+        gain_shift = 0
+        while gain_shift < 40 and max_gain * 2.**(gain_shift+1) < MCU_MAX_GAIN:
+            gain_shift += 1
+        gain_scale = 2.**gain_shift
+        return (int(kp * gain_scale + .5), int(ki * gain_scale + .5),
+                int(kd * gain_scale + .5), gain_shift, int(integ_max),
+                int(deriv_alpha), int(max_delta),
+                int(self.heater.get_max_power() * MCU_VALUE_SCALE))
+    def _build_table(self):
+        # Generate adc to temperature conversion table (sorted by adc)
+        max_adc = self.sample_count * self.mcu.get_constant_float("ADC_MAX")
+        temp_step = (self.max_temp - self.min_temp) / (MCU_TABLE_SIZE - 1)
+        table = {}
+        for i in range(MCU_TABLE_SIZE):
+            temp = self.min_temp + i * temp_step
+            adc = self.adc_convert.calc_adc(temp)
+            adc = max(0, min(0xffff, int(adc * max_adc + .5)))
+            table.setdefault(adc, int(temp * MCU_TEMP_SCALE + .5))
+        return sorted(table.items())
+    def _build_config(self):
+        mcu = self.mcu
+        self.oid = mcu.create_oid()
+        table = self._build_table()
+        report_count = int(self.heater.get_pwm_delay() / self.control_time
+                           + .5)
+        mcu.add_config_cmd(
+            "config_heater_control oid=%d adc_oid=%d pin=%s invert=%d"
+            " cycle_ticks=%d max_duration=%d report_count=%d table_size=%d"
+            % (self.oid, self.mcu_adc.get_oid(), self.pin, self.invert,
+               mcu.seconds_to_clock(self.pwm_cycle_time),
+               mcu.seconds_to_clock(MAX_HEAT_TIME),
+               max(1, min(255, report_count)), len(table)))
+        for i, (adc, temp) in enumerate(table):
+            mcu.add_config_cmd(
+                "heater_control_set_table oid=%d pos=%d adc=%d temp=%d"
+                % (self.oid, i, adc, temp))
+        mcu.add_config_cmd(
+            "heater_control_setup oid=%d kp=%d ki=%d kd=%d gain_shift=%d"
+            " integ_max=%d deriv_alpha=%d max_delta=%d max_value=%d"
+            % ((self.oid,) + self.mcu_params))
+        cmd_queue = mcu.alloc_command_queue()
+        self.update_cmd = mcu.lookup_command(
+            "heater_control_update oid=%c mode=%c target=%i value=%u",
+            cq=cmd_queue)
+        mcu.register_response(self._handle_heater_control_state,
+                              "heater_control_state", self.oid)
+    def _handle_heater_control_state(self, params):
+        clock = self.mcu.clock32_to_clock64(params['clock'])
+        read_time = self.mcu.clock_to_print_time(clock) + self.sample_duration
+        self.last_power = params['value'] / float(MCU_VALUE_SCALE)
+        self.last_deriv = params['deriv'] / (
+            MCU_TEMP_SCALE * MCU_DERIV_SCALE * self.control_time)
+        temp = params['temp'] / MCU_TEMP_SCALE
+        self.heater.temperature_callback(read_time, temp)
+    def _send_update(self, read_time, mode, target, value):
+        update = (mode, target, value)
+        if update == self.last_update and read_time < self.next_update_time:
+            return
+        # Updates must be sent regularly to avoid an mcu max_duration error
+        self.last_update = update
+        self.next_update_time = read_time + 0.75 * MAX_HEAT_TIME
+        self.update_cmd.send([self.oid, mode, target, value])
+    # Interface for Heater (used when a host algorithm sets the output)
+    def get_mcu(self):
+        return self.mcu
+    def set_pwm(self, print_time, value):
+        mode = MCU_MODE_DIRECT if value else MCU_MODE_OFF
+        self._send_update(print_time, mode, 0, int(value * MCU_VALUE_SCALE))
+    # Control algorithm interface
+    def temperature_update(self, read_time, temp, target_temp):
+        mode = MCU_MODE_WATERMARK
+        if self.is_pid:
+            mode = MCU_MODE_PID
+            self.control.prev_temp_deriv = self.last_deriv
+        if target_temp <= 0. or self.heater.is_shutdown:
+            mode = MCU_MODE_OFF
+        self.heater.last_pwm_value = self.last_power
+        self._send_update(read_time, mode,
+                          int(target_temp * MCU_TEMP_SCALE + .5), 0)
+    def check_busy(self, eventtime, smoothed_temp, target_temp):
+        return self.control.check_busy(eventtime, smoothed_temp, target_temp)
+
+
 ######################################################################
 # Sensor and heater lookup
 ######################################################################
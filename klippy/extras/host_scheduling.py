@@ -0,0 +1,149 @@
+# Real-time scheduling and cpu isolation of the host software threads
+#
+# Copyright (C) 2026  agent <agent@local>
+#
+# This file may be distributed under the terms of the GNU GPLv3 license.
+import sys, os, logging, threading
+import chelper
+
+POLICIES = {'other': 'SCHED_OTHER', 'fifo': 'SCHED_FIFO', 'rr': 'SCHED_RR'}
+JITTER_COUNT = 200
+JITTER_INTERVAL = .001
+
+# The scheduling of the main thread at startup.  It is only recorded
+# once per process, as a RESTART reloads the config in the same process.
+orig_sched = None
+
+def get_orig_sched():
+    global orig_sched
+    if orig_sched is None:
+        orig_sched = (os.sched_getscheduler(0),
+                      os.sched_getparam(0).sched_priority,
+                      set(os.sched_getaffinity(0)))
+    return orig_sched
+
+# Scheduling settings of one class of threads
+class ThreadScheduling:
+    def __init__(self, config, name, all_cpus):
+        self.name = name
+        self.policy_name = config.getchoice(name + '_policy', list(POLICIES),
+                                            'other')
+        self.policy = getattr(os, POLICIES[self.policy_name])
+        if self.policy_name == 'other':
+            self.priority = config.getint(name + '_priority', 0,
+                                          minval=0, maxval=0)
+        else:
+            self.priority = config.getint(name + '_priority', 50,
+                                          minval=1, maxval=99)
+        self.is_default_cpus = config.get(name + '_cpus', None) is None
+        self.cpus = config.getintlist(name + '_cpus', sorted(all_cpus))
+        if not self.cpus or [c for c in self.cpus if c not in all_cpus]:
+            raise config.error("Invalid %s_cpus in host_scheduling" % (name,))
+    def get_reserved_cpus(self):
+        if self.is_default_cpus:
+            return set()
+        return set(self.cpus)
+    def apply(self, tid=0):
+        # Set the scheduling of a thread (the calling thread if tid=0)
+        try:
+            os.sched_setscheduler(tid, self.policy,
+                                  os.sched_param(self.priority))
+            os.sched_setaffinity(tid, self.cpus)
+        except OSError as e:
+            logging.warning("Unable to set %s thread scheduling: %s",
+                            self.name, e)
+            return False
+        return True
+    def apply_serialqueue(self, serialqueue):
+        ffi_main, ffi_lib = chelper.get_ffi()
+        return not ffi_lib.serialqueue_set_sched(
+            serialqueue, self.policy, self.priority, self.cpus, len(self.cpus))
+    def describe(self):
+        return "%s:%d cpus=%s" % (self.policy_name, self.priority,
+                                  ",".join([str(c) for c in self.cpus]))
+
+class HostScheduling:
+    def __init__(self, config):
+        self.printer = config.get_printer()
+        # Use the cpus available before the main thread was restricted
+        self.all_cpus = all_cpus = get_orig_sched()[2]
+        self.reactor_sched = ThreadScheduling(config, 'reactor', all_cpus)
+        self.serialqueue_sched = ThreadScheduling(config, 'serialqueue',
+                                                  all_cpus)
+        self.serialreader_sched = ThreadScheduling(config, 'serialreader',
+                                                   all_cpus)
+        self.all_sched = [self.reactor_sched, self.serialqueue_sched,
+                          self.serialreader_sched]
+        self.lock_memory = config.getboolean('lock_memory', False)
+        self.prefault_memory = config.getint('prefault_memory', 0, minval=0)
+        self.jitter_test = config.getboolean('jitter_test', True)
+        self.jitter = {}
+        # Memory locking and the main thread take effect immediately
+        if self.lock_memory:
+            ffi_main, ffi_lib = chelper.get_ffi()
+            if ffi_lib.sched_lock_memory(self.prefault_memory * 1024 * 1024):
+                logging.warning("Unable to lock host memory")
+        self.reactor_sched.apply()
+        if self.jitter_test:
+            self._run_jitter_test()
+        # The serial threads are created when the mcus connect
+        self.printer.register_event_handler("klippy:connect",
+                                            self._handle_connect)
+        self.printer.register_event_handler("klippy:disconnect",
+                                            self._handle_disconnect)
+    def _handle_disconnect(self):
+        # Restore the main thread scheduling (in case of a RESTART
+        # without a host_scheduling config section)
+        policy, priority, cpus = get_orig_sched()
+        try:
+            os.sched_setscheduler(0, policy, os.sched_param(priority))
+            os.sched_setaffinity(0, cpus)
+        except OSError as e:
+            logging.warning("Unable to restore reactor thread scheduling: %s",
+                            e)
+    def _handle_connect(self):
+        for name, mcu in self.printer.lookup_objects('mcu'):
+            serial = mcu.get_serial()
+            serialqueue = serial.get_serialqueue()
+            if serialqueue is not None:
+                self.serialqueue_sched.apply_serialqueue(serialqueue)
+            bg_thread = serial.get_background_thread()
+            if bg_thread is not None:
+                self.serialreader_sched.apply(bg_thread.native_id)
+    def _measure_jitter(self, sched):
+        # Measure the wakeup latency of a thread with the given scheduling
+        ffi_main, ffi_lib = chelper.get_ffi()
+        results = ffi_main.new('double[2]')
+        def run():
+            sched.apply()
+            ffi_lib.sched_measure_jitter(JITTER_COUNT, JITTER_INTERVAL,
+                                         results)
+        thread = threading.Thread(target=run)
+        thread.start()
+        thread.join()
+        return results[0], results[1]
+    def _run_jitter_test(self):
+        msgs = []
+        for sched in self.all_sched:
+            avg, maxval = self._measure_jitter(sched)
+            self.jitter[sched.name] = {'avg': avg, 'max': maxval}
+            msgs.append("%s(%s) avg=%.1fus max=%.1fus" % (
+                sched.name, sched.describe(), avg * 1000000.,
+                maxval * 1000000.))
+        logging.info("Host scheduling wakeup jitter: %s", " ".join(msgs))
+    def get_all_cpus(self):
+        return set(self.all_cpus)
+    def get_reserved_cpus(self):
+        # Return the cpus explicitly assigned to the klippy threads
+        cpus = set()
+        for sched in self.all_sched:
+            cpus |= sched.get_reserved_cpus()
+        return cpus
+    def get_status(self, eventtime):
+        return {'jitter': self.jitter}
+
+def load_config(config):
+    # Thread ids (threading native_id) are only available on Python 3.8+
+    if sys.version_info < (3, 8) or not hasattr(os, 'sched_setaffinity'):
+        raise config.error("host_scheduling requires Python 3.8 or later")
+    return HostScheduling(config)
@@ -0,0 +1,78 @@
+# Report host move pipeline latency histograms
+#
+# Copyright (C) 2026  agent <agent@local>
+#
+# This file may be distributed under the terms of the GNU GPLv3 license.
+import logging
+import chelper
+
+# The printer objects that process moves (gcode, toolhead, mcu) record
+# the time spent in each phase of the move pipeline into low-level
+# histograms (see chelper/latency.c).  This module periodically
+# summarizes those histograms into klippy.log and exports them via
+# the webhooks "latency_stats/dump" endpoint.
+
+LOG_INTERVAL = 60.
+
+class PrinterLatencyStats:
+    def __init__(self, config):
+        self.printer = config.get_printer()
+        self.reactor = self.printer.get_reactor()
+        self.histograms = []
+        self.last_report = {}
+        self.last_report_time = 0.
+        self.log_timer = self.reactor.register_timer(self._log_stats)
+        self.printer.register_event_handler("klippy:ready", self._handle_ready)
+        self.printer.register_event_handler("klippy:disconnect",
+                                            self._handle_disconnect)
+        wh = self.printer.lookup_object('webhooks')
+        wh.register_endpoint("latency_stats/dump", self._handle_dump)
+    def _handle_ready(self):
+        self.histograms = [
+            (name, lh) for n, o in self.printer.lookup_objects()
+            if hasattr(o, 'get_latency_histograms')
+            for name, lh in o.get_latency_histograms()]
+        if self.printer.get_start_args().get('debugoutput') is None:
+            self.last_report_time = self.reactor.monotonic()
+            self.reactor.update_timer(self.log_timer,
+                                      self.last_report_time + LOG_INTERVAL)
+    def _summarize(self, reset):
+        ffi_main, ffi_lib = chelper.get_ffi()
+        ls = ffi_main.new('struct pull_latency_summary *')
+        res = {}
+        for name, lh in self.histograms:
+            ffi_lib.latency_hist_summary(lh, ls, reset)
+            if not ls.count:
+                continue
+            res[name] = {'count': ls.count, 'avg': ls.avg, 'p50': ls.p50,
+                         'p99': ls.p99, 'p999': ls.p999, 'max': ls.max}
+        return res
+    def _log_report(self, eventtime, report):
+        out = ["Latency stats %.1f (seconds):" % (eventtime,)]
+        for name, r in sorted(report.items()):
+            out.append("%s: count=%d avg=%.9f p50=%.9f p99=%.9f"
+                       " p999=%.9f max=%.9f"
+                       % (name, r['count'], r['avg'], r['p50'], r['p99'],
+                          r['p999'], r['max']))
+        logging.info("\n  ".join(out))
+    def _log_stats(self, eventtime):
+        report = self._summarize(True)
+        self.last_report = report
+        self.last_report_time = eventtime
+        if 'trapq_append' in report:
+            # Only log while moves are being processed
+            self._log_report(eventtime, report)
+        return eventtime + LOG_INTERVAL
+    def _handle_disconnect(self):
+        # Report any remaining statistics (also used by batch mode tools)
+        report = self._summarize(True)
+        if report:
+            self._log_report(self.reactor.monotonic(), report)
+    def _handle_dump(self, web_request):
+        web_request.send({'interval': LOG_INTERVAL,
+                          'last_report_time': self.last_report_time,
+                          'last_report': self.last_report,
+                          'current': self._summarize(False)})
+
+def load_config(config):
+    return PrinterLatencyStats(config)
@@ -0,0 +1,193 @@
+# Report micro-controller timer and command profiling statistics
+#
+# Copyright (C) 2026  agent <agent@local>
+#
+# This file may be distributed under the terms of the GNU GPLv3 license.
+import logging
+
+# Micro-controller code built with CONFIG_WANT_PROFILE tracks the time
+# spent in each timer callback and command handler (see src/profile.c).
+# This module decodes those statistics and periodically writes them to
+# the log along with the move queue usage of each stepper.
+
+LOG_INTERVAL = 60.
+
+PT_END, PT_TIMER, PT_COMMAND, PT_LATENCY = range(4)
+KEY_OTHER = 0xffffffff
+
+class MCUProfile:
+    def __init__(self, mcu):
+        self.mcu = mcu
+        self.query_cmd = self.reset_cmd = self.multi_cmd = None
+        self.steppers = []
+        mcu.register_config_callback(self._build_config)
+    def _build_config(self):
+        if self.mcu.is_fileoutput():
+            return
+        if self.mcu.try_lookup_command("stepper_get_multi_stats") is not None:
+            self.multi_cmd = self.mcu.lookup_query_command(
+                "stepper_get_multi_stats",
+                "stepper_multi_stats messages=%u moves=%u")
+        if self.mcu.try_lookup_command("profile_query index=%c") is None:
+            return
+        self.query_cmd = self.mcu.lookup_query_command(
+            "profile_query index=%c",
+            "profile_item index=%c type=%c key=%u count=%u avg=%u max=%u")
+        self.reset_cmd = self.mcu.lookup_command("profile_reset")
+    def is_supported(self):
+        return self.query_cmd is not None
+    def add_stepper(self, stepper):
+        self.steppers.append(stepper)
+    def query_steppers(self, reset=False):
+        return [(s.get_name(), s.get_move_queue_stats(reset))
+                for s in self.steppers]
+    def format_multi(self):
+        # Report total queue_step_multi usage (as seen by the mcu) and
+        # the bytes saved (as last reported by the host stats)
+        if self.multi_cmd is None:
+            return []
+        params = self.multi_cmd.send()
+        last_stats = self.mcu.get_status().get('last_stats', {})
+        return ["queue_step_multi: messages=%d moves=%d bytes_saved=%d"
+                % (params['messages'], params['moves'],
+                   last_stats.get('step_bytes_saved', 0))]
+    def format_steppers(self, stepper_stats):
+        out = []
+        for name, st in stepper_stats:
+            msg = "stepper %s: peak_queue_share=%d" % (name, st['host_peak'])
+            if 'mcu_count' in st:
+                msg += " mcu_queued=%d mcu_peak=%d" % (st['mcu_count'],
+                                                      st['mcu_peak'])
+            out.append(msg)
+        return out
+    def _timer_name(self, key):
+        if key == KEY_OTHER:
+            return "other"
+        if not key:
+            # Timers with no callback are inlined calls to stepper_event()
+            return "stepper_event"
+        return "0x%x" % (key,)
+    def _command_name(self, key):
+        if key == KEY_OTHER:
+            return "other"
+        name = self.mcu.lookup_message_name(key)
+        if name is None:
+            return "msgid=%d" % (key,)
+        return name
+    def query(self, reset=False):
+        freq = self.mcu.seconds_to_clock(1.)
+        res = {'timers': [], 'commands': [], 'latency': [],
+               'peak_move_queue': 0}
+        index = 0
+        while 1:
+            params = self.query_cmd.send([index])
+            ptype = params['type']
+            key = params['key']
+            if ptype == PT_END:
+                res['peak_move_queue'] = key
+                break
+            index = params['index'] + 1
+            if ptype == PT_LATENCY:
+                # Bucket 'key' contains latencies less than 2**key ticks
+                res['latency'].append((float(1 << key) / freq,
+                                       params['count']))
+                continue
+            entry = {'count': params['count'], 'avg': params['avg'] / freq,
+                     'max': params['max'] / freq}
+            if ptype == PT_TIMER:
+                res['timers'].append((self._timer_name(key), entry))
+            else:
+                res['commands'].append((self._command_name(key), entry))
+        if reset:
+            self.reset_cmd.send()
+        return res
+    def format(self, res):
+        out = ["MCU '%s' profile (peak move queue %d):"
+               % (self.mcu.get_name(), res['peak_move_queue'])]
+        for kind in ['timers', 'commands']:
+            for name, e in sorted(res[kind], key=lambda i: -i[1]['count']):
+                out.append("%s %s: count=%d avg=%.3fus max=%.3fus" % (
+                    kind[:-1], name, e['count'], e['avg'] * 1000000.,
+                    e['max'] * 1000000.))
+        lat = ["<%.3fus:%d" % (t * 1000000., c) for t, c in res['latency']]
+        out.append("timer latency: %s" % (" ".join(lat),))
+        return out
+
+class PrinterMCUProfile:
+    def __init__(self, config):
+        self.printer = config.get_printer()
+        self.reactor = self.printer.get_reactor()
+        self.profiles = [(n, MCUProfile(m))
+                         for n, m in self.printer.lookup_objects('mcu')]
+        self.log_timer = self.reactor.register_timer(self._log_stats)
+        self.printer.register_event_handler("klippy:ready", self._handle_ready)
+        self.printer.register_event_handler("klippy:shutdown",
+                                            self._handle_shutdown)
+        gcode = self.printer.lookup_object('gcode')
+        gcode.register_command("MCU_PROFILE", self.cmd_MCU_PROFILE,
+                               desc=self.cmd_MCU_PROFILE_help)
+    def _supported(self):
+        return [(n, p) for n, p in self.profiles if p.is_supported()]
+    def _handle_ready(self):
+        stepper_enable = self.printer.lookup_object('stepper_enable', None)
+        snames = []
+        if stepper_enable is not None:
+            snames = stepper_enable.get_steppers()
+        for sname in snames:
+            stepper = stepper_enable.lookup_enable(sname).stepper
+            for name, prof in self.profiles:
+                if prof.mcu is stepper.get_mcu():
+                    prof.add_stepper(stepper)
+        if not self.printer.get_start_args().get('debugoutput'):
+            self.reactor.update_timer(self.log_timer,
+                                      self.reactor.monotonic() + LOG_INTERVAL)
+    def _log_profiles(self, reset):
+        for name, prof in self._supported():
+            try:
+                res = prof.query(reset)
+            except self.printer.command_error as e:
+                logging.info("Unable to query MCU '%s' profile: %s",
+                             name, str(e))
+                continue
+            logging.info("\n  ".join(prof.format(res)))
+    def _log_stats(self, eventtime):
+        if self.printer.is_shutdown():
+            return self.reactor.NEVER
+        self._log_profiles(True)
+        # Report stepper move queue usage while moves are being processed
+        for name, prof in self.profiles:
+            try:
+                stats = prof.query_steppers(True)
+            except self.printer.command_error:
+                continue
+            if any([st['host_peak'] for n, st in stats]):
+                logging.info("MCU '%s' move queue usage:\n  %s",
+                             prof.mcu.get_name(),
+                             "\n  ".join(prof.format_steppers(stats)))
+        return eventtime + LOG_INTERVAL
+    def _handle_shutdown(self):
+        # Report the statistics leading up to an mcu shutdown
+        if self._supported():
+            self.reactor.register_callback(
+                (lambda e: self._log_profiles(False)))
+    cmd_MCU_PROFILE_help = "Report micro-controller profiling statistics"
+    def cmd_MCU_PROFILE(self, gcmd):
+        mcu_name = gcmd.get('MCU', None)
+        reset = gcmd.get_int('RESET', 0, minval=0, maxval=1)
+        profiles = self.profiles
+        if mcu_name is not None:
+            profiles = [(n, p) for n, p in profiles
+                        if n == mcu_name or n == 'mcu ' + mcu_name]
+            if not profiles:
+                raise gcmd.error("Unknown mcu '%s'" % (mcu_name,))
+        for name, prof in profiles:
+            out = []
+            if prof.is_supported():
+                out = prof.format(prof.query(reset))
+            out.append("MCU '%s' move queue usage:" % (prof.mcu.get_name(),))
+            out += prof.format_multi()
+            out += prof.format_steppers(prof.query_steppers(reset))
+            gcmd.respond_info("\n".join(out))
+
+def load_config(config):
+    return PrinterMCUProfile(config)
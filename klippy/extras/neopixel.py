@@ -11,6 +11,10 @@ BIT_MAX_TIME=.000004
 RESET_MIN_TIME=.000050
 
 MAX_MCU_SIZE = 500  # Sanity check on LED chain length
+MAX_UPDATE_SIZE = 48  # Maximum color bytes in a neopixel_update command
+UPDATE_GAP = 8  # Unchanged bytes worth sending to avoid a new command
+
+EFFECTS = {"off": 0, "gradient": 1, "chase": 2, "progress": 3, "pulse": 4}
 
 class PrinterNeoPixel:
     def __init__(self, config):
@@ -24,6 +28,7 @@ class PrinterNeoPixel:
         self.pin = pin_params['pin']
         self.mcu.register_config_callback(self.build_config)
         self.neopixel_update_cmd = self.neopixel_send_cmd = None
+        self.neopixel_effect_cmd = None
         # Build color map
         chain_count = config.getint('chain_count', 1, minval=1)
         color_order = config.getlist("color_order", ["GRB"])
@@ -39,6 +44,17 @@ class PrinterNeoPixel:
         self.color_map = list(enumerate(color_indexes))
         if len(self.color_map) > MAX_MCU_SIZE:
             raise config.error("neopixel chain too long")
+        self.led_layout = []
+        pos = 0
+        for co in color_order:
+            self.led_layout.append((pos, co))
+            pos += len(co)
+        # Setup mcu effects
+        self.max_effects = config.getint('max_effects', 0, minval=0,
+                                         maxval=16)
+        self.effect_frame_time = config.getfloat('effect_frame_time', 0.050,
+                                                 minval=0.010)
+        self.effects = [None] * self.max_effects
         # Initialize color data
         pled = printer.load_object(config, "led")
         self.led_helper = pled.setup_helper(config, self.update_leds,
@@ -48,6 +64,12 @@ class PrinterNeoPixel:
         self.old_color_data = bytearray([d ^ 1 for d in self.color_data])
         # Register callbacks
         printer.register_event_handler("klippy:connect", self.send_data)
+        if self.max_effects:
+            name = config.get_name().split()[-1]
+            gcode = printer.lookup_object('gcode')
+            gcode.register_mux_command("SET_LED_EFFECT", "LED", name,
+                                       self.cmd_SET_LED_EFFECT,
+                                       desc=self.cmd_SET_LED_EFFECT_help)
     def build_config(self):
         bmt = self.mcu.seconds_to_clock(BIT_MAX_TIME)
         rmt = self.mcu.seconds_to_clock(RESET_MIN_TIME)
@@ -61,24 +83,40 @@ class PrinterNeoPixel:
         self.neopixel_send_cmd = self.mcu.lookup_query_command(
             "neopixel_send oid=%c", "neopixel_result oid=%c success=%c",
             oid=self.oid, cq=cmd_queue)
+        if self.max_effects:
+            ft = self.mcu.seconds_to_clock(self.effect_frame_time)
+            self.mcu.add_config_cmd(
+                "neopixel_setup_effects oid=%d count=%d frame_ticks=%d"
+                % (self.oid, self.max_effects, ft))
+            self.neopixel_effect_cmd = self.mcu.lookup_command(
+                "neopixel_effect oid=%c slot=%c type=%c pos=%hu count=%hu"
+                " color1=%*s color2=%*s param=%hu step=%hu", cq=cmd_queue)
     def update_color_data(self, led_state):
         color_data = self.color_data
         for cdidx, (lidx, cidx) in self.color_map:
             color_data[cdidx] = int(led_state[lidx][cidx] * 255. + .5)
-    def send_data(self, print_time=None):
+    def send_data(self, print_time=None, force=False):
         old_data, new_data = self.old_color_data, self.color_data
-        if new_data == old_data:
+        # The mcu generates the color data of leds with an active effect
+        for effect_range in self.effects:
+            if effect_range is not None:
+                start, end = effect_range
+                old_data[start:end] = new_data[start:end]
+        if new_data == old_data and not force:
             return
-        # Find the position of all changed bytes in this framebuffer
-        diffs = [[i, 1] for i, (n, o) in enumerate(zip(new_data, old_data))
-                 if n != o]
-        # Batch together changes that are close to each other
-        for i in range(len(diffs)-2, -1, -1):
-            pos, count = diffs[i]
-            nextpos, nextcount = diffs[i+1]
-            if pos + 5 >= nextpos and nextcount < 16:
-                diffs[i][1] = nextcount + (nextpos - pos)
-                del diffs[i+1]
+        # Find the ranges of changed bytes in this framebuffer - nearby
+        # changes are sent together in the largest possible commands
+        diffs = []
+        for i, (n, o) in enumerate(zip(new_data, old_data)):
+            if n == o:
+                continue
+            if diffs:
+                last = diffs[-1]
+                if (i - last[0] - last[1] < UPDATE_GAP
+                    and i + 1 - last[0] <= MAX_UPDATE_SIZE):
+                    last[1] = i + 1 - last[0]
+                    continue
+            diffs.append([i, 1])
         # Transmit changes
         ucmd = self.neopixel_update_cmd.send
         for pos, count in diffs:
@@ -99,6 +137,57 @@ class PrinterNeoPixel:
                 break
         else:
             logging.info("Neopixel update did not succeed")
+    cmd_SET_LED_EFFECT_help = "Run an animation on the micro-controller"
+    def cmd_SET_LED_EFFECT(self, gcmd):
+        slot = gcmd.get_int('SLOT', 0, minval=0, maxval=self.max_effects-1)
+        effect = gcmd.get('EFFECT').lower()
+        if effect not in EFFECTS:
+            raise gcmd.error("Unknown led effect '%s'" % (effect,))
+        led_count = len(self.led_layout)
+        index = gcmd.get_int('INDEX', 1, minval=1, maxval=led_count)
+        count = gcmd.get_int('COUNT', led_count - index + 1, minval=1,
+                             maxval=led_count - index + 1)
+        colors = []
+        for suffix in ['', '2']:
+            colors.append([gcmd.get_float(c + suffix, 0., minval=0., maxval=1.)
+                           for c in ['RED', 'GREEN', 'BLUE', 'WHITE']])
+        # Determine color data layout of the leds
+        pos, color_order = self.led_layout[index-1]
+        for lpos, co in self.led_layout[index-1:index-1+count]:
+            if co != color_order:
+                raise gcmd.error("LED effect requires identical color_order")
+        elem_size = len(color_order)
+        color1, color2 = [bytearray([int(c["RGBW".index(ch)] * 255. + .5)
+                                     for ch in color_order])
+                          for c in colors]
+        # Determine effect parameters
+        param = step = 0
+        if effect == "chase":
+            param = gcmd.get_int('LENGTH', 1, minval=1, maxval=count)
+            speed = gcmd.get_float('SPEED', 10., above=0.)
+            step = int(65536. * self.effect_frame_time * speed / count + .5)
+        elif effect == "pulse":
+            period = gcmd.get_float('PERIOD', 2., above=0.)
+            step = int(65536. * self.effect_frame_time / period + .5)
+        elif effect == "progress":
+            param = int(gcmd.get_float('VALUE', minval=0., maxval=1.)
+                        * 65535. + .5)
+        step = max(1, min(0x7fff, step)) if step else 0
+        etype = EFFECTS[effect]
+        with self.mutex:
+            old_range = self.effects[slot]
+            if old_range is not None:
+                # Resend the host color data once the effect is removed
+                start, end = old_range
+                for i in range(start, end):
+                    self.old_color_data[i] = self.color_data[i] ^ 1
+            self.effects[slot] = None
+            if etype:
+                self.effects[slot] = (pos, pos + count * elem_size)
+            self.neopixel_effect_cmd.send(
+                [self.oid, slot, etype, pos, count, color1, color2,
+                 param, step], reqclock=BACKGROUND_PRIORITY_CLOCK)
+            self.send_data(force=True)
     def update_leds(self, led_state, print_time):
         def reactor_bgfunc(eventtime):
             with self.mutex:
@@ -452,9 +452,17 @@ class ProbePointsHelper:
             raise gcmd.error("horizontal_move_z can't be less than"
                              " probe's z_offset")
         probe_session = probe.start_probe_session(gcmd)
+        # A "rapid scan" takes readings while the toolhead passes over
+        # each point - there is no need to stop or lift between points
+        is_rapid = (hasattr(probe_session, 'is_rapid_scan')
+                    and probe_session.is_rapid_scan())
+        if is_rapid:
+            probe_session.set_scan_speed(self.speed)
         probe_num = 0
         while 1:
-            self._raise_tool(not probe_num)
+            if (not is_rapid or not probe_num
+                or probe_num >= len(self.probe_points)):
+                self._raise_tool(not probe_num)
             if probe_num >= len(self.probe_points):
                 results = probe_session.pull_probed_results()
                 done = self._invoke_callback(results)
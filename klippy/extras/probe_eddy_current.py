@@ -210,7 +210,9 @@ class EddyGatherSamples:
         if self._need_stop:
             del self._samples[:]
             return False
-        self._samples.append(msg)
+        # Store the sample times and frequencies as separate lists
+        times, freqs, zpos = zip(*msg['data'])
+        self._samples.append((times, freqs))
         self._check_samples()
         return True
     def finish(self):
@@ -233,18 +235,17 @@ class EddyGatherSamples:
         samp_sum = 0.
         samp_count = 0
         while msg_num < len(self._samples):
-            msg = self._samples[msg_num]
+            times, freqs = self._samples[msg_num]
             msg_num += 1
-            data = msg['data']
-            if data[0][0] > end_time:
+            if times[0] > end_time:
                 break
-            if data[-1][0] < start_time:
+            if times[-1] < start_time:
                 discard_msgs = msg_num
                 continue
-            for time, freq, z in data:
-                if time >= start_time and time <= end_time:
-                    samp_sum += freq
-                    samp_count += 1
+            start_pos = bisect.bisect_left(times, start_time)
+            end_pos = bisect.bisect_right(times, end_time)
+            samp_sum += sum(freqs[start_pos:end_pos])
+            samp_count += end_pos - start_pos
         del self._samples[:discard_msgs]
         if not samp_count:
             # No sensor readings - raise error in pull_probed()
@@ -260,7 +261,7 @@ class EddyGatherSamples:
     def _check_samples(self):
         while self._samples and self._probe_times:
             start_time, end_time, pos_time, toolhead_pos = self._probe_times[0]
-            if self._samples[-1]['data'][-1][0] < end_time:
+            if self._samples[-1][0][-1] < end_time:
                 break
             freq = self._pull_freq(start_time, end_time)
             if pos_time is not None:
@@ -363,10 +364,14 @@ class EddyEndstopWrapper:
     def get_position_endstop(self):
         return self._z_offset
 
-# Implementing probing with "METHOD=scan"
+# Implementing probing with "METHOD=scan" and "METHOD=rapid_scan"
 class EddyScanningProbe:
-    def __init__(self, printer, sensor_helper, calibration, z_offset, gcmd):
+    def __init__(self, printer, sensor_helper, calibration, z_offset, gcmd,
+                 is_rapid=False, rapid_sample_dist=0.):
         self._printer = printer
+        self._is_rapid = is_rapid
+        self._rapid_sample_dist = rapid_sample_dist
+        self._rapid_sample_time = 0.
         self._sensor_helper = sensor_helper
         self._calibration = calibration
         self._z_offset = z_offset
@@ -374,14 +379,34 @@ class EddyScanningProbe:
                                          calibration, z_offset)
         self._sample_time_delay = 0.050
         self._sample_time = 0.100
+    def is_rapid_scan(self):
+        return self._is_rapid
+    def set_scan_speed(self, speed):
+        # Sample over a fixed distance around each point
+        self._rapid_sample_time = self._rapid_sample_dist / speed
+    def _rapid_lookahead_cb(self, printtime):
+        # Average the samples taken while passing over the probe point
+        sample_time = self._rapid_sample_time
+        start_time = printtime - sample_time / 2.
+        self._gather.note_probe_and_position(
+            start_time, start_time + sample_time, printtime)
     def run_probe(self, gcmd):
         toolhead = self._printer.lookup_object("toolhead")
+        if self._is_rapid:
+            # Note the time the toolhead reaches the point (without
+            # flushing the lookahead queue, so motion does not stop)
+            toolhead.register_lookahead_callback(self._rapid_lookahead_cb)
+            return
         printtime = toolhead.get_last_move_time()
         toolhead.dwell(self._sample_time_delay + self._sample_time)
         start_time = printtime + self._sample_time_delay
         self._gather.note_probe_and_position(
             start_time, start_time + self._sample_time, start_time)
     def pull_probed_results(self):
+        if self._is_rapid:
+            # Flush lookahead queue (to register any pending probe times)
+            toolhead = self._printer.lookup_object("toolhead")
+            toolhead.get_last_move_time()
         results = self._gather.pull_probed()
         # Allow axis_twist_compensation to update results
         for epos in results:
@@ -407,6 +432,8 @@ class PrinterEddyProbe:
             config, self, self.mcu_probe.query_endstop)
         self.probe_offsets = probe.ProbeOffsetsHelper(config)
         self.probe_session = probe.ProbeSessionHelper(config, self.mcu_probe)
+        self.rapid_sample_dist = config.getfloat('rapid_scan_sample_distance',
+                                                 2., above=0.)
         self.printer.add_object('probe', self)
     def add_client(self, cb):
         self.sensor_helper.add_client(cb)
@@ -418,10 +445,12 @@ class PrinterEddyProbe:
         return self.cmd_helper.get_status(eventtime)
     def start_probe_session(self, gcmd):
         method = gcmd.get('METHOD', 'automatic').lower()
-        if method == 'scan':
+        if method in ('scan', 'rapid_scan'):
             z_offset = self.get_offsets()[2]
             return EddyScanningProbe(self.printer, self.sensor_helper,
-                                     self.calibration, z_offset, gcmd)
+                                     self.calibration, z_offset, gcmd,
+                                     is_rapid=(method == 'rapid_scan'),
+                                     rapid_sample_dist=self.rapid_sample_dist)
         return self.probe_session.start_probe_session(gcmd)
 
 def load_config_prefix(config):
@@ -4,7 +4,7 @@
 #
 # This file may be distributed under the terms of the GNU GPLv3 license.
 import logging, math, os, time
-from . import shaper_calibrate
+from . import bulk_sensor, shaper_calibrate
 
 class TestAxis:
     def __init__(self, axis=None, vib_dir=None):
@@ -120,6 +120,7 @@ class VibrationPulseTest:
 class ResonanceTester:
     def __init__(self, config):
         self.printer = config.get_printer()
+        self.printer.load_object(config, 'worker_pool')
         self.move_speed = config.getfloat('move_speed', 50., above=0.)
         self.test = VibrationPulseTest(config)
         if not config.get('accel_chip_x', None):
@@ -150,7 +151,7 @@ class ResonanceTester:
                 for chip_axis, chip_name in self.accel_chip_names]
 
     def _run_test(self, gcmd, axes, helper, raw_name_suffix=None,
-                  accel_chips=None, test_point=None):
+                  accel_chips=None, test_point=None, raw_format='binary'):
         toolhead = self.printer.lookup_object('toolhead')
         calibration_data = {axis: None for axis in axes}
 
@@ -182,28 +183,58 @@ class ResonanceTester:
                     for chip in accel_chips:
                         aclient = chip.start_internal_client()
                         raw_values.append((axis, aclient, chip.name))
+                raw_names = []
+                if raw_name_suffix is not None:
+                    # Record the raw samples to a file as they arrive
+                    ext = '.csv' if raw_format == 'csv' else '.bin'
+                    for chip_axis, aclient, chip_name in raw_values:
+                        raw_name = self.get_filename(
+                                'raw_data', raw_name_suffix, axis,
+                                point if len(test_points) > 1 else None,
+                                chip_name if accel_chips is not None else None,
+                                ext=ext)
+                        try:
+                            aclient.start_capture(
+                                raw_name, raw_format,
+                                {'sensor': chip_name, 'axis': axis.get_name(),
+                                 'point': list(point)})
+                        except (IOError, OSError) as e:
+                            for c_axis, c, c_name in raw_values:
+                                c.finish_measurements()
+                            raise gcmd.error("Unable to create %s: %s"
+                                             % (raw_name, str(e)))
+                        raw_names.append(raw_name)
+                psd_streams = []
+                if helper is not None:
+                    # Calculate the frequency response as samples arrive
+                    for chip_axis, aclient, chip_name in raw_values:
+                        psd = helper.create_psd_stream()
+                        aclient.add_sample_handler(psd.add_samples)
+                        psd_streams.append(psd)
 
                 # Generate moves
                 self.test.run_test(axis, gcmd)
                 for chip_axis, aclient, chip_name in raw_values:
                     aclient.finish_measurements()
-                    if raw_name_suffix is not None:
-                        raw_name = self.get_filename(
-                                'raw_data', raw_name_suffix, axis,
-                                point if len(test_points) > 1 else None,
-                                chip_name if accel_chips is not None else None,)
-                        aclient.write_to_file(raw_name)
-                        gcmd.respond_info(
-                                "Writing raw accelerometer data to "
-                                "%s file" % (raw_name,))
+                for (chip_axis, aclient, chip_name), raw_name in zip(
+                        raw_values, raw_names):
+                    try:
+                        aclient.finish_capture()
+                    except (IOError, OSError) as e:
+                        raise gcmd.error("Error writing %s: %s"
+                                         % (raw_name, str(e)))
+                    gcmd.respond_info(
+                            "Writing raw accelerometer data to "
+                            "%s file" % (raw_name,))
                 if helper is None:
                     continue
-                for chip_axis, aclient, chip_name in raw_values:
+                for (chip_axis, aclient, chip_name), psd in zip(raw_values,
+                                                                psd_streams):
                     if not aclient.has_valid_samples():
                         raise gcmd.error(
                             "accelerometer '%s' measured no data" % (
                                 chip_name,))
-                    new_data = helper.process_accelerometer_data(aclient)
+                    new_data = helper.process_accelerometer_data(psd)
                     if calibration_data[axis] is None:
                         calibration_data[axis] = new_data
                     else:
@@ -253,6 +284,9 @@ class ResonanceTester:
             raise gcmd.error("Invalid NAME parameter")
         csv_output = 'resonances' in outputs
         raw_output = 'raw_data' in outputs
+        raw_format = gcmd.get("RAW_FORMAT", "binary").lower()
+        if raw_format not in bulk_sensor.CAPTURE_FORMATS:
+            raise gcmd.error("Invalid RAW_FORMAT parameter")
 
         # Setup calculation of resonances
         if csv_output:
@@ -263,7 +297,8 @@ class ResonanceTester:
         data = self._run_test(
                 gcmd, [axis], helper,
                 raw_name_suffix=name_suffix if raw_output else None,
-                accel_chips=accel_chips, test_point=test_point)[axis]
+                accel_chips=accel_chips, test_point=test_point,
+                raw_format=raw_format)[axis]
         if csv_output:
             csv_name = self.save_calibration_data(
                     'resonances', name_suffix, helper, axis, data,
@@ -335,18 +370,22 @@ class ResonanceTester:
         "Measures noise of all enabled accelerometer chips")
     def cmd_MEASURE_AXES_NOISE(self, gcmd):
         meas_time = gcmd.get_float("MEAS_TIME", 2.)
-        raw_values = [(chip_axis, chip.start_internal_client())
-                      for chip_axis, chip in self.accel_chips]
+        helper = shaper_calibrate.ShaperCalibrate(self.printer)
+        raw_values = []
+        for chip_axis, chip in self.accel_chips:
+            aclient = chip.start_internal_client()
+            psd = helper.create_psd_stream()
+            aclient.add_sample_handler(psd.add_samples)
+            raw_values.append((chip_axis, aclient, psd))
         self.printer.lookup_object('toolhead').dwell(meas_time)
-        for chip_axis, aclient in raw_values:
+        for chip_axis, aclient, psd in raw_values:
             aclient.finish_measurements()
-        helper = shaper_calibrate.ShaperCalibrate(self.printer)
-        for chip_axis, aclient in raw_values:
+        for chip_axis, aclient, psd in raw_values:
             if not aclient.has_valid_samples():
                 raise gcmd.error(
                         "%s-axis accelerometer measured no data" % (
                             chip_axis,))
-            data = helper.process_accelerometer_data(aclient)
+            data = helper.process_accelerometer_data(psd)
             vx = data.psd_x.mean()
             vy = data.psd_y.mean()
             vz = data.psd_z.mean()
@@ -358,7 +397,7 @@ class ResonanceTester:
         return name_suffix.replace('-', '').replace('_', '').isalnum()
 
     def get_filename(self, base, name_suffix, axis=None,
-                     point=None, chip_name=None):
+                     point=None, chip_name=None, ext=".csv"):
         name = base
         if axis:
             name += '_' + axis.get_name()
@@ -367,7 +406,7 @@ class ResonanceTester:
         if point:
             name += "_%.3f_%.3f_%.3f" % (point[0], point[1], point[2])
         name += '_' + name_suffix
-        return os.path.join("/tmp", name + ".csv")
+        return os.path.join("/tmp", name + ext)
 
     def save_calibration_data(self, base_name, name_suffix, shaper_calibrate,
                               axis, calibration_data,
@@ -53,14 +53,99 @@ class CalibrationData:
         return self._psd_map[axis]
 
 
+# Minimum measurement time used to estimate the sampling frequency (and
+# thus the window size) of streaming PSD calculations
+STREAM_ESTIMATE_T_SEC = 2. * WINDOW_T_SEC
+
+# Calculate the PSD of accelerometer samples as they arrive.  Welch's
+# algorithm only needs the running sum of the response of each window,
+# so just the samples of the last (partially filled) window are kept.
+# The window size is chosen from the sampling frequency of the first
+# samples and the final sampling frequency is applied once all samples
+# have arrived, which produces the same results as calc_freq_response().
+class StreamingPSD:
+    def __init__(self, helper):
+        self.helper = helper
+        self.numpy = np = helper.numpy
+        self.pending = np.zeros((0, 3))
+        self.sample_count = 0
+        self.first_time = self.last_time = None
+        self.window = None
+        self.psd_sums = None
+        self.num_windows = 0
+    def add_samples(self, samples):
+        np = self.numpy
+        if not len(samples):
+            return
+        data = np.array(samples, dtype=float)
+        if self.first_time is None:
+            self.first_time = data[0,0]
+        self.last_time = data[-1,0]
+        self.sample_count += data.shape[0]
+        self.pending = np.concatenate((self.pending, data[:,1:]))
+        if self.window is None:
+            T = self.last_time - self.first_time
+            if T < STREAM_ESTIMATE_T_SEC:
+                return
+            self._setup_window(self.sample_count / T)
+        self._process_windows()
+    def _setup_window(self, sampling_freq):
+        np = self.numpy
+        nfft = self.helper._calc_nfft(sampling_freq)
+        self.window = np.kaiser(nfft, 6.)
+        self.psd_sums = [np.zeros(nfft // 2 + 1) for i in range(3)]
+    def _process_windows(self):
+        nfft = self.window.shape[0]
+        step = nfft - nfft // 2
+        pending = self.pending
+        if pending.shape[0] < nfft:
+            return
+        for i in range(3):
+            psd_sum, num_windows = self.helper._psd_windows_sum(
+                    pending[:,i], self.window)
+            self.psd_sums[i] += psd_sum
+        self.num_windows += num_windows
+        # Retain the samples needed by the next (overlapping) window
+        self.pending = pending[num_windows * step:].copy()
+    def get_calibration_data(self):
+        N = self.sample_count
+        if N < 2 or self.last_time <= self.first_time:
+            return None
+        SAMPLING_FREQ = N / (self.last_time - self.first_time)
+        if self.window is None:
+            self._setup_window(SAMPLING_FREQ)
+            self._process_windows()
+        if N <= self.window.shape[0] or not self.num_windows:
+            return None
+        helper = self.helper
+        fx, px = helper._psd_finalize(self.psd_sums[0], self.num_windows,
+                                      self.window, SAMPLING_FREQ)
+        fy, py = helper._psd_finalize(self.psd_sums[1], self.num_windows,
+                                      self.window, SAMPLING_FREQ)
+        fz, pz = helper._psd_finalize(self.psd_sums[2], self.num_windows,
+                                      self.window, SAMPLING_FREQ)
+        return CalibrationData(fx, px+py+pz, px, py, pz)
+
 CalibrationResult = collections.namedtuple(
         'CalibrationResult',
         ('name', 'freq', 'vals', 'vibrs', 'smoothing', 'score', 'max_accel'))
 
+# The subset of CalibrationData needed to fit a shaper
+FitData = collections.namedtuple('FitData', ('freq_bins', 'psd_sum'))
+
+# Fit a shaper in a worker_pool process (jobs must be module level
+# functions, as a bound method can not be pickled on Python 2)
+def _pool_fit_shaper(*args):
+    return ShaperCalibrate(None).fit_shaper(*args)
+
 class ShaperCalibrate:
     def __init__(self, printer):
         self.printer = printer
         self.error = printer.command_error if printer else Exception
+        self.max_workers = multiprocessing.cpu_count()
+        self.worker_pool = None
+        if printer is not None:
+            self.worker_pool = printer.lookup_object('worker_pool', None)
         try:
             self.numpy = importlib.import_module('numpy')
         except ImportError:
@@ -69,13 +154,12 @@ class ShaperCalibrate:
                     "installed via `~/klippy-env/bin/pip install` (refer to "
                     "docs/Measuring_Resonances.md for more details).")
 
-    def background_process_exec(self, method, args):
-        if self.printer is None:
-            return method(*args)
-        import queuelogger
+    def _start_background_process(self, method, args):
         parent_conn, child_conn = multiprocessing.Pipe()
         def wrapper():
-            queuelogger.clear_bg_logging()
+            if self.printer is not None:
+                import queuelogger
+                queuelogger.clear_bg_logging()
             try:
                 res = method(*args)
             except:
@@ -88,22 +172,61 @@ class ShaperCalibrate:
         calc_proc = multiprocessing.Process(target=wrapper)
         calc_proc.daemon = True
         calc_proc.start()
-        # Wait for the process to finish
-        reactor = self.printer.get_reactor()
-        gcode = self.printer.lookup_object("gcode")
-        eventtime = last_report_time = reactor.monotonic()
-        while calc_proc.is_alive():
-            if eventtime > last_report_time + 5.:
-                last_report_time = eventtime
-                gcode.respond_info("Wait for calculations..", log=False)
-            eventtime = reactor.pause(eventtime + .1)
-        # Return results
-        is_err, res = parent_conn.recv()
-        if is_err:
-            raise self.error("Error in remote calculation: %s" % (res,))
-        calc_proc.join()
-        parent_conn.close()
-        return res
+        return calc_proc, parent_conn
+
+    def background_process_exec(self, method, args):
+        return self.background_process_exec_multi(method, [args])[0]
+
+    def background_process_exec_multi(self, method, args_list):
+        # Perform a calculation for each entry in 'args_list', using up
+        # to 'max_workers' background processes in parallel
+        if self.printer is None and (self.max_workers <= 1
+                                     or len(args_list) <= 1):
+            return [method(*args) for args in args_list]
+        if self.printer is not None:
+            reactor = self.printer.get_reactor()
+            gcode = self.printer.lookup_object("gcode")
+            eventtime = last_report_time = reactor.monotonic()
+        results = [None] * len(args_list)
+        pending = list(enumerate(args_list))
+        running = []
+        try:
+            while pending or running:
+                while pending and len(running) < self.max_workers:
+                    index, args = pending.pop(0)
+                    calc_proc, conn = self._start_background_process(
+                            method, args)
+                    running.append((index, calc_proc, conn))
+                # Collect the results of finished processes
+                for item in list(running):
+                    index, calc_proc, conn = item
+                    if not conn.poll():
+                        if calc_proc.is_alive() or conn.poll():
+                            continue
+                        raise self.error("Remote calculation failed")
+                    is_err, res = conn.recv()
+                    running.remove(item)
+                    calc_proc.join()
+                    conn.close()
+                    if is_err:
+                        raise self.error(
+                                "Error in remote calculation: %s" % (res,))
+                    results[index] = res
+                if not running:
+                    continue
+                # Wait for the processes to finish
+                if self.printer is None:
+                    running[0][2].poll(.1)
+                    continue
+                if eventtime > last_report_time + 5.:
+                    last_report_time = eventtime
+                    gcode.respond_info("Wait for calculations..", log=False)
+                eventtime = reactor.pause(eventtime + .1)
+        finally:
+            for index, calc_proc, conn in running:
+                calc_proc.terminate()
+                conn.close()
+        return results
 
     def _split_into_windows(self, x, window_size, overlap):
         # Memory-efficient algorithm to split an input 'x' into a series
@@ -115,12 +238,15 @@ class ShaperCalibrate:
         return self.numpy.lib.stride_tricks.as_strided(
                 x, shape=shape, strides=strides, writeable=False)
 
-    def _psd(self, x, fs, nfft):
-        # Calculate power spectral density (PSD) using Welch's algorithm
+    def _calc_nfft(self, sampling_freq):
+        # Round up to the nearest power of 2 for faster FFT
+        return 1 << int(sampling_freq * WINDOW_T_SEC - 1).bit_length()
+
+    def _psd_windows_sum(self, x, window):
+        # Sum the (unscaled) frequency response of the overlapping
+        # windows of 'x', returns the sum and the number of windows
         np = self.numpy
-        window = np.kaiser(nfft, 6.)
-        # Compensation for windowing loss
-        scale = 1.0 / (window**2).sum()
+        nfft = window.shape[0]
 
         # Split into overlapping windows of size nfft
         overlap = nfft // 2
@@ -132,19 +258,34 @@ class ShaperCalibrate:
         # Calculate frequency response for each window using FFT
         result = np.fft.rfft(x, n=nfft, axis=0)
         result = np.conjugate(result) * result
-        result *= scale / fs
+        return result.real.sum(axis=-1), x.shape[-1]
+
+    def _psd_finalize(self, psd_sum, num_windows, window, fs):
+        np = self.numpy
+        nfft = window.shape[0]
+        # Compensation for windowing loss
+        scale = 1.0 / (window**2).sum()
+
+        # Welch's algorithm: average response over windows
+        psd = psd_sum * (scale / (fs * num_windows))
         # For one-sided FFT output the response must be doubled, except
         # the last point for unpaired Nyquist frequency (assuming even nfft)
         # and the 'DC' term (0 Hz)
-        result[1:-1,:] *= 2.
-
-        # Welch's algorithm: average response over windows
-        psd = result.real.mean(axis=-1)
+        psd[1:-1] *= 2.
 
         # Calculate the frequency bins
         freqs = np.fft.rfftfreq(nfft, 1. / fs)
         return freqs, psd
 
+    def _psd(self, x, fs, nfft):
+        # Calculate power spectral density (PSD) using Welch's algorithm
+        window = self.numpy.kaiser(nfft, 6.)
+        psd_sum, num_windows = self._psd_windows_sum(x, window)
+        return self._psd_finalize(psd_sum, num_windows, window, fs)
+
+    def create_psd_stream(self):
+        return StreamingPSD(self)
+
     def calc_freq_response(self, raw_values):
         np = self.numpy
         if raw_values is None:
@@ -160,8 +301,7 @@ class ShaperCalibrate:
         N = data.shape[0]
         T = data[-1,0] - data[0,0]
         SAMPLING_FREQ = N / T
-        # Round up to the nearest power of 2 for faster FFT
-        M = 1 << int(SAMPLING_FREQ * WINDOW_T_SEC - 1).bit_length()
+        M = self._calc_nfft(SAMPLING_FREQ)
         if N <= M:
             return None
 
@@ -173,59 +313,82 @@ class ShaperCalibrate:
         return CalibrationData(fx, px+py+pz, px, py, pz)
 
     def process_accelerometer_data(self, data):
-        calibration_data = self.background_process_exec(
-                self.calc_freq_response, (data,))
+        if isinstance(data, StreamingPSD):
+            # The frequency response was calculated as samples arrived
+            calibration_data = data.get_calibration_data()
+        else:
+            calibration_data = self.background_process_exec(
+                    self.calc_freq_response, (data,))
         if calibration_data is None:
             raise self.error(
                     "Internal error processing accelerometer data %s" % (data,))
         calibration_data.set_numpy(self.numpy)
         return calibration_data
 
-    def _estimate_shaper(self, shaper, test_damping_ratio, test_freqs):
+    def _get_shapers(self, shaper_cfg, shaper_freqs, damping_ratio):
+        # Return the pulse amplitudes (A) and times (T) of the shaper at
+        # each of the shaper frequencies as 2d arrays (one row per shaper)
         np = self.numpy
-
-        A, T = np.array(shaper[0]), np.array(shaper[1])
-        inv_D = 1. / A.sum()
+        shapers = [shaper_cfg.init_func(freq, damping_ratio)
+                   for freq in shaper_freqs]
+        return (np.array([A for A, T in shapers]),
+                np.array([T for A, T in shapers]))
+
+    def _estimate_shapers(self, A, T, test_damping_ratio, test_freqs):
+        # Calculate the vibration reduction ratio of each shaper at
+        # each of the test frequencies
+        np = self.numpy
+        inv_D = 1. / A.sum(axis=-1)
 
         omega = 2. * math.pi * test_freqs
         damping = test_damping_ratio * omega
         omega_d = omega * math.sqrt(1. - test_damping_ratio**2)
-        W = A * np.exp(np.outer(-damping, (T[-1] - T)))
-        S = W * np.sin(np.outer(omega_d, T))
-        C = W * np.cos(np.outer(omega_d, T))
-        return np.sqrt(S.sum(axis=1)**2 + C.sum(axis=1)**2) * inv_D
-
-    def _estimate_remaining_vibrations(self, shaper, test_damping_ratio,
-                                       freq_bins, psd):
-        vals = self._estimate_shaper(shaper, test_damping_ratio, freq_bins)
-        # The input shaper can only reduce the amplitude of vibrations by
-        # SHAPER_VIBRATION_REDUCTION times, so all vibrations below that
-        # threshold can be igonred
-        vibr_threshold = psd.max() / shaper_defs.SHAPER_VIBRATION_REDUCTION
-        remaining_vibrations = self.numpy.maximum(
-                vals * psd - vibr_threshold, 0).sum()
-        all_vibrations = self.numpy.maximum(psd - vibr_threshold, 0).sum()
-        return (remaining_vibrations / all_vibrations, vals)
-
-    def _get_shaper_smoothing(self, shaper, accel=5000, scv=5.):
-        half_accel = accel * .5
-
-        A, T = shaper
-        inv_D = 1. / sum(A)
-        n = len(T)
+        W = A[:,None,:] * np.exp(
+                -damping[None,:,None] * (T[:,-1:] - T)[:,None,:])
+        omega_t = omega_d[None,:,None] * T[:,None,:]
+        S = (W * np.sin(omega_t)).sum(axis=-1)
+        C = (W * np.cos(omega_t)).sum(axis=-1)
+        return np.sqrt(S**2 + C**2) * inv_D[:,None]
+
+    def _get_smoothing_coeffs(self, A, T, scv):
+        # The smoothing of a shaper is max(c90 + accel * k90, accel * k180)
+        # where c90, k90, and k180 are returned for each shaper
+        np = self.numpy
+        inv_D = 1. / A.sum(axis=-1)
         # Calculate input shaper shift
-        ts = sum([A[i] * T[i] for i in range(n)]) * inv_D
-
+        ts = (A * T).sum(axis=-1) * inv_D
+        dT = T - ts[:,None]
         # Calculate offset for 90 and 180 degrees turn
-        offset_90 = offset_180 = 0.
-        for i in range(n):
-            if T[i] >= ts:
-                # Calculate offset for one of the axes
-                offset_90 += A[i] * (scv + half_accel * (T[i]-ts)) * (T[i]-ts)
-            offset_180 += A[i] * half_accel * (T[i]-ts)**2
-        offset_90 *= inv_D * math.sqrt(2.)
-        offset_180 *= inv_D
-        return max(offset_90, offset_180)
+        half_offset = .5 * A * dT**2
+        turn = T >= ts[:,None]
+        c90 = (A * scv * dT * turn).sum(axis=-1) * inv_D * math.sqrt(2.)
+        k90 = (half_offset * turn).sum(axis=-1) * inv_D * math.sqrt(2.)
+        k180 = half_offset.sum(axis=-1) * inv_D
+        return c90, k90, k180
+
+    def _calc_smoothing(self, coeffs, accel=5000):
+        c90, k90, k180 = coeffs
+        return self.numpy.maximum(c90 + accel * k90, accel * k180)
+
+    def _calc_max_accel(self, coeffs):
+        # Just some empirically chosen value which produces good projections
+        # for max_accel without much smoothing
+        TARGET_SMOOTHING = 0.12
+        np = self.numpy
+        c90, k90, k180 = coeffs
+        # The smoothing grows linearly with the acceleration, so the
+        # max_accel can be found directly
+        with np.errstate(divide='ignore', invalid='ignore'):
+            accel_90 = np.where(k90 > 0., (TARGET_SMOOTHING - c90) / k90,
+                                np.inf)
+            accel_180 = np.where(k180 > 0., TARGET_SMOOTHING / k180, np.inf)
+        return np.maximum(np.minimum(accel_90, accel_180), 0.)
+
+    def find_shaper_max_accel(self, shaper, scv):
+        np = self.numpy
+        A, T = np.array([shaper[0]]), np.array([shaper[1]])
+        return float(self._calc_max_accel(
+            self._get_smoothing_coeffs(A, T, scv))[0])
 
     def fit_shaper(self, shaper_cfg, calibration_data, shaper_freqs,
                    damping_ratio, scv, max_smoothing, test_damping_ratios,
@@ -252,37 +415,61 @@ class ShaperCalibrate:
         psd = calibration_data.psd_sum[freq_bins <= max_freq]
         freq_bins = freq_bins[freq_bins <= max_freq]
 
-        best_res = None
-        results = []
-        for test_freq in test_freqs[::-1]:
-            shaper_vibrations = 0.
-            shaper_vals = np.zeros(shape=freq_bins.shape)
-            shaper = shaper_cfg.init_func(test_freq, damping_ratio)
-            shaper_smoothing = self._get_shaper_smoothing(shaper, scv=scv)
-            if max_smoothing and shaper_smoothing > max_smoothing and best_res:
-                return best_res
+        # Evaluate all the shaper frequencies (from highest to lowest) at once
+        test_freqs = test_freqs[::-1]
+        A, T = self._get_shapers(shaper_cfg, test_freqs, damping_ratio)
+        coeffs = self._get_smoothing_coeffs(A, T, scv)
+        smoothing = self._calc_smoothing(coeffs)
+        # Shapers with too much smoothing (after the first one) end the search
+        num_freqs = len(test_freqs)
+        if max_smoothing:
+            too_smooth = np.nonzero(smoothing[1:] > max_smoothing)[0]
+            if len(too_smooth):
+                num_freqs = too_smooth[0] + 1
+
+        # The input shaper can only reduce the amplitude of vibrations by
+        # SHAPER_VIBRATION_REDUCTION times, so all vibrations below that
+        # threshold can be igonred
+        vibr_threshold = psd.max() / shaper_defs.SHAPER_VIBRATION_REDUCTION
+        all_vibrations = np.maximum(psd - vibr_threshold, 0).sum()
+        shaper_vibrations = np.zeros(num_freqs)
+        shaper_vals = np.zeros(shape=(num_freqs, freq_bins.shape[0]))
+        # Limit the memory used by intermediate results
+        chunk = max(1, (1 << 20) // (freq_bins.shape[0] * A.shape[1]))
+        for i in range(0, num_freqs, chunk):
+            j = min(i + chunk, num_freqs)
             # Exact damping ratio of the printer is unknown, pessimizing
             # remaining vibrations over possible damping values
             for dr in test_damping_ratios:
-                vibrations, vals = self._estimate_remaining_vibrations(
-                        shaper, dr, freq_bins, psd)
-                shaper_vals = np.maximum(shaper_vals, vals)
-                if vibrations > shaper_vibrations:
-                    shaper_vibrations = vibrations
-            max_accel = self.find_shaper_max_accel(shaper, scv)
-            # The score trying to minimize vibrations, but also accounting
-            # the growth of smoothing. The formula itself does not have any
-            # special meaning, it simply shows good results on real user data
-            shaper_score = shaper_smoothing * (shaper_vibrations**1.5 +
-                                               shaper_vibrations * .2 + .01)
+                vals = self._estimate_shapers(A[i:j], T[i:j], dr, freq_bins)
+                shaper_vals[i:j] = np.maximum(shaper_vals[i:j], vals)
+                remaining_vibrations = np.maximum(
+                        vals * psd - vibr_threshold, 0).sum(axis=-1)
+                shaper_vibrations[i:j] = np.maximum(
+                        shaper_vibrations[i:j],
+                        remaining_vibrations / all_vibrations)
+        max_accel = self._calc_max_accel([c[:num_freqs] for c in coeffs])
+        # The score trying to minimize vibrations, but also accounting
+        # the growth of smoothing. The formula itself does not have any
+        # special meaning, it simply shows good results on real user data
+        smoothing = smoothing[:num_freqs]
+        shaper_score = smoothing * (shaper_vibrations**1.5 +
+                                    shaper_vibrations * .2 + .01)
+
+        best_res = None
+        results = []
+        for i in range(num_freqs):
             results.append(
                     CalibrationResult(
-                        name=shaper_cfg.name, freq=test_freq, vals=shaper_vals,
-                        vibrs=shaper_vibrations, smoothing=shaper_smoothing,
-                        score=shaper_score, max_accel=max_accel))
+                        name=shaper_cfg.name, freq=test_freqs[i],
+                        vals=shaper_vals[i], vibrs=shaper_vibrations[i],
+                        smoothing=smoothing[i], score=shaper_score[i],
+                        max_accel=max_accel[i]))
             if best_res is None or best_res.vibrs > results[-1].vibrs:
                 # The current frequency is better for the shaper.
                 best_res = results[-1]
+        if num_freqs < len(test_freqs):
+            return best_res
         # Try to find an 'optimal' shapper configuration: the one that is not
         # much worse than the 'best' one, but gives much less smoothing
         selected = best_res
@@ -291,32 +478,6 @@ class ShaperCalibrate:
                 selected = res
         return selected
 
-    def _bisect(self, func):
-        left = right = 1.
-        if not func(1e-9):
-            return 0.
-        while not func(left):
-            right = left
-            left *= .5
-        if right == left:
-            while func(right):
-                right *= 2.
-        while right - left > 1e-8:
-            middle = (left + right) * .5
-            if func(middle):
-                left = middle
-            else:
-                right = middle
-        return left
-
-    def find_shaper_max_accel(self, shaper, scv):
-        # Just some empirically chosen value which produces good projections
-        # for max_accel without much smoothing
-        TARGET_SMOOTHING = 0.12
-        max_accel = self._bisect(lambda test_accel: self._get_shaper_smoothing(
-            shaper, test_accel, scv) <= TARGET_SMOOTHING)
-        return max_accel
-
     def find_best_shaper(self, calibration_data, shapers=None,
                          damping_ratio=None, scv=None, shaper_freqs=None,
                          max_smoothing=None, test_damping_ratios=None,
@@ -324,12 +485,34 @@ class ShaperCalibrate:
         best_shaper = None
         all_shapers = []
         shapers = shapers or AUTOTUNE_SHAPERS
-        for shaper_cfg in shaper_defs.INPUT_SHAPERS:
-            if shaper_cfg.name not in shapers:
-                continue
-            shaper = self.background_process_exec(self.fit_shaper, (
-                shaper_cfg, calibration_data, shaper_freqs, damping_ratio,
-                scv, max_smoothing, test_damping_ratios, max_freq))
+        shaper_cfgs = [shaper_cfg for shaper_cfg in shaper_defs.INPUT_SHAPERS
+                       if shaper_cfg.name in shapers]
+        # Fit all the shapers in parallel
+        if self.worker_pool is not None:
+            # The workers map the psd from shared memory instead of
+            # receiving a copy of it with each job
+            pool = self.worker_pool
+            freq_bins = pool.share_array(calibration_data.freq_bins)
+            psd_sum = pool.share_array(calibration_data.psd_sum)
+            try:
+                fitted_shapers = pool.run_multi(
+                        _pool_fit_shaper,
+                        [(shaper_cfg, FitData(freq_bins, psd_sum),
+                          shaper_freqs, damping_ratio, scv, max_smoothing,
+                          test_damping_ratios, max_freq)
+                         for shaper_cfg in shaper_cfgs],
+                        "Wait for calculations..")
+            finally:
+                freq_bins.release()
+                psd_sum.release()
+        else:
+            fitted_shapers = self.background_process_exec_multi(
+                    self.fit_shaper,
+                    [(shaper_cfg, calibration_data, shaper_freqs,
+                      damping_ratio, scv, max_smoothing,
+                      test_damping_ratios, max_freq)
+                     for shaper_cfg in shaper_cfgs])
+        for shaper in fitted_shapers:
             if logger is not None:
                 logger("Fitted shaper '%s' frequency = %.1f Hz "
                        "(vibrations = %.1f%%, smoothing ~= %.3f)" % (
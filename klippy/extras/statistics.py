@@ -8,9 +8,14 @@ import os, time, logging
 class PrinterSysStats:
     def __init__(self, config):
         printer = config.get_printer()
+        self.reactor = printer.get_reactor()
         self.last_process_time = self.total_process_time = 0.
         self.last_load_avg = 0.
         self.last_mem_avail = 0
+        # Reactor activity
+        self.last_stats_time = 0.
+        self.last_timer_callbacks = self.last_greenlet_switches = 0
+        self.timer_rate = self.switch_rate = self.max_callback_time = 0.
         self.mem_file = None
         try:
             self.mem_file = open("/proc/meminfo", "r")
@@ -31,6 +36,18 @@ class PrinterSysStats:
         self.last_load_avg = os.getloadavg()[0]
         msg = "sysload=%.2f cputime=%.3f" % (self.last_load_avg,
                                              self.total_process_time)
+        # Get reactor timer and greenlet usage
+        callbacks, switches, max_cb_time = self.reactor.get_stats()
+        tdiff = eventtime - self.last_stats_time
+        if self.last_stats_time and tdiff > 0.:
+            self.timer_rate = (callbacks - self.last_timer_callbacks) / tdiff
+            self.switch_rate = (switches - self.last_greenlet_switches) / tdiff
+        self.last_stats_time = eventtime
+        self.last_timer_callbacks = callbacks
+        self.last_greenlet_switches = switches
+        self.max_callback_time = max_cb_time
+        msg = "%s timer_rate=%.1f switch_rate=%.1f max_callback=%.6f" % (
+            msg, self.timer_rate, self.switch_rate, self.max_callback_time)
         # Get available system memory
         if self.mem_file is not None:
             try:
@@ -47,7 +64,10 @@ class PrinterSysStats:
     def get_status(self, eventtime):
         return {'sysload': self.last_load_avg,
                 'cputime': self.total_process_time,
-                'memavail': self.last_mem_avail}
+                'memavail': self.last_mem_avail,
+                'timer_rate': self.timer_rate,
+                'switch_rate': self.switch_rate,
+                'max_callback_time': self.max_callback_time}
 
 class PrinterStats:
     def __init__(self, config):
@@ -85,6 +85,51 @@ class FieldHelper:
 # Periodic error checking
 ######################################################################
 
+# Run the periodic checks of all drivers from a single timer.  Each
+# check is started in its own reactor callback so that the register
+# queries of all drivers are in flight together (one round trip per
+# mcu) instead of being issued from independent timers.
+class PrinterTMCChecks:
+    def __init__(self, printer):
+        self.reactor = printer.get_reactor()
+        self.checks = []
+        self.pending = set()
+        self.check_timer = None
+    def add_check(self, check):
+        if check not in self.checks:
+            self.checks.append(check)
+        if self.check_timer is None:
+            curtime = self.reactor.monotonic()
+            self.check_timer = self.reactor.register_timer(
+                self._do_checks, curtime + 1.)
+    def remove_check(self, check):
+        if check in self.checks:
+            self.checks.remove(check)
+        if not self.checks and self.check_timer is not None:
+            self.reactor.unregister_timer(self.check_timer)
+            self.check_timer = None
+    def _run_check(self, check, eventtime):
+        try:
+            check.do_periodic_check(eventtime)
+        finally:
+            self.pending.discard(check)
+    def _do_checks(self, eventtime):
+        for check in self.checks:
+            if check in self.pending:
+                # Previous query of this driver still outstanding
+                continue
+            self.pending.add(check)
+            self.reactor.register_callback(
+                (lambda e, c=check: self._run_check(c, e)))
+        return eventtime + 1.
+
+def lookup_tmc_checks(printer):
+    pchecks = printer.lookup_object('tmc_checks', None)
+    if pchecks is None:
+        pchecks = PrinterTMCChecks(printer)
+        printer.add_object('tmc_checks', pchecks)
+    return pchecks
+
 class TMCErrorCheck:
     def __init__(self, config, mcu_tmc):
         self.printer = config.get_printer()
@@ -92,7 +137,8 @@ class TMCErrorCheck:
         self.stepper_name = ' '.join(name_parts[1:])
         self.mcu_tmc = mcu_tmc
         self.fields = mcu_tmc.get_fields()
-        self.check_timer = None
+        self.tmc_checks = lookup_tmc_checks(self.printer)
+        self.checks_active = False
         self.last_drv_status = self.last_drv_fields = None
         # Setup for GSTAT query
         reg_name = self.fields.lookup_register("drv_err")
@@ -128,21 +174,36 @@ class TMCErrorCheck:
         if self.adc_temp_reg is not None:
             pheaters = self.printer.load_object(config, 'heaters')
             pheaters.register_monitor(config)
-    def _query_register(self, reg_info, try_clear=False):
+    def _read_registers(self):
+        # Read all the checked registers with a single batch request
+        reg_names = [self.drv_status_reg_info[1]]
+        if self.gstat_reg_info is not None:
+            reg_names.append(self.gstat_reg_info[1])
+        if self.adc_temp_reg is not None:
+            reg_names.append(self.adc_temp_reg)
+        try:
+            vals = self.mcu_tmc.get_registers(reg_names)
+        except self.printer.command_error:
+            # Registers will be queried (and retried) individually
+            return {}
+        return dict(zip(reg_names, vals))
+    def _query_register(self, reg_info, try_clear=False, val=None):
         last_value, reg_name, mask, err_mask, cs_actual_mask = reg_info
         cleared_flags = 0
         count = 0
         while 1:
-            try:
-                val = self.mcu_tmc.get_register(reg_name)
-            except self.printer.command_error as e:
-                count += 1
-                if count < 3 and str(e).startswith("Unable to read tmc uart"):
-                    # Allow more retries on a TMC UART read error
-                    reactor = self.printer.get_reactor()
-                    reactor.pause(reactor.monotonic() + 0.050)
-                    continue
-                raise
+            if val is None:
+                try:
+                    val = self.mcu_tmc.get_register(reg_name)
+                except self.printer.command_error as e:
+                    count += 1
+                    if (count < 3
+                        and str(e).startswith("Unable to read tmc uart")):
+                        # Allow more retries on a TMC UART read error
+                        reactor = self.printer.get_reactor()
+                        reactor.pause(reactor.monotonic() + 0.050)
+                        continue
+                    raise
             if val & mask != last_value & mask:
                 fmt = self.fields.pretty_format(reg_name, val)
                 logging.info("TMC '%s' reports %s", self.stepper_name, fmt)
@@ -151,7 +212,7 @@ class TMCErrorCheck:
                 if not cs_actual_mask or val & cs_actual_mask:
                     break
                 irun = self.fields.get_field(self.irun_field)
-                if self.check_timer is None or irun < 4:
+                if not self.checks_active or irun < 4:
                     break
                 if (self.irun_field == "irun"
                     and not self.fields.get_field("ihold")):
@@ -166,49 +227,56 @@ class TMCErrorCheck:
                 try_clear = False
                 cleared_flags |= val & err_mask
                 self.mcu_tmc.set_register(reg_name, val & err_mask)
+            val = None
         return cleared_flags
-    def _query_temperature(self):
+    def _query_temperature(self, val=None):
+        if val is not None:
+            self.adc_temp = val
+            return
         try:
             self.adc_temp = self.mcu_tmc.get_register(self.adc_temp_reg)
         except self.printer.command_error as e:
             # Ignore comms error for temperature
             self.adc_temp = None
             return
-    def _do_periodic_check(self, eventtime):
+    def do_periodic_check(self, eventtime):
+        if not self.checks_active:
+            return
         try:
-            self._query_register(self.drv_status_reg_info)
+            vals = self._read_registers()
+            reg_info = self.drv_status_reg_info
+            self._query_register(reg_info, val=vals.get(reg_info[1]))
             if self.gstat_reg_info is not None:
-                self._query_register(self.gstat_reg_info)
+                reg_info = self.gstat_reg_info
+                self._query_register(reg_info, val=vals.get(reg_info[1]))
             if self.adc_temp_reg is not None:
-                self._query_temperature()
+                self._query_temperature(vals.get(self.adc_temp_reg))
         except self.printer.command_error as e:
+            self.stop_checks()
             self.printer.invoke_shutdown(str(e))
-            return self.printer.get_reactor().NEVER
-        return eventtime + 1.
     def stop_checks(self):
-        if self.check_timer is None:
-            return
-        self.printer.get_reactor().unregister_timer(self.check_timer)
-        self.check_timer = None
+        self.checks_active = False
+        self.tmc_checks.remove_check(self)
     def start_checks(self):
-        if self.check_timer is not None:
+        if self.checks_active:
             self.stop_checks()
         cleared_flags = 0
-        self._query_register(self.drv_status_reg_info)
+        vals = self._read_registers()
+        reg_info = self.drv_status_reg_info
+        self._query_register(reg_info, val=vals.get(reg_info[1]))
         if self.gstat_reg_info is not None:
-            cleared_flags = self._query_register(self.gstat_reg_info,
-                                                 try_clear=self.clear_gstat)
-        reactor = self.printer.get_reactor()
-        curtime = reactor.monotonic()
-        self.check_timer = reactor.register_timer(self._do_periodic_check,
-                                                  curtime + 1.)
+            reg_info = self.gstat_reg_info
+            cleared_flags = self._query_register(
+                reg_info, try_clear=self.clear_gstat, val=vals.get(reg_info[1]))
+        self.checks_active = True
+        self.tmc_checks.add_check(self)
         if cleared_flags:
             reset_mask = self.fields.all_fields["GSTAT"]["reset"]
             if cleared_flags & reset_mask:
                 return True
         return False
     def get_status(self, eventtime=None):
-        if self.check_timer is None:
+        if not self.checks_active:
             return {'drv_status': None, 'temperature': None}
         temp = None
         if self.adc_temp is not None:
@@ -262,9 +330,8 @@ class TMCCommandHelper:
                                    desc=self.cmd_SET_TMC_CURRENT_help)
     def _init_registers(self, print_time=None):
         # Send registers
-        for reg_name in list(self.fields.registers.keys()):
-            val = self.fields.registers[reg_name] # Val may change during loop
-            self.mcu_tmc.set_register(reg_name, val, print_time)
+        reg_vals = list(self.fields.registers.items())
+        self.mcu_tmc.set_registers(reg_vals, print_time)
     cmd_INIT_TMC_help = "Initialize TMC stepper driver registers"
     def cmd_INIT_TMC(self, gcmd):
         logging.info("INIT_TMC %s", self.name)
@@ -450,8 +517,8 @@ class TMCCommandHelper:
                 if reg_name not in self.read_registers:
                     gcmd.respond_info(self.fields.pretty_format(reg_name, val))
             gcmd.respond_info("========== Queried registers ==========")
-            for reg_name in self.read_registers:
-                val = self.mcu_tmc.get_register(reg_name)
+            vals = self.mcu_tmc.get_registers(self.read_registers)
+            for reg_name, val in zip(self.read_registers, vals):
                 if self.read_translate is not None:
                     reg_name, val = self.read_translate(reg_name, val)
                 gcmd.respond_info(self.fields.pretty_format(reg_name, val))
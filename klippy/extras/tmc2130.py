@@ -223,6 +223,40 @@ class MCU_TMC_SPI_chain:
         pr = pr[(self.chain_len - chain_pos) * 5 :
                 (self.chain_len - chain_pos + 1) * 5]
         return (pr[1] << 24) | (pr[2] << 16) | (pr[3] << 8) | pr[4]
+    def _transfer_multi(self, cmds, chain_pos, minclock=0):
+        # Pipeline the transfers - the response to each message
+        # contains the result of the previous message
+        dummy_read = self._build_cmd([0x00, 0x00, 0x00, 0x00, 0x00], chain_pos)
+        responses = self.spi.spi_transfer_multi(cmds[1:] + [dummy_read],
+                                                cmds[0], minclock=minclock)
+        res = []
+        for params in responses:
+            pr = bytearray(params['response'])
+            pr = pr[(self.chain_len - chain_pos) * 5 :
+                    (self.chain_len - chain_pos + 1) * 5]
+            res.append((pr[1] << 24) | (pr[2] << 16) | (pr[3] << 8) | pr[4])
+        return res
+    def reg_read_multi(self, regs, chain_pos):
+        cmds = [self._build_cmd([reg, 0x00, 0x00, 0x00, 0x00], chain_pos)
+                for reg in regs]
+        if self.printer.get_start_args().get('debugoutput') is not None:
+            for cmd in cmds:
+                self.spi.spi_send(cmd)
+            return [0] * len(regs)
+        return self._transfer_multi(cmds, chain_pos)
+    def reg_write_multi(self, reg_vals, chain_pos, print_time=None):
+        minclock = 0
+        if print_time is not None:
+            minclock = self.spi.get_mcu().print_time_to_clock(print_time)
+        cmds = [self._build_cmd([(reg | 0x80) & 0xff, (val >> 24) & 0xff,
+                                 (val >> 16) & 0xff, (val >> 8) & 0xff,
+                                 val & 0xff], chain_pos)
+                for reg, val in reg_vals]
+        if self.printer.get_start_args().get('debugoutput') is not None:
+            for cmd in cmds:
+                self.spi.spi_send(cmd, minclock)
+            return [val for reg, val in reg_vals]
+        return self._transfer_multi(cmds, chain_pos, minclock)
 
 # Helper to setup an spi daisy chain bus from settings in a config section
 def lookup_tmc_spi_chain(config):
@@ -272,6 +306,25 @@ class MCU_TMC_SPI:
                     return
         raise self.printer.command_error(
             "Unable to write tmc spi '%s' register %s" % (self.name, reg_name))
+    def get_registers(self, reg_names):
+        regs = [self.name_to_reg[reg_name] for reg_name in reg_names]
+        with self.mutex:
+            return self.tmc_spi.reg_read_multi(regs, self.chain_pos)
+    def set_registers(self, reg_vals, print_time=None):
+        pending = [(reg_name, self.name_to_reg[reg_name], val)
+                   for reg_name, val in reg_vals]
+        with self.mutex:
+            for retry in range(5):
+                res = self.tmc_spi.reg_write_multi(
+                    [(reg, val) for reg_name, reg, val in pending],
+                    self.chain_pos, print_time)
+                # Only resend the registers that did not verify
+                pending = [p for p, v in zip(pending, res) if v != p[2]]
+                if not pending:
+                    return
+        raise self.printer.command_error(
+            "Unable to write tmc spi '%s' register %s"
+            % (self.name, pending[0][0]))
     def get_tmc_frequency(self):
         return self.tmc_frequency
 
@@ -221,6 +221,15 @@ class MCU_TMC2660_SPI:
         msg = [((val >> 16) | reg) & 0xff, (val >> 8) & 0xff, val & 0xff]
         with self.mutex:
             self.spi.spi_send(msg, minclock)
+    def get_registers(self, reg_names):
+        # The READRSP registers are selected via DRVCONF, so they are
+        # read one at a time
+        return [self.get_register(reg_name) for reg_name in reg_names]
+    def set_registers(self, reg_vals, print_time=None):
+        # Writes do not wait for a response, so they are already queued
+        # to the mcu without any round trips
+        for reg_name, val in reg_vals:
+            self.set_register(reg_name, val, print_time)
     def get_tmc_frequency(self):
         return None
 
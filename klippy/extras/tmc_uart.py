@@ -72,6 +72,8 @@ def lookup_tmc_uart_mutex(mcu):
 
 TMC_BAUD_RATE = 40000
 TMC_BAUD_RATE_AVR = 9000
+TMCUART_MAX_TRANSFERS = 4
+TMCUART_MAX_DATA = 40
 
 # Code for sending messages on a TMC uart
 class MCU_TMC_uart_bitbang:
@@ -88,7 +90,7 @@ class MCU_TMC_uart_bitbang:
             self.analog_mux = MCU_analog_mux(self.mcu, self.cmd_queue,
                                              select_pins_desc)
         self.instances = {}
-        self.tmcuart_send_cmd = None
+        self.tmcuart_send_cmd = self.tmcuart_send_multi_cmd = None
         self.mcu.register_config_callback(self.build_config)
     def build_config(self):
         baud = TMC_BAUD_RATE
@@ -103,6 +105,11 @@ class MCU_TMC_uart_bitbang:
             "tmcuart_send oid=%c write=%*s read=%c",
             "tmcuart_response oid=%c read=%*s", oid=self.oid,
             cq=self.cmd_queue, is_async=True)
+        multi_fmt = "tmcuart_send_multi oid=%c lens=%*s write=%*s"
+        if self.mcu.try_lookup_command(multi_fmt) is not None:
+            self.tmcuart_send_multi_cmd = self.mcu.lookup_query_command(
+                multi_fmt, "tmcuart_response oid=%c read=%*s", oid=self.oid,
+                cq=self.cmd_queue, is_async=True)
     def register_instance(self, rx_pin_params, tx_pin_params,
                           select_pins_desc, addr):
         if (rx_pin_params['pin'] != self.rx_pin
@@ -184,6 +191,61 @@ class MCU_TMC_uart_bitbang:
             self.analog_mux.activate(instance_id)
         msg = self._encode_write(0xf5, addr, reg | 0x80, val)
         self.tmcuart_send_cmd.send([self.oid, msg, 0], minclock=minclock)
+    def reg_transfer(self, instance_id, addr, ops, print_time=None):
+        # Perform a sequence of register reads (val is None) and
+        # writes using as few mcu requests as possible.  Returns the
+        # value of each read (or None on a read error or a write).
+        if self.tmcuart_send_multi_cmd is None:
+            res = []
+            for reg, val in ops:
+                if val is None:
+                    res.append(self.reg_read(instance_id, addr, reg))
+                else:
+                    self.reg_write(instance_id, addr, reg, val, print_time)
+                    res.append(None)
+            return res
+        minclock = 0
+        if print_time is not None:
+            minclock = self.mcu.print_time_to_clock(print_time)
+        if self.analog_mux is not None:
+            self.analog_mux.activate(instance_id)
+        msgs = []
+        for reg, val in ops:
+            if val is None:
+                msgs.append((self._encode_read(0xf5, addr, reg), 10))
+            else:
+                msgs.append((self._encode_write(0xf5, addr, reg | 0x80, val),
+                             0))
+        # Group the transfers into requests that fit in the mcu buffers
+        reads = []
+        while msgs:
+            count = write_len = read_len = 0
+            for msg, rlen in msgs[:TMCUART_MAX_TRANSFERS]:
+                if (write_len + len(msg) > TMCUART_MAX_DATA
+                    or read_len + rlen > TMCUART_MAX_DATA):
+                    break
+                count += 1
+                write_len += len(msg)
+                read_len += rlen
+            chunk, msgs = msgs[:count], msgs[count:]
+            lens = bytearray([(len(msg) << 4) | rlen for msg, rlen in chunk])
+            write = bytearray().join([msg for msg, rlen in chunk])
+            params = self.tmcuart_send_multi_cmd.send(
+                [self.oid, lens, write], minclock=minclock)
+            # A read timeout is reported as an empty (single transfer) or
+            # zero filled message - neither is accepted by _decode_read()
+            data = bytearray(params['read'])
+            pos = 0
+            for msg, rlen in chunk:
+                reads.append(data[pos:pos+rlen])
+                pos += rlen
+        res = []
+        for (reg, val), data in zip(ops, reads):
+            if val is None:
+                res.append(self._decode_read(reg, data))
+            else:
+                res.append(None)
+        return res
 
 # Lookup a (possibly shared) tmc uart
 def lookup_tmc_uart_bitbang(config, max_addr):
@@ -235,6 +297,15 @@ class MCU_TMC_uart:
     def get_register(self, reg_name):
         with self.mutex:
             return self._do_get_register(reg_name)
+    def get_registers(self, reg_names):
+        if self.printer.get_start_args().get('debugoutput') is not None:
+            return [0] * len(reg_names)
+        ops = [(self.name_to_reg[reg_name], None) for reg_name in reg_names]
+        with self.mutex:
+            vals = self.mcu_uart.reg_transfer(self.instance_id, self.addr, ops)
+            # Retry any failed reads individually
+            return [self._do_get_register(reg_name) if val is None else val
+                    for reg_name, val in zip(reg_names, vals)]
     def set_register(self, reg_name, val, print_time=None):
         reg = self.name_to_reg[reg_name]
         if self.printer.get_start_args().get('debugoutput') is not None:
@@ -251,5 +322,27 @@ class MCU_TMC_uart:
                     return
         raise self.printer.command_error(
             "Unable to write tmc uart '%s' register %s" % (self.name, reg_name))
+    def set_registers(self, reg_vals, print_time=None):
+        if self.printer.get_start_args().get('debugoutput') is not None:
+            return
+        ifcnt_reg = self.name_to_reg["IFCNT"]
+        ops = [(self.name_to_reg[reg_name], val) for reg_name, val in reg_vals]
+        with self.mutex:
+            ifcnt = self.ifcnt
+            if ifcnt is None:
+                ops.insert(0, (ifcnt_reg, None))
+            ops.append((ifcnt_reg, None))
+            res = self.mcu_uart.reg_transfer(self.instance_id, self.addr, ops,
+                                             print_time)
+            if ifcnt is None:
+                ifcnt = res[0]
+            self.ifcnt = res[-1]
+            if (ifcnt is not None and self.ifcnt is not None
+                and self.ifcnt == (ifcnt + len(reg_vals)) & 0xff):
+                return
+            self.ifcnt = None
+        # Unable to verify all writes - fall back to individual writes
+        for reg_name, val in reg_vals:
+            self.set_register(reg_name, val, print_time)
     def get_tmc_frequency(self):
         return self.tmc_frequency
@@ -0,0 +1,233 @@
+# Continuous background vibration monitoring
+#
+# Copyright (C) 2026  agent <agent@local>
+#
+# This file may be distributed under the terms of the GNU GPLv3 license.
+import logging
+from . import bulk_sensor, shaper_calibrate
+
+# This module keeps an accelerometer streaming during normal printer
+# operation.  The incoming samples are converted to numpy arrays as
+# each batch arrives and only the most recent 'window' seconds are
+# retained.  Periodically the frequency response of that window is
+# calculated and summarized into per-axis rms vibrations (for each
+# configured frequency band) and the dominant vibration frequencies.
+# The analysis interval is stretched as needed to keep the host
+# processing time within the configured 'cpu_budget'.
+
+AXES = ['x', 'y', 'z']
+
+class VibrationMonitor:
+    def __init__(self, config):
+        self.printer = config.get_printer()
+        self.reactor = self.printer.get_reactor()
+        self.chip_name = config.get('accel_chip').strip()
+        self.window = config.getfloat('window', 2., minval=1.)
+        self.update_interval = config.getfloat('update_interval', 5.,
+                                               minval=1.)
+        self.cpu_budget = config.getfloat('cpu_budget', 0.02, above=0.,
+                                          maxval=1.)
+        self.bands = config.getlists(
+            'bands', ((5., 50.), (50., 100.), (100., 200.)),
+            seps=('-', ','), count=2, parser=float)
+        for low, high in self.bands:
+            if low < 0. or high <= low:
+                raise config.error("Invalid band %.3f-%.3f in section '%s'"
+                                   % (low, high, config.get_name()))
+        self.autostart = config.getboolean('autostart', False)
+        self.chip = None
+        self.helper = None
+        # Sample ingest state
+        self.is_enabled = False
+        self.session = 0
+        self.chunks = []
+        self.sample_count = 0
+        self.errors = self.overflows = 0
+        self.busy_time = 0.
+        self.busy_start_time = 0.
+        # Analysis state
+        self.analysis_timer = self.reactor.register_timer(self._analyze)
+        self.clients = []
+        self.status = self._empty_status()
+        # Register handlers
+        self.printer.register_event_handler("klippy:connect",
+                                            self._handle_connect)
+        self.printer.register_event_handler("klippy:ready", self._handle_ready)
+        self.printer.register_event_handler("klippy:shutdown",
+                                            self._handle_shutdown)
+        gcode = self.printer.lookup_object('gcode')
+        gcode.register_command("VIBRATION_MONITOR", self.cmd_VIBRATION_MONITOR,
+                               desc=self.cmd_VIBRATION_MONITOR_help)
+        wh = self.printer.lookup_object('webhooks')
+        wh.register_endpoint("vibration_monitor/subscribe",
+                             self._handle_subscribe)
+    def _empty_status(self):
+        return {'enabled': self.is_enabled, 'last_update': 0.,
+                'sample_rate': 0., 'samples': 0, 'errors': 0, 'overflows': 0,
+                'cpu_usage': 0., 'rms': {a: 0. for a in AXES},
+                'peak_freq': {a: 0. for a in AXES + ['all']},
+                'bands': {"%g-%g" % b: {a: 0. for a in AXES}
+                          for b in self.bands}}
+    def _handle_connect(self):
+        self.chip = self.printer.lookup_object(self.chip_name, None)
+        if self.chip is None or not hasattr(self.chip, 'batch_bulk'):
+            raise self.printer.config_error(
+                "Unknown accelerometer '%s' in [vibration_monitor]"
+                % (self.chip_name,))
+    def _handle_ready(self):
+        if self.autostart:
+            self.reactor.register_callback(self._autostart)
+    def _autostart(self, eventtime):
+        try:
+            self.start()
+        except self.printer.command_error as e:
+            logging.warning("Unable to start vibration monitor: %s", str(e))
+    def _handle_shutdown(self):
+        self.stop()
+    # Start and stop monitoring
+    def start(self):
+        if self.is_enabled:
+            return
+        if self.helper is None:
+            self.helper = shaper_calibrate.ShaperCalibrate(self.printer)
+        self.is_enabled = True
+        self.chunks = []
+        self.sample_count = self.errors = self.overflows = 0
+        self.busy_time = 0.
+        self.busy_start_time = self.reactor.monotonic()
+        self.status = self._empty_status()
+        # A client left over from an earlier start() (and not yet
+        # unregistered) ignores all further batches
+        self.session += 1
+        session = self.session
+        def handle_batch(msg):
+            if not self.is_enabled or session != self.session:
+                return False
+            return self._handle_batch(msg)
+        try:
+            self.chip.batch_bulk.add_client(handle_batch)
+        except self.printer.command_error:
+            self.is_enabled = False
+            self.status['enabled'] = False
+            raise
+        self.reactor.update_timer(self.analysis_timer,
+                                  self.busy_start_time + self.update_interval)
+        logging.info("Vibration monitor started on '%s'", self.chip_name)
+    def stop(self):
+        if not self.is_enabled:
+            return
+        # The chip client is unregistered on the next batch
+        self.is_enabled = False
+        self.status = dict(self.status)
+        self.status['enabled'] = False
+        self.chunks = []
+        self.reactor.update_timer(self.analysis_timer, self.reactor.NEVER)
+        logging.info("Vibration monitor stopped on '%s'", self.chip_name)
+    # Sample ingest
+    def _handle_batch(self, msg):
+        np = self.helper.numpy
+        start_time = self.reactor.monotonic()
+        self.errors = msg.get('errors', self.errors)
+        self.overflows = msg.get('overflows', self.overflows)
+        data = msg['data']
+        if data:
+            self.chunks.append(np.array(data, dtype=np.float64))
+            self.sample_count += len(data)
+            # Discard samples that are older than the analysis window
+            min_time = self.chunks[-1][-1, 0] - self.window
+            while len(self.chunks) > 1 and self.chunks[1][0, 0] <= min_time:
+                del self.chunks[0]
+        self.busy_time += self.reactor.monotonic() - start_time
+        return True
+    # Periodic analysis
+    def _calc_status(self, data):
+        np = self.helper.numpy
+        cd = self.helper.calc_freq_response(data)
+        if cd is None:
+            return None
+        freqs = cd.freq_bins
+        df = freqs[1] - freqs[0]
+        psds = {'x': cd.psd_x, 'y': cd.psd_y, 'z': cd.psd_z,
+                'all': cd.psd_sum}
+        min_freq = min([low for low, high in self.bands])
+        max_freq = max([high for low, high in self.bands])
+        in_range = (freqs >= min_freq) & (freqs <= max_freq)
+        status = {'rms': {}, 'peak_freq': {}, 'bands': {}}
+        for axis, psd in psds.items():
+            if not in_range.any():
+                status['peak_freq'][axis] = 0.
+                continue
+            idx = np.argmax(np.where(in_range, psd, -1.))
+            status['peak_freq'][axis] = round(float(freqs[idx]), 2)
+        for axis in AXES:
+            psd = psds[axis]
+            status['rms'][axis] = round(
+                float(np.sqrt(psd[in_range].sum() * df)), 3)
+        for low, high in self.bands:
+            mask = (freqs >= low) & (freqs < high)
+            status['bands']["%g-%g" % (low, high)] = {
+                axis: round(float(np.sqrt(psds[axis][mask].sum() * df)), 3)
+                for axis in AXES}
+        duration = data[-1, 0] - data[0, 0]
+        status['sample_rate'] = round(float(data.shape[0] / duration), 1)
+        return status
+    def _analyze(self, eventtime):
+        np = self.helper.numpy
+        start_time = self.reactor.monotonic()
+        status = None
+        if self.chunks:
+            data = np.concatenate(self.chunks)
+            data = data[data[:, 0] >= data[-1, 0] - self.window]
+            status = self._calc_status(data)
+        analysis_time = self.reactor.monotonic() - start_time
+        self.busy_time += analysis_time
+        elapsed = max(eventtime - self.busy_start_time, 0.001)
+        if status is not None:
+            status['last_update'] = eventtime
+            self.status = dict(self.status, **status)
+        self.status = dict(self.status, enabled=self.is_enabled,
+                           samples=self.sample_count, errors=self.errors,
+                           overflows=self.overflows,
+                           cpu_usage=round(self.busy_time / elapsed, 4))
+        self.busy_time = 0.
+        self.busy_start_time = eventtime
+        if status is not None:
+            self._send_clients()
+        # Delay the next analysis if it would exceed the cpu budget
+        return eventtime + max(self.update_interval,
+                               analysis_time / self.cpu_budget)
+    # Webhooks subscription
+    def _send_clients(self):
+        for client in list(self.clients):
+            if not client.handle_batch(self.status):
+                self.clients.remove(client)
+    def _handle_subscribe(self, web_request):
+        self.clients.append(bulk_sensor.BatchWebhooksClient(web_request))
+        web_request.send(self.status)
+    def get_status(self, eventtime):
+        return self.status
+    cmd_VIBRATION_MONITOR_help = (
+        "Start, stop, or report background vibration monitoring")
+    def cmd_VIBRATION_MONITOR(self, gcmd):
+        enable = gcmd.get_int('ENABLE', None, minval=0, maxval=1)
+        if enable:
+            self.start()
+        elif enable is not None:
+            self.stop()
+        st = self.status
+        msg = ["vibration monitor %s: samples=%d cpu_usage=%.2f%%"
+               % (["disabled", "enabled"][self.is_enabled], st['samples'],
+                  st['cpu_usage'] * 100.)]
+        if st['last_update']:
+            msg.append("rms: " + " ".join(["%s=%.3f" % (a, st['rms'][a])
+                                           for a in AXES]))
+            msg.append("peak_freq: " + " ".join(
+                ["%s=%.1f" % (a, st['peak_freq'][a]) for a in AXES]))
+            for low, high in self.bands:
+                name = "%g-%g" % (low, high)
+                msg.append("band %sHz rms: %s" % (name, " ".join(
+                    ["%s=%.3f" % (a, st['bands'][name][a]) for a in AXES])))
+        gcmd.respond_info("\n".join(msg))
+
+def load_config(config):
+    return VibrationMonitor(config)
@@ -0,0 +1,214 @@
+# Pool of background processes for cpu intensive calculations
+#
+# Copyright (C) 2026  agent <agent@local>
+#
+# This file may be distributed under the terms of the GNU GPLv3 license.
+import os, logging, mmap, tempfile, traceback, collections, multiprocessing
+import queuelogger
+
+WAIT_REPORT_TIME = 5.
+
+######################################################################
+# Shared memory arrays
+######################################################################
+
+SHM_DIR = '/dev/shm' if os.path.isdir('/dev/shm') else tempfile.gettempdir()
+
+# Return the cpus the calling thread may run on
+def get_available_cpus():
+    if hasattr(os, 'sched_getaffinity'):
+        return set(os.sched_getaffinity(0))
+    return set(range(multiprocessing.cpu_count()))
+
+def _attach_shared_array(path, dtype, shape):
+    import numpy
+    dtype = numpy.dtype(dtype)
+    if not os.path.getsize(path):
+        return numpy.zeros(shape, dtype=dtype)
+    with open(path, 'rb') as f:
+        mm = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+    return numpy.frombuffer(mm, dtype=dtype).reshape(shape)
+
+# A numpy array stored in shared memory.  The array is written once by
+# the main process and each job that references it maps it (read-only)
+# instead of receiving a pickled copy of the data.
+class SharedArray:
+    def __init__(self, array):
+        self.dtype = array.dtype.str
+        self.shape = array.shape
+        fd, self.path = tempfile.mkstemp(prefix="klippy-shared-", dir=SHM_DIR)
+        with os.fdopen(fd, 'wb') as f:
+            f.write(array.tobytes())
+    def __reduce__(self):
+        return (_attach_shared_array, (self.path, self.dtype, self.shape))
+    def release(self):
+        if self.path is not None:
+            os.unlink(self.path)
+            self.path = None
+
+
+######################################################################
+# Worker processes
+######################################################################
+
+def _worker_main(conn, cpus, nice):
+    queuelogger.clear_bg_logging()
+    try:
+        # Don't inherit a real-time policy from the main klippy thread
+        if hasattr(os, 'sched_setscheduler'):
+            os.sched_setscheduler(0, os.SCHED_OTHER, os.sched_param(0))
+            if cpus:
+                os.sched_setaffinity(0, cpus)
+        os.nice(nice)
+    except:
+        logging.exception("Unable to set worker process scheduling")
+    while 1:
+        try:
+            func, args = conn.recv()
+        except EOFError:
+            break
+        try:
+            res = (False, func(*args))
+        except:
+            res = (True, traceback.format_exc())
+        try:
+            conn.send(res)
+        except:
+            conn.send((True, traceback.format_exc()))
+
+class WorkerProcess:
+    def __init__(self, pool, cpus, nice):
+        self.pool = pool
+        self.reactor = pool.reactor
+        self.conn, child_conn = multiprocessing.Pipe()
+        self.proc = multiprocessing.Process(target=_worker_main,
+                                            args=(child_conn, cpus, nice))
+        self.proc.daemon = True
+        self.proc.start()
+        child_conn.close()
+        self.fd_handle = self.reactor.register_fd(self.conn.fileno(),
+                                                  self._handle_result)
+        self.completion = None
+    def is_busy(self):
+        return self.completion is not None
+    def start_job(self, func, args, completion):
+        try:
+            self.conn.send((func, args))
+        except:
+            completion.complete((True, traceback.format_exc()))
+            return
+        self.completion = completion
+    def _handle_result(self, eventtime):
+        try:
+            res = self.conn.recv()
+        except (EOFError, OSError):
+            res = (True, "Worker process exited")
+            self.close()
+        if res[0]:
+            logging.warning("worker_pool job failed: %s", res[1])
+        completion = self.completion
+        self.completion = None
+        if completion is not None:
+            completion.complete(res)
+        self.pool.note_worker_idle(self)
+    def close(self):
+        if self.fd_handle is None:
+            return
+        self.reactor.unregister_fd(self.fd_handle)
+        self.fd_handle = None
+        self.conn.close()
+        self.proc.terminate()
+        self.proc.join(.100)
+
+
+######################################################################
+# Pool interface
+######################################################################
+
+class WorkerPool:
+    def __init__(self, config):
+        self.printer = config.get_printer()
+        self.reactor = self.printer.get_reactor()
+        self.cpus = config.getintlist('cpus', None)
+        num_cpus = multiprocessing.cpu_count()
+        if self.cpus is not None and (
+                not self.cpus or [c for c in self.cpus
+                                  if c < 0 or c >= num_cpus]):
+            raise config.error("Invalid cpus list in worker_pool")
+        self.max_workers = config.getint('max_workers', None, minval=1)
+        self.nice = config.getint('nice', 10, minval=0, maxval=19)
+        # Worker processes are started on first use and then reused
+        self.workers = []
+        self.pending = collections.deque()
+        self.printer.register_event_handler("klippy:disconnect",
+                                            self._disconnect)
+    def _disconnect(self):
+        for w in self.workers:
+            w.close()
+        self.workers = []
+    def _get_cpus(self):
+        if self.cpus is None:
+            # Default to the cpus not reserved for the klippy threads
+            all_cpus = get_available_cpus()
+            reserved = set()
+            host_sched = self.printer.lookup_object('host_scheduling', None)
+            if host_sched is not None:
+                # The main thread affinity may already be restricted
+                all_cpus = host_sched.get_all_cpus()
+                reserved = host_sched.get_reserved_cpus()
+            self.cpus = sorted(all_cpus - reserved) or sorted(all_cpus)
+        return self.cpus
+    def get_max_workers(self):
+        if self.max_workers is None:
+            self.max_workers = len(self._get_cpus())
+        return self.max_workers
+    def note_worker_idle(self, worker):
+        if worker.fd_handle is None:
+            self.workers.remove(worker)
+        self._dispatch()
+    def _dispatch(self):
+        while self.pending:
+            idle = [w for w in self.workers if not w.is_busy()]
+            if idle:
+                worker = idle[0]
+            elif len(self.workers) < self.get_max_workers():
+                worker = WorkerProcess(self, self._get_cpus(), self.nice)
+                self.workers.append(worker)
+            else:
+                return
+            func, args, completion = self.pending.popleft()
+            worker.start_job(func, args, completion)
+    def share_array(self, array):
+        return SharedArray(array)
+    def submit(self, func, args=()):
+        # Start a calculation in a worker process.  Returns a completion
+        # with an (is_error, result) tuple.  The 'func' and 'args'
+        # parameters must be picklable.
+        completion = self.reactor.completion()
+        self.pending.append((func, args, completion))
+        self._dispatch()
+        return completion
+    def run_multi(self, func, args_list, wait_msg=None):
+        # Run 'func' for each entry in 'args_list' and wait for the results
+        completions = [self.submit(func, args) for args in args_list]
+        gcode = self.printer.lookup_object('gcode')
+        results = []
+        for completion in completions:
+            while 1:
+                eventtime = self.reactor.monotonic()
+                res = completion.wait(eventtime + WAIT_REPORT_TIME)
+                if res is not None:
+                    break
+                if wait_msg is not None:
+                    gcode.respond_info(wait_msg, log=False)
+            is_err, val = res
+            if is_err:
+                raise self.printer.command_error(
+                    "Error in remote calculation: %s" % (val,))
+            results.append(val)
+        return results
+    def run(self, func, args=(), wait_msg=None):
+        return self.run_multi(func, [args], wait_msg)[0]
+
+def load_config(config):
+    return WorkerPool(config)
@@ -4,6 +4,7 @@
 #
 # This file may be distributed under the terms of the GNU GPLv3 license.
 import os, re, logging, collections, shlex
+import chelper
 
 class CommandError(Exception):
     pass
@@ -105,6 +106,12 @@ class GCodeDispatch:
         self.mux_commands = {}
         self.gcode_help = {}
         self.status_commands = {}
+        # Latency tracking
+        ffi_main, ffi_lib = chelper.get_ffi()
+        self.latency_get_time = ffi_lib.latency_get_time
+        self.latency_note = ffi_lib.latency_hist_note
+        self.command_latency = ffi_main.gc(ffi_lib.latency_hist_alloc(),
+                                           ffi_lib.free)
         # Register commands needed before config file is loaded
         handlers = ['M110', 'M112', 'M115',
                     'RESTART', 'FIRMWARE_RESTART', 'ECHO', 'STATUS', 'HELP']
@@ -161,6 +168,8 @@ class GCodeDispatch:
         return dict(self.gcode_help)
     def get_status(self, eventtime):
         return {'commands': self.status_commands}
+    def get_latency_histograms(self):
+        return [("gcode_command", self.command_latency)]
     def _build_status_commands(self):
         commands = {cmd: {} for cmd in self.gcode_handlers}
         for cmd in self.gcode_help:
@@ -187,6 +196,9 @@ class GCodeDispatch:
     args_r = re.compile('([A-Z_]+|[A-Z*/])')
     def _process_commands(self, commands, need_ack=True):
         for line in commands:
+            # Only the parsing and dispatch of a line is timed - the
+            # handler may wait (eg, M400) or run a nested script
+            start_time = self.latency_get_time()
             # Ignore comments and leading/trailing spaces
             line = origline = line.strip()
             cpos = line.find(';')
@@ -207,6 +219,7 @@ class GCodeDispatch:
             gcmd = GCodeCommand(self, cmd, origline, params, need_ack)
             # Invoke handler for command
             handler = self.gcode_handlers.get(cmd, self.cmd_default)
+            self.latency_note(self.command_latency, start_time)
             try:
                 handler(gcmd)
             except self.error as e:
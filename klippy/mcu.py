@@ -77,6 +77,19 @@ class CommandQueryWrapper:
                           minclock=0, reqclock=0):
         cmds = [preface_cmd._cmd.encode(preface_data), self._cmd.encode(data)]
         return self._do_send(cmds, minclock, reqclock)
+    def send_multi(self, data_list, preface_cmd=None, preface_data=(),
+                   minclock=0, reqclock=0):
+        # Send several queries back-to-back and return all the responses
+        cmds = [self._cmd.encode(data) for data in data_list]
+        if preface_cmd is not None:
+            cmds.insert(0, preface_cmd._cmd.encode(preface_data))
+        xh = serialhdl.SerialRetryMultiCommand(self._serial, self._response,
+                                               self._oid, len(data_list))
+        reqclock = max(minclock, reqclock)
+        try:
+            return xh.get_response(cmds, self._cmd_queue, minclock, reqclock)
+        except serialhdl.error as e:
+            raise self._error(str(e))
 
 # Wrapper around command sending
 class CommandWrapper:
@@ -496,6 +509,8 @@ class MCU_adc:
         self._inv_max_adc = 0.
     def get_mcu(self):
         return self._mcu
+    def get_oid(self):
+        return self._oid
     def setup_minmax(self, sample_time, sample_count,
                      minval=0., maxval=1., range_check_count=0):
         self._sample_time = sample_time
@@ -597,7 +612,16 @@ class MCU:
         self._reserved_move_slots = 0
         self._stepqueues = []
         self._steppersync = None
+        self._move_count = 0
         self._flush_callbacks = []
+        # Latency tracking
+        self._latency_hists = []
+        self._sc_flush_latency = self.alloc_latency_histogram(
+            "stepcompress_flush %s" % (self._name,))
+        self._ss_flush_latency = self.alloc_latency_histogram(
+            "steppersync_flush %s" % (self._name,))
+        self._transmit_latency = self.alloc_latency_histogram(
+            "serialqueue_transmit %s" % (self._name,))
         # Stats
         self._get_status_info = {}
         self._stats_sumsq_base = 0.
@@ -760,12 +784,17 @@ class MCU:
         if move_count < self._reserved_move_slots:
             raise error("Too few moves available on MCU '%s'" % (self._name,))
         ffi_main, ffi_lib = chelper.get_ffi()
+        self._move_count = move_count - self._reserved_move_slots
         self._steppersync = ffi_main.gc(
             ffi_lib.steppersync_alloc(self._serial.get_serialqueue(),
                                       self._stepqueues, len(self._stepqueues),
-                                      move_count-self._reserved_move_slots),
+                                      self._move_count),
             ffi_lib.steppersync_free)
         ffi_lib.steppersync_set_time(self._steppersync, 0., self._mcu_freq)
+        ffi_lib.steppersync_set_latency_hists(
+            self._steppersync, self._sc_flush_latency, self._ss_flush_latency)
+        ffi_lib.serialqueue_set_latency_hist(self._serial.get_serialqueue(),
+                                             self._transmit_latency)
         # Log config information
         move_msg = "Configured MCU '%s' (%d moves)" % (self._name, move_count)
         logging.info(move_msg)
@@ -865,11 +894,20 @@ class MCU:
         return int(time * self._mcu_freq)
     def get_max_stepper_error(self):
         return self._max_stepper_error
+    def alloc_latency_histogram(self, name):
+        ffi_main, ffi_lib = chelper.get_ffi()
+        lh = ffi_main.gc(ffi_lib.latency_hist_alloc(), ffi_lib.free)
+        self._latency_hists.append((name, lh))
+        return lh
+    def get_latency_histograms(self):
+        return list(self._latency_hists)
     # Wrapper functions
     def get_printer(self):
         return self._printer
     def get_name(self):
         return self._name
+    def get_serial(self):
+        return self._serial
     def register_response(self, cb, msg, oid=None):
         self._serial.register_response(cb, msg, oid)
     def alloc_command_queue(self):
@@ -891,6 +929,12 @@ class MCU:
         return self._serial.get_msgparser().get_constants()
     def get_constant_float(self, name):
         return self._serial.get_msgparser().get_constant_float(name)
+    def lookup_message_name(self, msgid):
+        msgparser = self._serial.get_msgparser()
+        msg = msgparser.messages_by_id.get(msgid)
+        if msg is None:
+            return None
+        return msg.name
     def print_time_to_clock(self, print_time):
         return self._clocksync.print_time_to_clock(print_time)
     def clock_to_print_time(self, clock):
@@ -899,6 +943,8 @@ class MCU:
         return self._clocksync.estimated_print_time(eventtime)
     def clock32_to_clock64(self, clock32):
         return self._clocksync.clock32_to_clock64(clock32)
+    def get_clock_error(self, eventtime):
+        return self._clocksync.get_clock_error(eventtime)
     # Restarts
     def _disconnect(self):
         self._serial.disconnect()
@@ -961,21 +1007,34 @@ class MCU:
         self._reserved_move_slots += 1
     def register_flush_callback(self, callback):
         self._flush_callbacks.append(callback)
-    def flush_moves(self, print_time, clear_history_time):
+    def prepare_flush(self, print_time, clear_history_time):
+        # Run flush callbacks and return the steppersync flush parameters
         if self._steppersync is None:
-            return
+            return None
         clock = self.print_time_to_clock(print_time)
         if clock < 0:
-            return
+            return None
         for cb in self._flush_callbacks:
             cb(print_time, clock)
         clear_history_clock = \
             max(0, self.print_time_to_clock(clear_history_time))
-        ret = self._ffi_lib.steppersync_flush(self._steppersync, clock,
-                                              clear_history_clock)
+        return self._steppersync, clock, clear_history_clock
+    def flush_moves(self, print_time, clear_history_time):
+        params = self.prepare_flush(print_time, clear_history_time)
+        if params is None:
+            return
+        ret = self._ffi_lib.steppersync_flush(*params)
         if ret:
             raise error("Internal error in MCU '%s' stepcompress"
                         % (self._name,))
+    def get_move_queue_usage(self, eventtime):
+        # Return the fraction of the mcu move queue that is in use
+        if self._steppersync is None or not self._move_count:
+            return 0.
+        clock = self._clocksync.get_clock(eventtime)
+        used = self._ffi_lib.steppersync_get_queue_usage(self._steppersync,
+                                                         clock)
+        return float(used) / self._move_count
     def check_active(self, print_time, eventtime):
         if self._steppersync is None:
             return
@@ -1003,11 +1062,53 @@ class MCU:
             self._mcu_tick_awake, self._mcu_tick_avg, self._mcu_tick_stddev)
         stats = ' '.join([load, self._serial.stats(eventtime),
                           self._clocksync.stats(eventtime)])
+        if self._steppersync is not None:
+            ffi_main, ffi_lib = chelper.get_ffi()
+            sbuf = ffi_main.new('char[256]')
+            # Flush time statistics are reported since the last stats call
+            reset = 1
+            ffi_lib.steppersync_get_stats(self._steppersync, sbuf, len(sbuf),
+                                          reset)
+            stats += ' ' + str(ffi_main.string(sbuf).decode())
         parts = [s.split('=', 1) for s in stats.split()]
         last_stats = {k:(float(v) if '.' in v else int(v)) for k, v in parts}
         self._get_status_info['last_stats'] = last_stats
         return False, '%s: %s' % (self._name, stats)
 
+# Flush the step queues of several mcus in parallel (using a pool of
+# threads in the C code)
+class ParallelFlush:
+    def __init__(self, mcus):
+        self.mcus = mcus
+        count = len(mcus)
+        ffi_main, self.ffi_lib = chelper.get_ffi()
+        self.flushpool = ffi_main.gc(self.ffi_lib.flushpool_alloc(count),
+                                     self.ffi_lib.flushpool_free)
+        self.ss_list = ffi_main.new('struct steppersync *[]', count)
+        self.move_clocks = ffi_main.new('uint64_t[]', count)
+        self.clear_history_clocks = ffi_main.new('uint64_t[]', count)
+        self.results = ffi_main.new('int[]', count)
+    def flush_moves(self, print_time, clear_history_time):
+        flushed = []
+        for m in self.mcus:
+            params = m.prepare_flush(print_time, clear_history_time)
+            if params is None:
+                continue
+            i = len(flushed)
+            (self.ss_list[i], self.move_clocks[i],
+             self.clear_history_clocks[i]) = params
+            flushed.append(m)
+        if not flushed:
+            return
+        ret = self.ffi_lib.flushpool_flush(
+            self.flushpool, self.ss_list, self.move_clocks,
+            self.clear_history_clocks, self.results, len(flushed))
+        if ret:
+            names = [m.get_name() for i, m in enumerate(flushed)
+                     if self.results[i]]
+            raise error("Internal error in MCU '%s' stepcompress"
+                        % ("', '".join(names),))
+
 Common_MCU_errors = {
     ("Timer too close",): """
 This often indicates the host computer is overloaded. Check
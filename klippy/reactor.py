@@ -3,7 +3,7 @@
 # Copyright (C) 2016-2020  Kevin O'Connor <kevin@koconnor.net>
 #
 # This file may be distributed under the terms of the GNU GPLv3 license.
-import os, gc, select, math, time, logging, queue
+import os, gc, select, math, time, logging, queue, heapq
 import greenlet
 import chelper, util
 
@@ -14,6 +14,8 @@ class ReactorTimer:
     def __init__(self, callback, waketime):
         self.callback = callback
         self.waketime = waketime
+        self.heap_entry = None
+        self.is_registered = True
 
 class ReactorCompletion:
     class sentinel: pass
@@ -101,9 +103,16 @@ class SelectReactor:
         # Python garbage collection
         self._check_gc = gc_checking
         self._last_gc_times = [0., 0., 0.]
-        # Timers
-        self._timers = []
+        # Timers (stored in a heap of [waketime, sequence, timer] entries -
+        # an entry is invalidated by clearing its timer)
+        self._timer_heap = []
+        self._timer_count = 0
+        self._timer_seq = 0
         self._next_timer = self.NEVER
+        # Statistics
+        self._timer_callbacks = 0
+        self._greenlet_switches = 0
+        self._max_callback_time = 0.
         # Callbacks
         self._pipe_fds = None
         self._async_queue = queue.Queue()
@@ -116,22 +125,54 @@ class SelectReactor:
         self._all_greenlets = []
     def get_gc_stats(self):
         return tuple(self._last_gc_times)
+    def get_stats(self):
+        # Return total timer callbacks, total greenlet switches, and the
+        # longest timer callback since the last call
+        max_callback_time = self._max_callback_time
+        self._max_callback_time = 0.
+        return (self._timer_callbacks, self._greenlet_switches,
+                max_callback_time)
     # Timers
-    def update_timer(self, timer_handler, waketime):
+    def _schedule_timer(self, timer_handler, waketime):
+        entry = timer_handler.heap_entry
+        if entry is not None:
+            entry[2] = None
+            timer_handler.heap_entry = None
         timer_handler.waketime = waketime
+        if waketime >= self.NEVER or not timer_handler.is_registered:
+            return
+        heap = self._timer_heap
+        if len(heap) > 2 * self._timer_count + 64:
+            # Discard invalidated entries (in place, as _check_timers
+            # may be iterating over this heap)
+            heap[:] = [e for e in heap if e[2] is not None]
+            heapq.heapify(heap)
+        self._timer_seq += 1
+        entry = [waketime, self._timer_seq, timer_handler]
+        heapq.heappush(heap, entry)
+        timer_handler.heap_entry = entry
+    def update_timer(self, timer_handler, waketime):
+        self._schedule_timer(timer_handler, waketime)
         self._next_timer = min(self._next_timer, waketime)
     def register_timer(self, callback, waketime=NEVER):
-        timer_handler = ReactorTimer(callback, waketime)
-        timers = list(self._timers)
-        timers.append(timer_handler)
-        self._timers = timers
+        timer_handler = ReactorTimer(callback, self.NEVER)
+        self._timer_count += 1
+        self._schedule_timer(timer_handler, waketime)
         self._next_timer = min(self._next_timer, waketime)
         return timer_handler
     def unregister_timer(self, timer_handler):
-        timer_handler.waketime = self.NEVER
-        timers = list(self._timers)
-        timers.pop(timers.index(timer_handler))
-        self._timers = timers
+        if timer_handler.is_registered:
+            timer_handler.is_registered = False
+            self._timer_count -= 1
+        self._schedule_timer(timer_handler, self.NEVER)
+    def _update_next_timer(self):
+        heap = self._timer_heap
+        while heap and heap[0][2] is None:
+            heapq.heappop(heap)
+        if heap:
+            self._next_timer = heap[0][0]
+        else:
+            self._next_timer = self.NEVER
     def _check_timers(self, eventtime, busy):
         if eventtime < self._next_timer:
             if busy:
@@ -149,18 +190,39 @@ class SelectReactor:
                     gc.collect(gc_level)
                     return 0.
             return min(1., max(.001, self._next_timer - eventtime))
-        self._next_timer = self.NEVER
         g_dispatch = self._g_dispatch
-        for t in self._timers:
-            waketime = t.waketime
-            if eventtime >= waketime:
-                t.waketime = self.NEVER
-                t.waketime = waketime = t.callback(eventtime)
-                if g_dispatch is not self._g_dispatch:
-                    self._next_timer = min(self._next_timer, waketime)
-                    self._end_greenlet(g_dispatch)
-                    return 0.
-            self._next_timer = min(self._next_timer, waketime)
+        heap = self._timer_heap
+        # Each timer is run at most once per call - entries added by
+        # the callbacks are deferred until the next call
+        seq_limit = self._timer_seq
+        deferred = []
+        while heap and heap[0][0] <= eventtime:
+            entry = heapq.heappop(heap)
+            t = entry[2]
+            if t is None:
+                continue
+            if entry[1] > seq_limit:
+                deferred.append(entry)
+                continue
+            for d in deferred:
+                heapq.heappush(heap, d)
+            del deferred[:]
+            entry[2] = None
+            t.heap_entry = None
+            t.waketime = self.NEVER
+            self._timer_callbacks += 1
+            start_time = self.monotonic()
+            waketime = t.callback(eventtime)
+            self._schedule_timer(t, waketime)
+            if g_dispatch is not self._g_dispatch:
+                self._next_timer = min(self._next_timer, waketime)
+                self._end_greenlet(g_dispatch)
+                return 0.
+            self._max_callback_time = max(self._max_callback_time,
+                                          self.monotonic() - start_time)
+        for entry in deferred:
+            heapq.heappush(heap, entry)
+        self._update_next_timer()
         return 0.
     # Callbacks and Completions
     def completion(self):
@@ -211,6 +273,7 @@ class SelectReactor:
             if self._g_dispatch is None:
                 return self._sys_pause(waketime)
             # Switch to _check_timers (via g.timer.callback return)
+            self._greenlet_switches += 1
             return self._g_dispatch.switch(waketime)
         # Pausing the dispatch greenlet - prepare a new greenlet to do dispatch
         if self._greenlets:
@@ -221,6 +284,7 @@ class SelectReactor:
         g_next.parent = g.parent
         g.timer = self.register_timer(g.switch, waketime)
         self._next_timer = self.NOW
+        self._greenlet_switches += 1
         # Switch to _dispatch_loop (via _end_greenlet or direct)
         eventtime = g_next.switch()
         # This greenlet activated from g.timer.callback (via _check_timers)
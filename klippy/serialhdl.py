@@ -229,6 +229,8 @@ class SerialReader:
         return self.msgparser
     def get_serialqueue(self):
         return self.serialqueue
+    def get_background_thread(self):
+        return self.background_thread
     def get_default_command_queue(self):
         return self.default_cmd_queue
     # Serial response callbacks
@@ -330,6 +332,38 @@ class SerialRetryCommand:
             retries -= 1
             retry_delay *= 2.
 
+# Class to send a sequence of query commands and collect all responses
+class SerialRetryMultiCommand:
+    def __init__(self, serial, name, oid=None, count=1):
+        self.serial = serial
+        self.name = name
+        self.oid = oid
+        self.count = count
+        self.responses = []
+        self.serial.register_response(self.handle_callback, name, oid)
+    def handle_callback(self, params):
+        self.responses.append(params)
+    def get_response(self, cmds, cmd_queue, minclock=0, reqclock=0):
+        retries = 5
+        retry_delay = .010
+        while 1:
+            self.responses = []
+            for cmd in cmds[:-1]:
+                self.serial.raw_send(cmd, minclock, reqclock, cmd_queue)
+            self.serial.raw_send_wait_ack(cmds[-1], minclock, reqclock,
+                                          cmd_queue)
+            responses = self.responses
+            if len(responses) >= self.count:
+                self.serial.register_response(None, self.name, self.oid)
+                return responses[-self.count:]
+            if retries <= 0:
+                self.serial.register_response(None, self.name, self.oid)
+                raise error("Unable to obtain '%s' response" % (self.name,))
+            reactor = self.serial.reactor
+            reactor.pause(reactor.monotonic() + retry_delay)
+            retries -= 1
+            retry_delay *= 2.
+
 # Attempt to place an AVR stk500v2 style programmer into normal mode
 def stk500v2_leave(ser, reactor):
     logging.debug("Starting stk500v2 leave programmer sequence")
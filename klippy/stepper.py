@@ -40,6 +40,7 @@ class MCU_stepper:
         self._step_both_edge = self._req_step_both_edge = False
         self._mcu_position_offset = 0.
         self._reset_cmd_tag = self._get_position_cmd = None
+        self._get_queue_cmd = None
         self._active_callbacks = []
         ffi_main, ffi_lib = chelper.get_ffi()
         self._stepqueue = ffi_main.gc(ffi_lib.stepcompress_alloc(oid),
@@ -50,6 +51,10 @@ class MCU_stepper:
         self._itersolve_generate_steps = ffi_lib.itersolve_generate_steps
         self._itersolve_check_active = ffi_lib.itersolve_check_active
         self._trapq = ffi_main.NULL
+        self._latency_get_time = ffi_lib.latency_get_time
+        self._latency_note = ffi_lib.latency_hist_note
+        self._gen_latency = self._mcu.alloc_latency_histogram(
+            "generate_steps %s" % (name,))
         self._mcu.get_printer().register_event_handler('klippy:connect',
                                                        self._query_mcu_position)
     def get_mcu(self):
@@ -98,13 +103,33 @@ class MCU_stepper:
         self._get_position_cmd = self._mcu.lookup_query_command(
             "stepper_get_position oid=%c",
             "stepper_position oid=%c pos=%i", oid=self._oid)
+        if self._mcu.try_lookup_command("stepper_get_queue oid=%c"):
+            self._get_queue_cmd = self._mcu.lookup_query_command(
+                "stepper_get_queue oid=%c",
+                "stepper_queue oid=%c count=%hu peak=%hu", oid=self._oid)
         max_error = self._mcu.get_max_stepper_error()
         max_error_ticks = self._mcu.seconds_to_clock(max_error)
         ffi_main, ffi_lib = chelper.get_ffi()
         ffi_lib.stepcompress_fill(self._stepqueue, max_error_ticks,
                                   step_cmd_tag, dir_cmd_tag)
+        multi_cmd = self._mcu.try_lookup_command(
+            "queue_step_multi oid=%c data=%*s")
+        if multi_cmd is not None:
+            ffi_lib.stepcompress_fill_multi(self._stepqueue,
+                                            multi_cmd.get_command_tag())
     def get_oid(self):
         return self._oid
+    def get_move_queue_stats(self, reset=False):
+        # Report the peak number of mcu move queue slots used by the host
+        # and (if available) the moves currently queued in the mcu
+        ffi_main, ffi_lib = chelper.get_ffi()
+        res = {'host_peak': ffi_lib.stepcompress_get_move_slots_peak(
+            self._stepqueue, reset)}
+        if self._get_queue_cmd is not None and not self._mcu.is_fileoutput():
+            params = self._get_queue_cmd.send([self._oid])
+            res['mcu_count'] = params['count']
+            res['mcu_peak'] = params['peak']
+        return res
     def get_step_dist(self):
         return self._step_dist
     def get_rotation_distance(self):
@@ -223,7 +248,9 @@ class MCU_stepper:
                     cb(ret)
         # Generate steps
         sk = self._stepper_kinematics
+        start_time = self._latency_get_time()
         ret = self._itersolve_generate_steps(sk, flush_time)
+        self._latency_note(self._gen_latency, start_time)
         if ret:
             raise error("Internal error in stepcompress")
     def is_active_axis(self, axis):
@@ -125,6 +125,7 @@ class LookAheadQueue:
             return self.queue[-1]
         return None
     def flush(self, lazy=False):
+        start_time = self.toolhead.latency_get_time()
         self.junction_flush = LOOKAHEAD_FLUSH_TIME
         update_flush_count = lazy
         queue = self.queue
@@ -176,6 +177,7 @@ class LookAheadQueue:
         self.toolhead._process_moves(queue[:flush_count])
         # Remove processed moves from the queue
         del queue[:flush_count]
+        self.toolhead.latency_note(self.toolhead.flush_latency, start_time)
     def add_move(self, move):
         self.queue.append(move)
         if len(self.queue) == 1:
@@ -198,6 +200,98 @@ STEPCOMPRESS_FLUSH_TIME = 0.050
 SDS_CHECK_TIME = 0.001 # step+dir+step filter in stepcompress.c
 MOVE_HISTORY_EXPIRE = 30.
 
+# Adaptive buffer time control
+BUFFER_TIME_MIN = 0.250
+BUFFER_TIME_MAX = 4.0
+BUFFER_SAFETY_FACTOR = 4.
+BUFFER_DECAY = 1. / 30.
+BUFFER_SHRINK_RATE = .050
+MOVE_QUEUE_FULL = 0.90
+
+# Determine how much move data to buffer in the host.  By default the
+# buffer times are fixed.  In adaptive mode they are sized from the
+# measured step generation time, the health of each mcu link, and the
+# occupancy of each mcu move queue.
+class BufferTimeController:
+    def __init__(self, config, main_mcu):
+        self.is_adaptive = config.getboolean('adaptive_buffer_time', False)
+        if main_mcu.is_fileoutput():
+            self.is_adaptive = False
+        self.buffer_time_low = BUFFER_TIME_LOW
+        self.buffer_time_high = BUFFER_TIME_HIGH
+        self.bgflush_low_time = BGFLUSH_LOW_TIME
+        self.move_batch_time = MOVE_BATCH_TIME
+        # Measurements
+        self.step_gen_time = self.step_gen_peak = 0.
+        self.link_time = self.clock_error = self.move_queue = 0.
+        self.min_slack = 99999999.9
+        self.last_retransmit = {}
+        self.required_time = 0.
+        self.increases = 0
+    def note_flush(self, gen_time):
+        # Track the host time used to generate a batch of steps
+        if gen_time > self.step_gen_peak:
+            self.step_gen_peak = gen_time
+    def note_slack(self, slack):
+        # Track how far ahead of the mcu a low buffer flush completed
+        if slack < self.min_slack:
+            self.min_slack = slack
+    def update(self, eventtime, all_mcus):
+        if not self.is_adaptive:
+            return
+        # Step generation time (decayed peak)
+        self.step_gen_time = max(self.step_gen_peak, (1. - BUFFER_DECAY)
+                                 * self.step_gen_time)
+        self.step_gen_peak = 0.
+        # Link health and clock prediction error of each mcu
+        link_time = clock_error = move_queue = 0.
+        for m in all_mcus:
+            last_stats = m.get_status(eventtime).get('last_stats', {})
+            mcu_link = last_stats.get('rto', 0.)
+            retransmit = last_stats.get('bytes_retransmit', 0)
+            if retransmit > self.last_retransmit.get(m, retransmit):
+                # Recent retransmits - allow for a further retransmit
+                mcu_link *= 2.
+            self.last_retransmit[m] = retransmit
+            link_time = max(link_time, mcu_link)
+            clock_error = max(clock_error, m.get_clock_error(eventtime))
+            move_queue = max(move_queue, m.get_move_queue_usage(eventtime))
+        self.link_time = max(link_time, (1. - BUFFER_DECAY) * self.link_time)
+        self.clock_error = clock_error
+        self.move_queue = move_queue
+        # Time needed to generate, transmit, and schedule one batch
+        required = self.step_gen_time + self.link_time + self.clock_error
+        self.required_time = required
+        target = min(BUFFER_TIME_MAX,
+                     max(BUFFER_TIME_MIN, BUFFER_SAFETY_FACTOR * required))
+        # Grow quickly if a batch arrived with less than the required lead
+        min_slack, self.min_slack = self.min_slack, 99999999.9
+        if min_slack < BUFFER_SAFETY_FACTOR * .5 * required:
+            target = min(BUFFER_TIME_MAX, max(target,
+                                              2. * self.buffer_time_low))
+        low = self.buffer_time_low
+        if target > low:
+            self.increases += 1
+            low = target
+        elif move_queue < MOVE_QUEUE_FULL:
+            # Shrink slowly.  Hold the current size while an mcu move
+            # queue is full, as queued steps then wait in the host.
+            low = max(target, low * (1. - BUFFER_SHRINK_RATE))
+        self.buffer_time_low = low
+        self.buffer_time_high = 2. * low
+        self.bgflush_low_time = max(BGFLUSH_LOW_TIME, 2. * required)
+        self.move_batch_time = min(MOVE_BATCH_TIME, .5 * low)
+    def get_status(self, eventtime):
+        return {'adaptive': self.is_adaptive,
+                'buffer_time_low': self.buffer_time_low,
+                'buffer_time_high': self.buffer_time_high,
+                'required_time': self.required_time,
+                'step_gen_time': self.step_gen_time,
+                'link_time': self.link_time,
+                'clock_error': self.clock_error,
+                'move_queue': self.move_queue,
+                'increases': self.increases}
+
 DRIP_SEGMENT_TIME = 0.050
 DRIP_TIME = 0.100
 class DripModeEndSignal(Exception):
@@ -211,8 +305,13 @@ class ToolHead:
         self.all_mcus = [
             m for n, m in self.printer.lookup_objects(module='mcu')]
         self.mcu = self.all_mcus[0]
+        self.flush_mcus = self.all_mcus
+        if len(self.all_mcus) > 1:
+            # Flush independent mcus in parallel
+            self.flush_mcus = [mcu.ParallelFlush(self.all_mcus)]
+        self.buffer_ctl = BufferTimeController(config, self.mcu)
         self.lookahead = LookAheadQueue(self)
-        self.lookahead.set_flush_time(BUFFER_TIME_HIGH)
+        self.lookahead.set_flush_time(self.buffer_ctl.buffer_time_high)
         self.commanded_pos = [0., 0., 0., 0.]
         # Velocity and acceleration control
         self.max_velocity = config.getfloat('max_velocity', above=0.)
@@ -259,6 +358,14 @@ class ToolHead:
         self.trapq_append = ffi_lib.trapq_append
         self.trapq_finalize_moves = ffi_lib.trapq_finalize_moves
         self.step_generators = []
+        # Latency tracking
+        self.latency_get_time = ffi_lib.latency_get_time
+        self.latency_note = ffi_lib.latency_hist_note
+        self.flush_latency = ffi_main.gc(ffi_lib.latency_hist_alloc(),
+                                         ffi_lib.free)
+        self.trapq_latency = ffi_main.gc(ffi_lib.latency_hist_alloc(),
+                                         ffi_lib.free)
+        ffi_lib.trapq_set_latency_hist(self.trapq, self.trapq_latency)
         # Create kinematics class
         gcode = self.printer.lookup_object('gcode')
         self.Coord = gcode.Coord
@@ -286,7 +393,8 @@ class ToolHead:
                                             self._handle_shutdown)
         # Load some default modules
         modules = ["gcode_move", "homing", "idle_timeout", "statistics",
-                   "manual_probe", "tuning_tower"]
+                   "latency_stats", "mcu_profile", "manual_probe",
+                   "tuning_tower"]
         for module_name in modules:
             self.printer.load_object(config, module_name)
     # Print time and flush tracking
@@ -296,6 +404,7 @@ class ToolHead:
         sg_flush_want = min(flush_time + STEPCOMPRESS_FLUSH_TIME,
                             self.print_time - self.kin_flush_delay)
         sg_flush_time = max(sg_flush_want, flush_time)
+        gen_start = self.latency_get_time()
         for sg in self.step_generators:
             sg(sg_flush_time)
         self.min_restart_time = max(self.min_restart_time, sg_flush_time)
@@ -307,16 +416,20 @@ class ToolHead:
         self.trapq_finalize_moves(self.trapq, free_time, clear_history_time)
         self.extruder.update_move_time(free_time, clear_history_time)
         # Flush stepcompress and mcu steppersync
-        for m in self.all_mcus:
+        for m in self.flush_mcus:
             m.flush_moves(flush_time, clear_history_time)
+        if self.buffer_ctl.is_adaptive:
+            self.buffer_ctl.note_flush(
+                (self.latency_get_time() - gen_start) * .000000001)
         self.last_flush_time = flush_time
     def _advance_move_time(self, next_print_time):
         pt_delay = self.kin_flush_delay + STEPCOMPRESS_FLUSH_TIME
         flush_time = max(self.last_flush_time, self.print_time - pt_delay)
         self.print_time = max(self.print_time, next_print_time)
         want_flush_time = max(flush_time, self.print_time - pt_delay)
+        batch_time = self.buffer_ctl.move_batch_time
         while 1:
-            flush_time = min(flush_time + MOVE_BATCH_TIME, want_flush_time)
+            flush_time = min(flush_time + batch_time, want_flush_time)
             self._advance_flush_time(flush_time)
             if flush_time >= want_flush_time:
                 break
@@ -365,7 +478,7 @@ class ToolHead:
         self.lookahead.flush()
         self.special_queuing_state = "NeedPrime"
         self.need_check_pause = -1.
-        self.lookahead.set_flush_time(BUFFER_TIME_HIGH)
+        self.lookahead.set_flush_time(self.buffer_ctl.buffer_time_high)
         self.check_stall_time = 0.
     def flush_step_generation(self):
         self._flush_lookahead()
@@ -394,11 +507,13 @@ class ToolHead:
             if self.priming_timer is None:
                 self.priming_timer = self.reactor.register_timer(
                     self._priming_handler)
-            wtime = eventtime + max(0.100, buffer_time - BUFFER_TIME_LOW)
+            wtime = eventtime + max(0.100, buffer_time
+                                    - self.buffer_ctl.buffer_time_low)
             self.reactor.update_timer(self.priming_timer, wtime)
         # Check if there are lots of queued moves and pause if so
+        buffer_time_high = self.buffer_ctl.buffer_time_high
         while 1:
-            pause_time = buffer_time - BUFFER_TIME_HIGH
+            pause_time = buffer_time - buffer_time_high
             if pause_time <= 0.:
                 break
             if not self.can_pause:
@@ -409,7 +524,7 @@ class ToolHead:
             buffer_time = self.print_time - est_print_time
         if not self.special_queuing_state:
             # In main state - defer pause checking until needed
-            self.need_check_pause = est_print_time + BUFFER_TIME_HIGH + 0.100
+            self.need_check_pause = est_print_time + buffer_time_high + 0.100
     def _priming_handler(self, eventtime):
         self.reactor.unregister_timer(self.priming_timer)
         self.priming_timer = None
@@ -428,23 +543,29 @@ class ToolHead:
                 # In "main" state - flush lookahead if buffer runs low
                 print_time = self.print_time
                 buffer_time = print_time - est_print_time
-                if buffer_time > BUFFER_TIME_LOW:
+                buffer_time_low = self.buffer_ctl.buffer_time_low
+                if buffer_time > buffer_time_low:
                     # Running normally - reschedule check
-                    return eventtime + buffer_time - BUFFER_TIME_LOW
+                    return eventtime + buffer_time - buffer_time_low
                 # Under ran low buffer mark - flush lookahead queue
                 self._flush_lookahead()
                 if print_time != self.print_time:
                     self.check_stall_time = self.print_time
+                    if self.buffer_ctl.is_adaptive:
+                        curtime = self.reactor.monotonic()
+                        self.buffer_ctl.note_slack(
+                            print_time - self.mcu.estimated_print_time(curtime))
             # In "NeedPrime"/"Priming" state - flush queues if needed
+            bgflush_low_time = self.buffer_ctl.bgflush_low_time
             while 1:
                 end_flush = self.need_flush_time + BGFLUSH_EXTRA_TIME
                 if self.last_flush_time >= end_flush:
                     self.do_kick_flush_timer = True
                     return self.reactor.NEVER
                 buffer_time = self.last_flush_time - est_print_time
-                if buffer_time > BGFLUSH_LOW_TIME:
-                    return eventtime + buffer_time - BGFLUSH_LOW_TIME
-                ftime = est_print_time + BGFLUSH_LOW_TIME + BGFLUSH_BATCH_TIME
+                if buffer_time > bgflush_low_time:
+                    return eventtime + buffer_time - bgflush_low_time
+                ftime = est_print_time + bgflush_low_time + BGFLUSH_BATCH_TIME
                 self._advance_flush_time(min(end_flush, ftime))
         except:
             logging.exception("Exception in flush_handler")
@@ -473,7 +594,12 @@ class ToolHead:
         self.lookahead.add_move(move)
         if self.print_time > self.need_check_pause:
             self._check_pause()
+    def move_batch(self, positions, speed):
+        # Queue a series of moves (all at the same requested speed)
+        for newpos in positions:
+            self.move(newpos, speed)
     def manual_move(self, coord, speed):
+        self.printer.send_event("toolhead:manual_move_begin")
         curpos = list(self.commanded_pos)
         for i in range(len(coord)):
             if coord[i] is not None:
@@ -522,7 +648,7 @@ class ToolHead:
         self.need_check_pause = self.reactor.NEVER
         self.reactor.update_timer(self.flush_timer, self.reactor.NEVER)
         self.do_kick_flush_timer = False
-        self.lookahead.set_flush_time(BUFFER_TIME_HIGH)
+        self.lookahead.set_flush_time(self.buffer_ctl.buffer_time_high)
         self.check_stall_time = 0.
         self.drip_completion = drip_completion
         # Submit move
@@ -550,6 +676,7 @@ class ToolHead:
         self.clear_history_time = est_print_time - MOVE_HISTORY_EXPIRE
         buffer_time = self.print_time - est_print_time
         is_active = buffer_time > -60. or not self.special_queuing_state
+        self.buffer_ctl.update(eventtime, self.all_mcus)
         if self.special_queuing_state == "Drip":
             buffer_time = 0.
         return is_active, "print_time=%.3f buffer_time=%.3f print_stall=%d" % (
@@ -570,11 +697,15 @@ class ToolHead:
                      'max_velocity': self.max_velocity,
                      'max_accel': self.max_accel,
                      'minimum_cruise_ratio': self.min_cruise_ratio,
-                     'square_corner_velocity': self.square_corner_velocity})
+                     'square_corner_velocity': self.square_corner_velocity,
+                     'buffer_control': self.buffer_ctl.get_status(eventtime)})
         return res
     def _handle_shutdown(self):
         self.can_pause = False
         self.lookahead.reset()
+    def get_latency_histograms(self):
+        return [("lookahead_flush", self.flush_latency),
+                ("trapq_append", self.trapq_latency)]
     def get_kinematics(self):
         return self.kin
     def get_trapq(self):
@@ -0,0 +1,366 @@
+#!/usr/bin/env python
+# Benchmark host step generation using klippy's batch output mode
+#
+# Copyright (C) 2026  agent <agent@local>
+#
+# This file may be distributed under the terms of the GNU GPLv3 license.
+import sys, os, optparse, subprocess, time, math, re, json
+sys.path.append(os.path.join(os.path.dirname(os.path.realpath(__file__)),
+                             '..', 'klippy'))
+import msgproto
+
+BENCH_DIR = os.path.join(os.path.dirname(os.path.realpath(__file__)),
+                         '..', 'test', 'benchmark')
+TEMP_GCODE_FILE = "_bench_.gcode"
+TEMP_LOG_FILE = "_bench_.log"
+TEMP_OUTPUT_FILE = "_bench_output"
+
+
+######################################################################
+# Workloads
+######################################################################
+
+def gen_start(out, accel=20000):
+    out += ["G28", "G90", "M83",
+            "SET_VELOCITY_LIMIT ACCEL=%d" % (accel,), "G1 Z0.3 F3000"]
+
+# Many small G2 circles of varying radius
+def gen_arcs(out, scale, cx=125., cy=125.):
+    gen_start(out)
+    for i in range(int(400 * scale)):
+        r = 2. + (i % 25) * .5
+        e = math.pi * r * .033
+        out.append("G1 X%.3f Y%.3f F18000" % (cx - r, cy))
+        out.append("G2 X%.3f Y%.3f I%.3f J0 E%.4f F9000" % (cx + r, cy, r, e))
+        out.append("G2 X%.3f Y%.3f I%.3f J0 E%.4f" % (cx - r, cy, -r, e))
+
+# Continuous spiral with many short segments (as in "vase mode")
+def gen_vase(out, scale, cx=125., cy=125., radius=50., segs=360):
+    gen_start(out, accel=5000)
+    out.append("G1 X%.3f Y%.3f F6000" % (cx + radius, cy))
+    z = .3
+    e = 2. * math.pi * radius / segs * .033
+    for i in range(int(60 * scale) * segs):
+        a = 2. * math.pi * (i + 1) / segs
+        z += .2 / segs
+        out.append("G1 X%.3f Y%.3f Z%.4f E%.5f"
+                   % (cx + radius * math.cos(a), cy + radius * math.sin(a),
+                      z, e))
+
+# Dense rectilinear infill with short lines and high acceleration
+def gen_infill(out, scale, cx=125., cy=125., size=30., layers=True):
+    gen_start(out)
+    out.append("G1 X%.3f Y%.3f F18000" % (cx - size/2., cy - size/2.))
+    count = int(size / .45)
+    e = size * .033
+    z = .3
+    for layer in range(int(40 * scale)):
+        for i in range(count):
+            y = cy - size/2. + i * .45
+            x = cx + size/2. if i % 2 == 0 else cx - size/2.
+            out.append("G1 X%.3f Y%.3f E%.4f" % (x, y, e))
+            out.append("G1 Y%.3f E%.4f" % (y + .45, .45 * .033))
+        if layers:
+            z += .2
+            out.append("G1 Z%.3f" % (z,))
+        out.append("G1 X%.3f Y%.3f" % (cx - size/2., cy - size/2.))
+
+# Short layers with macros invoked at each layer change
+def gen_macros(out, scale):
+    gen_start(out)
+    z = .3
+    for layer in range(int(1000 * scale)):
+        out.append("LAYER_CHANGE")
+        out.append("PRINT_STATUS")
+        if layer % 10 == 0:
+            out.append("TOOL_CHANGE")
+        out.append("G1 X%.3f Y%.3f E.1" % (100. + layer % 2 * 10., 100.))
+        z += .01
+        out.append("G1 Z%.3f" % (z,))
+
+def gen_delta(out, scale):
+    gen_infill(out, scale, cx=0., cy=0., size=60.)
+
+def gen_input_shaper(out, scale):
+    gen_infill(out, scale, layers=False)
+    gen_arcs(out, scale * .5)
+
+# name, config, dictionaries, gcode generator
+WORKLOADS = [
+    ("dense_arcs", "cartesian.cfg", ["atmega2560.dict"], gen_arcs),
+    ("vase_mode", "cartesian.cfg", ["atmega2560.dict"], gen_vase),
+    ("high_accel_infill", "cartesian.cfg", ["atmega2560.dict"], gen_infill),
+    ("delta", "delta.cfg", ["atmega2560.dict"], gen_delta),
+    ("input_shaper_pa", "input_shaper.cfg", ["atmega2560.dict"],
+     gen_input_shaper),
+    ("macros", "macros.cfg", ["atmega2560.dict"], gen_macros),
+    ("multi_mcu", "multi_mcu.cfg",
+     ["atmega2560.dict", "zboard=atmega2560.dict",
+      "auxboard=atmega2560.dict"], gen_infill),
+]
+
+
+######################################################################
+# Result extraction
+######################################################################
+
+class error(Exception):
+    pass
+
+PT_VLQ = msgproto.PT_uint32()
+
+# Count the queue_step messages (and steps) in a batch output file
+def count_steps(dict_fname, data_fname):
+    f = open(dict_fname, 'rb')
+    dictionary = f.read()
+    f.close()
+    mp = msgproto.MessageParser()
+    mp.process_identify(dictionary, decompress=False)
+    f = open(data_fname, 'rb')
+    data = bytearray(f.read())
+    f.close()
+    msgs = steps = 0
+    pos = 0
+    while pos < len(data):
+        l = mp.check_packet(data[pos:pos+msgproto.MESSAGE_MAX])
+        if l <= 0:
+            raise error("Invalid data in %s" % (data_fname,))
+        block = data[pos:pos+l]
+        mpos = msgproto.MESSAGE_HEADER_SIZE
+        while mpos < l - msgproto.MESSAGE_TRAILER_SIZE:
+            msgid, param_pos = mp.msgid_parser.parse(block, mpos)
+            mid = mp.messages_by_id.get(msgid, mp.unknown)
+            params, mpos = mid.parse(block, mpos)
+            if mid.name == 'queue_step':
+                msgs += 1
+                steps += params['count']
+            elif mid.name == 'queue_step_multi':
+                # Data contains a series of "interval, count, add" vlqs
+                msgs += 1
+                mdata = bytearray(params['data'])
+                dpos = 0
+                while dpos < len(mdata):
+                    interval, dpos = PT_VLQ.parse(mdata, dpos)
+                    count, dpos = PT_VLQ.parse(mdata, dpos)
+                    add, dpos = PT_VLQ.parse(mdata, dpos)
+                    steps += count
+        pos += l
+    return msgs, steps
+
+STATS_RE = re.compile(r"^  (?P<name>.*): count=(?P<count>\d+)"
+                      r" avg=(?P<avg>[0-9.e+-]+)")
+
+# Extract the final latency_stats report from the log
+def parse_latency(log_fname):
+    phases = {}
+    f = open(log_fname, 'r')
+    for line in f:
+        if line.startswith("Latency stats "):
+            phases = {}
+            continue
+        m = STATS_RE.match(line)
+        if m is not None:
+            count = int(m.group('count'))
+            phases[m.group('name')] = (count, count * float(m.group('avg')))
+    f.close()
+    return phases
+
+# Group per-stepper and per-mcu phases by subsystem
+def group_phases(phases):
+    res = {}
+    for name, (count, total) in phases.items():
+        group = name.split()[0]
+        pcount, ptotal = res.get(group, (0, 0.))
+        res[group] = (pcount + count, ptotal + total)
+    return res
+
+
+######################################################################
+# Benchmark runner
+######################################################################
+
+class Benchmark:
+    def __init__(self, name, config, dicts, gen, options):
+        self.name = name
+        self.config = os.path.join(BENCH_DIR, config)
+        self.dicts = dicts
+        self.gen = gen
+        self.options = options
+    def relpath(self, fname, rel='temp'):
+        if rel == 'dict':
+            return os.path.join(self.options.dictdir, fname)
+        return os.path.join(self.options.tempdir, fname)
+    def cleanup(self):
+        for fname in os.listdir(self.options.tempdir):
+            if fname.startswith(TEMP_OUTPUT_FILE):
+                os.unlink(self.relpath(fname))
+        for fname in [TEMP_GCODE_FILE, TEMP_LOG_FILE]:
+            if os.path.exists(self.relpath(fname)):
+                os.unlink(self.relpath(fname))
+    def run(self):
+        # Generate gcode
+        gcode = []
+        self.gen(gcode, self.options.scale)
+        gcode_fname = self.relpath(TEMP_GCODE_FILE)
+        f = open(gcode_fname, 'w')
+        f.write('\n'.join(gcode + ['']))
+        f.close()
+        # Run klippy in batch mode
+        output_fname = self.relpath(TEMP_OUTPUT_FILE)
+        log_fname = self.relpath(TEMP_LOG_FILE)
+        args = [sys.executable, './klippy/klippy.py', self.config,
+                '-i', gcode_fname, '-o', output_fname, '-l', log_fname]
+        outputs = []
+        for df in self.dicts:
+            if '=' in df:
+                mcu, fname = df.split('=', 1)
+                outputs.append((output_fname + '-' + mcu, self.relpath(
+                    fname, 'dict')))
+                args += ['-d', '%s=%s' % (mcu, self.relpath(fname, 'dict'))]
+            else:
+                outputs.append((output_fname, self.relpath(df, 'dict')))
+                args += ['-d', self.relpath(df, 'dict')]
+        sys.stderr.write("    Running %s (%s)\n" % (
+            self.name, os.path.basename(self.config)))
+        start_time = time.time()
+        proc = subprocess.Popen(args)
+        pid, status, rusage = os.wait4(proc.pid, 0)
+        wall_time = time.time() - start_time
+        if status:
+            f = open(log_fname, 'r')
+            sys.stdout.write(f.read())
+            f.close()
+            raise error("Error running benchmark %s" % (self.name,))
+        # Collect results
+        msgs = steps = 0
+        for data_fname, dict_fname in outputs:
+            m, s = count_steps(dict_fname, data_fname)
+            msgs += m
+            steps += s
+        phases = group_phases(parse_latency(log_fname))
+        if not self.options.keepfiles:
+            self.cleanup()
+        cpu_time = rusage.ru_utime + rusage.ru_stime
+        moves = phases.get('trapq_append', (0, 0.))[0]
+        renders, render_time = phases.get('gcode_macro_render', (0, 0.))
+        return {
+            'wall_time': wall_time, 'cpu_time': cpu_time,
+            'peak_rss_kb': rusage.ru_maxrss, 'moves': moves, 'steps': steps,
+            'queue_step_msgs': msgs, 'moves_per_sec': moves / cpu_time,
+            'steps_per_sec': steps / cpu_time,
+            'msgs_per_sec': msgs / cpu_time, 'macro_renders': renders,
+            'renders_per_sec': renders / render_time if render_time else 0.,
+            'phases': dict((n, t) for n, (c, t) in phases.items()),
+        }
+
+
+######################################################################
+# Reporting
+######################################################################
+
+def report(results):
+    sys.stdout.write("%-18s %8s %10s %11s %10s %8s\n" % (
+        "workload", "cpu(s)", "moves/s", "steps/s", "msgs/s", "rss(MB)"))
+    for name, r in results:
+        sys.stdout.write("%-18s %8.2f %10.0f %11.0f %10.0f %8.1f\n" % (
+            name, r['cpu_time'], r['moves_per_sec'], r['steps_per_sec'],
+            r['msgs_per_sec'], r['peak_rss_kb'] / 1024.))
+    renders = [(name, r) for name, r in results if r.get('macro_renders')]
+    if renders:
+        sys.stdout.write("\nG-Code macro template rendering:\n")
+        for name, r in renders:
+            sys.stdout.write("%s: renders=%d renders/s=%.0f\n" % (
+                name, r['macro_renders'], r['renders_per_sec']))
+    # Note that phases nest (lookahead_flush includes generate_steps and
+    # trapq_append); gcode_command only covers line parsing and dispatch
+    sys.stdout.write("\nCPU time per subsystem (seconds, % of total):\n")
+    for name, r in results:
+        parts = ["%s=%.3f(%.0f%%)" % (p, t, 100. * t / r['cpu_time'])
+                 for p, t in sorted(r['phases'].items())]
+        sys.stdout.write("%s:\n  %s\n" % (name, "\n  ".join(parts)))
+
+# Check results against a stored baseline - returns list of regressions
+def check_baseline(results, baseline, tolerance):
+    regressions = []
+    for name, r in results:
+        b = baseline.get(name)
+        if b is None:
+            continue
+        for field in ['moves_per_sec', 'steps_per_sec', 'renders_per_sec']:
+            if field not in b:
+                continue
+            if r[field] < b[field] * (1. - tolerance):
+                regressions.append("%s: %s %.0f < baseline %.0f" % (
+                    name, field, r[field], b[field]))
+        for field in ['queue_step_msgs', 'peak_rss_kb']:
+            if r[field] > b[field] * (1. + tolerance):
+                regressions.append("%s: %s %d > baseline %d" % (
+                    name, field, r[field], b[field]))
+    return regressions
+
+
+######################################################################
+# Startup
+######################################################################
+
+def main():
+    # Parse args
+    usage = "%prog [options] [<workload> ...]"
+    opts = optparse.OptionParser(usage)
+    opts.add_option("-d", "--dictdir", dest="dictdir", default=".",
+                    help="directory for dictionary files")
+    opts.add_option("-t", "--tempdir", dest="tempdir", default=".",
+                    help="directory for temporary files")
+    opts.add_option("-k", action="store_true", dest="keepfiles",
+                    help="do not remove temporary files")
+    opts.add_option("-s", "--scale", type="float", dest="scale", default=1.,
+                    help="multiply the size of each workload")
+    opts.add_option("-o", "--output", dest="output",
+                    help="store results (as a baseline) in a json file")
+    opts.add_option("-b", "--baseline", dest="baseline",
+                    help="compare results to a baseline json file")
+    opts.add_option("--tolerance", type="float", dest="tolerance",
+                    default=.10, help="allowed regression from baseline")
+    opts.add_option("-l", "--list", action="store_true", dest="list",
+                    help="list the available workloads")
+    options, args = opts.parse_args()
+    if options.list:
+        for name, config, dicts, gen in WORKLOADS:
+            sys.stdout.write("%s (%s)\n" % (name, config))
+        return
+    workloads = WORKLOADS
+    if args:
+        workloads = [w for w in WORKLOADS if w[0] in args]
+        if len(workloads) != len(args):
+            opts.error("Unknown workload")
+
+    # Run each benchmark
+    results = []
+    for name, config, dicts, gen in workloads:
+        bench = Benchmark(name, config, dicts, gen, options)
+        try:
+            results.append((name, bench.run()))
+        except error as e:
+            sys.stderr.write("\n\nBenchmark %s FAILED (%s)!\n\n" % (name, e))
+            sys.exit(-1)
+    sys.stderr.write("\n")
+    report(results)
+
+    # Store and compare baselines
+    if options.output:
+        f = open(options.output, 'w')
+        json.dump(dict(results), f, indent=2, sort_keys=True)
+        f.close()
+    if options.baseline:
+        f = open(options.baseline, 'r')
+        baseline = json.load(f)
+        f.close()
+        regressions = check_baseline(results, baseline, options.tolerance)
+        if regressions:
+            sys.stdout.write("\nRegressions found:\n  %s\n" % (
+                "\n  ".join(regressions),))
+            sys.exit(-1)
+        sys.stdout.write("\nNo regressions found\n")
+
+if __name__ == '__main__':
+    main()
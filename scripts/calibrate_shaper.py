@@ -6,16 +6,21 @@
 #
 # This file may be distributed under the terms of the GNU GPLv3 license.
 from __future__ import print_function
-import importlib, optparse, os, sys
+import importlib, optparse, os, sys, time
 from textwrap import wrap
 import numpy as np, matplotlib
 sys.path.append(os.path.join(os.path.dirname(os.path.realpath(__file__)),
                              '..', 'klippy'))
 shaper_calibrate = importlib.import_module('.shaper_calibrate', 'extras')
+bulk_sensor = importlib.import_module('.bulk_sensor', 'extras')
 
 MAX_TITLE_LENGTH=65
 
 def parse_log(logname):
+    if bulk_sensor.is_capture_file(logname):
+        # Raw accelerometer data in binary capture format
+        header, blocks = bulk_sensor.read_capture(logname, np)
+        return bulk_sensor.capture_to_array(header, blocks, np)
     with open(logname) as f:
         for header in f:
             if not header.startswith('#'):
@@ -71,6 +76,34 @@ def calibrate_shaper(datas, csv_output, *, shapers, damping_ratio, scv,
                 csv_output, calibration_data, all_shapers)
     return shaper.name, all_shapers, calibration_data
 
+# Measure the time taken by the frequency response calculation and the
+# shaper fitting (both sequentially and using all available cpus)
+def benchmark(datas, iterations, *, shapers, damping_ratio, scv,
+              shaper_freqs, max_smoothing, test_damping_ratios, max_freq):
+    helper = shaper_calibrate.ShaperCalibrate(printer=None)
+    if isinstance(datas[0], shaper_calibrate.CalibrationData):
+        calibration_data = datas[0]
+    else:
+        start_time = time.time()
+        for i in range(iterations):
+            calibration_data = helper.process_accelerometer_data(datas[0])
+        print("Frequency response calculation: %.3fs" % (
+            (time.time() - start_time) / iterations,))
+        calibration_data.normalize_to_frequencies()
+    max_workers = helper.max_workers
+    for workers in sorted(set([1, max_workers])):
+        helper.max_workers = workers
+        start_time = time.time()
+        for i in range(iterations):
+            helper.find_best_shaper(
+                    calibration_data, shapers=shapers,
+                    damping_ratio=damping_ratio, scv=scv,
+                    shaper_freqs=shaper_freqs, max_smoothing=max_smoothing,
+                    test_damping_ratios=test_damping_ratios,
+                    max_freq=max_freq)
+        print("Shaper fitting (max_workers=%d): %.3fs" % (
+            workers, (time.time() - start_time) / iterations))
+
 ######################################################################
 # Plot frequency response and suggested input shapers
 ######################################################################
@@ -168,6 +201,9 @@ def main():
                     dest="test_damping_ratios", default=None,
                     help="a comma-separated liat of damping ratios to test " +
                     "input shaper for")
+    opts.add_option("--benchmark", type="int", dest="benchmark",
+                    default=None, help="report the calculation time (averaged"
+                    " over the given number of runs) instead of calibrating")
     options, args = opts.parse_args()
     if len(args) < 1:
         opts.error("Incorrect number of arguments")
@@ -222,6 +258,14 @@ def main():
     # Parse data
     datas = [parse_log(fn) for fn in args]
 
+    if options.benchmark is not None:
+        benchmark(datas, max(1, options.benchmark), shapers=shapers,
+                  damping_ratio=options.damping_ratio, scv=options.scv,
+                  shaper_freqs=shaper_freqs,
+                  max_smoothing=options.max_smoothing,
+                  test_damping_ratios=test_damping_ratios, max_freq=max_freq)
+        return
+
     # Calibrate shaper and generate outputs
     selected_shaper, shapers, calibration_data = calibrate_shaper(
             datas, options.csv, shapers=shapers,
@@ -58,6 +58,9 @@ for TARGET in test/configs/*.config ; do
     size out/*.elf
     finish_test mcu_compile "$TARGET"
     cp out/klipper.dict ${DICTDIR}/$(basename ${TARGET} .config).dict
+    if [ "$(basename ${TARGET})" = "hostsimulator.config" ]; then
+        cp out/klipper.elf ${BUILD_DIR}/hostsimulator.elf
+    fi
 done
 
 
@@ -73,6 +76,14 @@ start_test klippy "Test klippy import (Python2)"
 $PYTHON2 klippy/klippy.py --import-test
 finish_test klippy "Test klippy import (Python2)"
 
+start_test klippy "Test reactor timers (Python3)"
+$PYTHON scripts/test_reactor.py
+finish_test klippy "Test reactor timers (Python3)"
+
+start_test klippy "Test mcu heater control (Python3)"
+$PYTHON scripts/test_heater_control.py ${BUILD_DIR}/hostsimulator.elf
+finish_test klippy "Test mcu heater control (Python3)"
+
 start_test klippy "Test invoke klippy (Python3)"
 $PYTHON scripts/test_klippy.py -d ${DICTDIR} test/klippy/*.test
 finish_test klippy "Test invoke klippy (Python3)"
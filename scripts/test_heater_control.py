@@ -0,0 +1,212 @@
+# End-to-end test of micro-controller based heater control
+#
+# Copyright (C) 2026  agent <agent@local>
+#
+# This file may be distributed under the terms of the GNU GPLv3 license.
+#
+# This runs the host simulator firmware (built from
+# test/configs/hostsimulator.config) along with klippy.  The simulator
+# models a heater on gpio0 whose temperature is reported on the adc of
+# gpio8 (and similarly gpio1 and gpio9).  The test checks that the
+# control loop running on the micro-controller reaches and holds the
+# requested temperatures.
+import sys, os, optparse, subprocess, tempfile, shutil, socket, json
+import time, tty, logging
+
+KLIPPY_DIR = os.path.join(os.path.dirname(__file__), '../klippy')
+
+CONFIG = """
+[mcu]
+serial: %s
+restart_method: command
+
+[printer]
+kinematics: none
+max_velocity: 1
+max_accel: 1
+
+# The simulator adc reports 10 units per degree Celsius
+[adc_temperature sim_adc]
+temperature1: 0
+voltage1: 0
+temperature2: 409.5
+voltage2: 5.0
+
+[heater_generic sim_pid]
+heater_pin: gpio0
+sensor_type: sim_adc
+sensor_pin: gpio8
+control: pid
+pid_Kp: 10
+pid_Ki: 0.5
+pid_Kd: 20
+mcu_control: True
+min_temp: 0
+max_temp: 300
+
+[heater_generic sim_watermark]
+heater_pin: gpio1
+sensor_type: sim_adc
+sensor_pin: gpio9
+control: watermark
+mcu_control: True
+mcu_control_time: 0.050
+min_temp: 0
+max_temp: 300
+"""
+
+class error(Exception):
+    pass
+
+def check(cond, msg):
+    if not cond:
+        raise error(msg)
+
+# Minimal client for the klippy api server
+class APIClient:
+    def __init__(self, sock_path, timeout):
+        end_time = time.time() + timeout
+        while 1:
+            try:
+                self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+                self.sock.connect(sock_path)
+                break
+            except socket.error:
+                self.sock.close()
+                if time.time() > end_time:
+                    raise error("Unable to connect to klippy api server")
+                time.sleep(.1)
+        self.sock.settimeout(timeout)
+        self.next_id = 1
+        self.data = b""
+    def send(self, method, params={}):
+        req_id = self.next_id
+        self.next_id += 1
+        msg = {"id": req_id, "method": method, "params": params}
+        self.sock.sendall(json.dumps(msg).encode() + b"\x03")
+        while 1:
+            while b"\x03" not in self.data:
+                data = self.sock.recv(4096)
+                if not data:
+                    raise error("klippy api server disconnected")
+                self.data += data
+            line, self.data = self.data.split(b"\x03", 1)
+            resp = json.loads(line)
+            if resp.get("id") != req_id:
+                continue
+            if "error" in resp:
+                raise error("api error: %s" % (resp["error"],))
+            return resp["result"]
+    def wait_ready(self, timeout):
+        end_time = time.time() + timeout
+        while 1:
+            state = self.send("info")["state"]
+            if state == "ready":
+                return
+            check(state != "shutdown", "klippy shutdown on startup")
+            check(time.time() < end_time, "klippy not ready (%s)" % (state,))
+            time.sleep(.5)
+    def get_heaters(self, names):
+        objs = dict([(n, ["temperature", "target", "power"]) for n in names])
+        result = self.send("objects/query", {"objects": objs})
+        return result["status"]
+    def gcode(self, script):
+        self.send("gcode/script", {"script": script})
+
+def wait_heaters(client, targets, tolerance, timeout):
+    # Wait for all heaters to be within 'tolerance' of their target
+    end_time = time.time() + timeout
+    while 1:
+        status = client.get_heaters(list(targets.keys()))
+        if all([abs(status[n]["temperature"] - t) <= tolerance
+                for n, t in targets.items()]):
+            return
+        check(time.time() < end_time, "heaters did not reach target %s"
+              % (status,))
+        time.sleep(.5)
+
+def check_heaters(client, targets, tolerance, duration):
+    # Check that all heaters stay within 'tolerance' of their target
+    end_time = time.time() + duration
+    while time.time() < end_time:
+        status = client.get_heaters(list(targets.keys()))
+        for n, t in targets.items():
+            check(abs(status[n]["temperature"] - t) <= tolerance,
+                  "heater %s not holding target %s" % (n, status))
+        time.sleep(.5)
+    # The pid heater should hold the temperature with partial power
+    status = client.get_heaters(["heater_generic sim_pid"])
+    check(0. < status["heater_generic sim_pid"]["power"] < 1.,
+          "unexpected pid heater power %s" % (status,))
+
+def run_test(client):
+    client.wait_ready(30.)
+    names = ["heater_generic sim_pid", "heater_generic sim_watermark"]
+    # Wait for the first temperature reports (at the ambient temperature)
+    wait_heaters(client, {names[0]: 25., names[1]: 25.}, 2., 5.)
+    # Heat up and hold the target temperatures
+    targets = {names[0]: 80., names[1]: 60.}
+    client.gcode("SET_HEATER_TEMPERATURE HEATER=sim_pid TARGET=80\n"
+                 "SET_HEATER_TEMPERATURE HEATER=sim_watermark TARGET=60")
+    wait_heaters(client, targets, 2., 30.)
+    check_heaters(client, targets, 3., 5.)
+    # Change target while heating
+    targets[names[0]] = 100.
+    client.gcode("SET_HEATER_TEMPERATURE HEATER=sim_pid TARGET=100")
+    wait_heaters(client, targets, 2., 30.)
+    check_heaters(client, targets, 3., 5.)
+    # Turn off the heaters and check that they cool down
+    client.gcode("TURN_OFF_HEATERS")
+    time.sleep(3.)
+    status = client.get_heaters(names)
+    for n in names:
+        check(status[n]["power"] == 0., "heater %s still on %s" % (n, status))
+        check(status[n]["temperature"] < targets[n] - 5.,
+              "heater %s not cooling %s" % (n, status))
+    check(client.send("info")["state"] == "ready", "klippy not ready")
+
+def main():
+    usage = "%prog [options] <simulator elf>"
+    opts = optparse.OptionParser(usage)
+    opts.add_option("-k", "--keep", action="store_true",
+                    help="do not remove temporary files")
+    options, args = opts.parse_args()
+    if len(args) != 1:
+        opts.error("Incorrect number of arguments")
+    elf = args[0]
+    logging.basicConfig(level=logging.INFO)
+    tmpdir = tempfile.mkdtemp(prefix="heater_control_")
+    procs = []
+    try:
+        # Run the simulator on a pseudo-tty
+        master, slave = os.openpty()
+        tty.setraw(slave)
+        procs.append(subprocess.Popen([elf], stdin=master, stdout=master))
+        cfg_path = os.path.join(tmpdir, "printer.cfg")
+        with open(cfg_path, "w") as f:
+            f.write(CONFIG % (os.ttyname(slave),))
+        # Start klippy with an api server
+        sock_path = os.path.join(tmpdir, "klippy_uds")
+        log_path = os.path.join(tmpdir, "klippy.log")
+        procs.append(subprocess.Popen(
+            [sys.executable, os.path.join(KLIPPY_DIR, "klippy.py"), cfg_path,
+             "-a", sock_path, "-l", log_path]))
+        client = APIClient(sock_path, 30.)
+        try:
+            run_test(client)
+        except error:
+            if os.path.exists(log_path):
+                logging.info("klippy log:\n%s", open(log_path).read())
+            raise
+    finally:
+        for p in reversed(procs):
+            p.terminate()
+            p.wait()
+        if options.keep:
+            logging.info("Temporary files in %s", tmpdir)
+        else:
+            shutil.rmtree(tmpdir)
+    logging.info("Heater control test passed")
+
+if __name__ == '__main__':
+    main()
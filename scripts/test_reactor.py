@@ -0,0 +1,102 @@
+# Regression tests for the reactor timer dispatch code
+#
+# Copyright (C) 2026  agent <agent@local>
+#
+# This file may be distributed under the terms of the GNU GPLv3 license.
+import sys, os, logging
+sys.path.append(os.path.join(os.path.dirname(__file__), '../klippy'))
+import reactor
+
+class error(Exception):
+    pass
+
+def check(cond, msg):
+    if not cond:
+        raise error(msg)
+
+# Run the reactor until 'duration' seconds have passed
+def run_reactor(r, duration):
+    def end_event(eventtime):
+        r.end()
+        return r.NEVER
+    r.register_timer(end_event, r.monotonic() + duration)
+    r.run()
+
+# A callback that churns many timers (forcing heap compaction) while
+# other timers are due in the same dispatch pass
+def test_churn_during_dispatch():
+    r = reactor.Reactor()
+    counts = {}
+    def make_once(name):
+        def callback(eventtime):
+            counts[name] = counts.get(name, 0) + 1
+            return r.NEVER
+        return callback
+    now = r.monotonic()
+    others = []
+    def churn(eventtime):
+        counts['churn'] = counts.get('churn', 0) + 1
+        t = r.register_timer(make_once('x'), r.NEVER)
+        for i in range(200):
+            r.update_timer(t, eventtime + 10. + i)
+        r.unregister_timer(t)
+        for t in others[5:]:
+            r.update_timer(t, eventtime + 10.)
+            r.update_timer(t, eventtime)
+        return r.NEVER
+    r.register_timer(churn, now + .010)
+    others.extend([r.register_timer(make_once('other%d' % (i,)), now + .010)
+                   for i in range(10)])
+    b = r.register_timer(make_once('b'), now + .010)
+    run_reactor(r, .100)
+    check(counts.get('churn') == 1, "churn count %s" % (counts,))
+    check(counts.get('b') == 1, "timer b run count %s" % (counts,))
+    for i in range(10):
+        check(counts.get('other%d' % (i,)) == 1,
+              "timer other%d run count %s" % (i, counts))
+    check('x' not in counts, "unregistered timer ran %s" % (counts,))
+
+# A callback that deletes and reschedules other pending timers
+def test_delete_reschedule_during_dispatch():
+    r = reactor.Reactor()
+    counts = {}
+    timers = {}
+    def make_counter(name, ret_delay=None):
+        def callback(eventtime):
+            counts[name] = counts.get(name, 0) + 1
+            if ret_delay is None:
+                return r.NEVER
+            return eventtime + ret_delay
+        return callback
+    now = r.monotonic()
+    def first(eventtime):
+        counts['first'] = counts.get('first', 0) + 1
+        r.unregister_timer(timers['deleted'])
+        r.update_timer(timers['moved'], eventtime + .030)
+        r.update_timer(timers['early'], eventtime)
+        return r.NEVER
+    timers['first'] = r.register_timer(first, now + .005)
+    timers['deleted'] = r.register_timer(make_counter('deleted'), now + .005)
+    timers['moved'] = r.register_timer(make_counter('moved'), now + .005)
+    timers['early'] = r.register_timer(make_counter('early'), now + .050)
+    timers['periodic'] = r.register_timer(make_counter('periodic', .010),
+                                          now + .005)
+    run_reactor(r, .100)
+    check(counts.get('first') == 1, "first count %s" % (counts,))
+    check('deleted' not in counts, "deleted timer ran %s" % (counts,))
+    check(counts.get('moved') == 1, "moved count %s" % (counts,))
+    check(counts.get('early') == 1, "early count %s" % (counts,))
+    check(5 <= counts.get('periodic', 0) <= 11,
+          "periodic count %s" % (counts,))
+
+TESTS = [test_churn_during_dispatch, test_delete_reschedule_during_dispatch]
+
+def main():
+    logging.basicConfig(level=logging.INFO)
+    for test in TESTS:
+        logging.info("Running %s", test.__name__)
+        test()
+    logging.info("All %d reactor tests passed", len(TESTS))
+
+if __name__ == '__main__':
+    main()
@@ -4,6 +4,7 @@
 //
 // This file may be distributed under the terms of the GNU GPLv3 license.
 
+#include "adccmds.h" // analog_in_set_handler
 #include "basecmd.h" // oid_alloc
 #include "board/gpio.h" // struct gpio_adc
 #include "board/irq.h" // irq_disable
@@ -12,6 +13,7 @@
 
 struct analog_in {
     struct timer timer;
+    struct analog_in_handler *handler;
     uint32_t rest_time, sample_time, next_begin_time;
     uint16_t value, min_value, max_value;
     struct gpio_adc pin;
@@ -52,7 +54,13 @@ analog_in_event(struct timer *timer)
             a->invalid_count = 0;
         }
     }
-    sched_wake_task(&analog_wake);
+    if (a->handler) {
+        // Measurement is consumed locally instead of reported to host
+        a->handler->func(a->handler, a->next_begin_time, a->value);
+        a->state++;
+    } else {
+        sched_wake_task(&analog_wake);
+    }
     a->next_begin_time += a->rest_time;
     a->timer.waketime = a->next_begin_time;
     return SF_RESCHEDULE;
@@ -93,6 +101,14 @@ DECL_COMMAND(command_query_analog_in,
              "query_analog_in oid=%c clock=%u sample_ticks=%u sample_count=%c"
              " rest_ticks=%u min_value=%hu max_value=%hu range_check_count=%c");
 
+// Forward measurements to another mcu module (called during config)
+void
+analog_in_set_handler(uint8_t oid, struct analog_in_handler *h)
+{
+    struct analog_in *a = oid_lookup(oid, command_config_analog_in);
+    a->handler = h;
+}
+
 void
 analog_in_task(void)
 {
@@ -0,0 +1,13 @@
+#ifndef __ADCCMDS_H
+#define __ADCCMDS_H
+
+#include <stdint.h> // uint16_t
+
+struct analog_in_handler {
+    void (*func)(struct analog_in_handler *h, uint32_t sample_time
+                 , uint16_t value);
+};
+
+void analog_in_set_handler(uint8_t oid, struct analog_in_handler *h);
+
+#endif // adccmds.h
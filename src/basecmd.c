@@ -5,6 +5,7 @@
 // This file may be distributed under the terms of the GNU GPLv3 license.
 
 #include <string.h> // memset
+#include "autoconf.h" // CONFIG_WANT_PROFILE
 #include "basecmd.h" // oid_lookup
 #include "board/irq.h" // irq_save
 #include "board/misc.h" // alloc_maxsize
@@ -60,7 +61,7 @@ alloc_chunks(size_t size, size_t count, uint16_t *avail)
 
 static struct move_node *move_free_list;
 static void *move_list;
-static uint16_t move_count;
+static uint16_t move_count, move_used, move_peak;
 static uint8_t move_item_size;
 
 // Is the config and move queue finalized?
@@ -78,6 +79,8 @@ move_free(void *m)
     struct move_node *mf = m;
     mf->next = move_free_list;
     move_free_list = mf;
+    if (CONFIG_WANT_PROFILE)
+        move_used--;
 }
 
 // Allocate runtime storage
@@ -89,10 +92,24 @@ move_alloc(void)
     if (!mf)
         shutdown("Move queue overflow");
     move_free_list = mf->next;
+    if (CONFIG_WANT_PROFILE && ++move_used > move_peak)
+        move_peak = move_used;
     irq_restore(flag);
     return mf;
 }
 
+// Report the peak number of allocated moves (profiling builds only)
+uint16_t
+move_queue_peak(uint_fast8_t reset)
+{
+    irqstatus_t flag = irq_save();
+    uint16_t peak = move_peak;
+    if (reset)
+        move_peak = move_used;
+    irq_restore(flag);
+    return peak;
+}
+
 // Check if a move_queue is empty
 int
 move_queue_empty(struct move_queue_head *mh)
@@ -163,6 +180,7 @@ move_reset(void)
     struct move_node *mf = move_list + (move_count - 1)*move_item_size;
     mf->next = NULL;
     move_free_list = move_list;
+    move_used = 0;
 }
 DECL_SHUTDOWN(move_reset);
 
@@ -173,7 +191,9 @@ move_finalize(void)
         shutdown("Already finalized");
     struct move_queue_head dummy;
     move_queue_setup(&dummy, sizeof(*move_free_list));
-    move_list = alloc_chunks(move_item_size, 1024, &move_count);
+    // Use all remaining memory for the move queue (up to the maximum
+    // that can be reported to the host)
+    move_list = alloc_chunks(move_item_size, UINT16_MAX, &move_count);
     move_reset();
 }
 
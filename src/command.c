@@ -6,11 +6,13 @@
 
 #include <stdarg.h> // va_start
 #include <string.h> // memcpy
+#include "autoconf.h" // CONFIG_WANT_PROFILE
 #include "board/io.h" // readb
 #include "board/irq.h" // irq_poll
 #include "board/misc.h" // crc16_ccitt
 #include "board/pgm.h" // READP
 #include "command.h" // output_P
+#include "profile.h" // profile_command_end
 #include "sched.h" // sched_is_shutdown
 
 static uint8_t next_sequence = MESSAGE_DEST;
@@ -54,8 +56,8 @@ f4: *p++ = v & 0x7f;
 }
 
 // Parse an integer that was encoded as a "variable length quantity"
-static uint32_t
-parse_int(uint8_t **pp)
+uint32_t
+command_parse_int(uint8_t **pp)
 {
     uint8_t *p = *pp, c = *p++;
     uint32_t v = c & 0x7f;
@@ -109,7 +111,7 @@ command_parsef(uint8_t *p, uint8_t *maxend
         case PT_uint16:
         case PT_int16:
         case PT_byte:
-            *args++ = parse_int(&p);
+            *args++ = command_parse_int(&p);
             break;
         case PT_buffer: {
             uint_fast8_t len = *p++;
@@ -341,6 +343,12 @@ command_dispatch(uint8_t *buf, uint_fast8_t msglen)
         }
         irq_poll();
         void (*func)(uint32_t*) = READP(cp->func);
+        if (CONFIG_WANT_PROFILE) {
+            uint32_t start = timer_read_time();
+            func(args);
+            profile_command_end(cmdid, start);
+            continue;
+        }
         func(args);
     }
 }
@@ -0,0 +1,310 @@
+// Closed loop heater temperature control on the micro-controller
+//
+// Copyright (C) 2026  agent <agent@local>
+//
+// This file may be distributed under the terms of the GNU GPLv3 license.
+
+#include "adccmds.h" // analog_in_set_handler
+#include "basecmd.h" // oid_alloc
+#include "board/gpio.h" // struct gpio_out
+#include "board/irq.h" // irq_disable
+#include "board/misc.h" // timer_is_before
+#include "command.h" // DECL_COMMAND
+#include "sched.h" // sched_add_timer
+
+// The heater is controlled by the measurements of an analog_in
+// sensor.  The host provides a table to convert adc readings to
+// temperature (in hundredths of a degree), the control gains, and
+// the target temperature.  Output values are fixed point with
+// 1<<16 representing a fully enabled heater.
+
+#define VALUE_SHIFT 16
+#define DERIV_SHIFT 8
+
+struct heater_table_entry {
+    uint16_t adc;
+    int32_t temp;
+};
+
+struct heater_control {
+    struct timer timer;
+    struct analog_in_handler handler;
+    struct gpio_out pin;
+    uint32_t cycle_time, on_duration, next_on_duration;
+    uint32_t max_duration, end_time;
+    // Measurement from adc handler
+    uint32_t sample_time;
+    uint16_t sample_value;
+    uint8_t flags, mode, control_flags;
+    // Conversion table
+    uint8_t table_size;
+    struct heater_table_entry *table;
+    // Control parameters
+    int32_t kp, ki, kd, integ_max, max_delta, target;
+    uint32_t deriv_alpha, max_value, direct_value;
+    uint8_t gain_shift;
+    // Control state
+    int32_t prev_temp, deriv, integ;
+    uint32_t value_sum;
+    uint8_t report_count, report_pos;
+};
+
+enum {
+    HF_INVERT=1<<0, HF_SAMPLE_PENDING=1<<1, HF_ACTIVE=1<<2, HF_CHECK_END=1<<3,
+};
+
+enum { HC_HAVE_TEMP=1<<0, HC_HEATING=1<<1 };
+
+enum { HM_OFF, HM_PID, HM_WATERMARK, HM_DIRECT };
+
+static struct task_wake heater_control_wake;
+
+static uint_fast8_t heater_cycle_event(struct timer *timer);
+
+// Software PWM "off" event
+static uint_fast8_t
+heater_off_event(struct timer *timer)
+{
+    struct heater_control *hc = container_of(
+        timer, struct heater_control, timer);
+    gpio_out_write(hc->pin, !!(hc->flags & HF_INVERT));
+    hc->timer.func = heater_cycle_event;
+    hc->timer.waketime += hc->cycle_time - hc->on_duration;
+    return SF_RESCHEDULE;
+}
+
+// Start of a software PWM cycle
+static uint_fast8_t
+heater_cycle_event(struct timer *timer)
+{
+    struct heater_control *hc = container_of(
+        timer, struct heater_control, timer);
+    uint32_t on_duration = hc->next_on_duration;
+    if (on_duration && hc->flags & HF_CHECK_END
+        && !timer_is_before(hc->timer.waketime, hc->end_time))
+        shutdown("Missed heater control update");
+    hc->on_duration = on_duration;
+    uint8_t on = !!on_duration;
+    gpio_out_write(hc->pin, on ^ !!(hc->flags & HF_INVERT));
+    if (on && on_duration < hc->cycle_time) {
+        hc->timer.func = heater_off_event;
+        hc->timer.waketime += on_duration;
+    } else {
+        hc->timer.waketime += hc->cycle_time;
+    }
+    return SF_RESCHEDULE;
+}
+
+// Note a new measurement from the analog_in module (timer context)
+static void
+heater_adc_handler(struct analog_in_handler *h, uint32_t sample_time
+                   , uint16_t value)
+{
+    struct heater_control *hc = container_of(
+        h, struct heater_control, handler);
+    hc->sample_time = sample_time;
+    hc->sample_value = value;
+    hc->flags |= HF_SAMPLE_PENDING;
+    sched_wake_task(&heater_control_wake);
+}
+
+void
+command_config_heater_control(uint32_t *args)
+{
+    struct heater_control *hc = oid_alloc(
+        args[0], command_config_heater_control, sizeof(*hc));
+    uint8_t invert = !!args[3];
+    hc->pin = gpio_out_setup(args[2], invert);
+    hc->flags = invert ? HF_INVERT : 0;
+    hc->cycle_time = args[4];
+    hc->max_duration = args[5];
+    hc->report_count = args[6];
+    hc->table_size = args[7];
+    hc->table = alloc_chunk(sizeof(hc->table[0]) * hc->table_size);
+    hc->timer.func = heater_cycle_event;
+    hc->handler.func = heater_adc_handler;
+    analog_in_set_handler(args[1], &hc->handler);
+}
+DECL_COMMAND(command_config_heater_control,
+             "config_heater_control oid=%c adc_oid=%c pin=%u invert=%c"
+             " cycle_ticks=%u max_duration=%u report_count=%c table_size=%c");
+
+void
+command_heater_control_set_table(uint32_t *args)
+{
+    struct heater_control *hc = oid_lookup(
+        args[0], command_config_heater_control);
+    uint8_t pos = args[1];
+    if (pos >= hc->table_size)
+        shutdown("Invalid heater control table position");
+    hc->table[pos].adc = args[2];
+    hc->table[pos].temp = args[3];
+}
+DECL_COMMAND(command_heater_control_set_table,
+             "heater_control_set_table oid=%c pos=%c adc=%hu temp=%i");
+
+void
+command_heater_control_setup(uint32_t *args)
+{
+    struct heater_control *hc = oid_lookup(
+        args[0], command_config_heater_control);
+    hc->kp = args[1];
+    hc->ki = args[2];
+    hc->kd = args[3];
+    hc->gain_shift = args[4];
+    hc->integ_max = args[5];
+    hc->deriv_alpha = args[6];
+    hc->max_delta = args[7];
+    hc->max_value = args[8];
+}
+DECL_COMMAND(command_heater_control_setup,
+             "heater_control_setup oid=%c kp=%i ki=%i kd=%i gain_shift=%c"
+             " integ_max=%i deriv_alpha=%u max_delta=%i max_value=%u");
+
+void
+command_heater_control_update(uint32_t *args)
+{
+    struct heater_control *hc = oid_lookup(
+        args[0], command_config_heater_control);
+    uint8_t mode = args[1];
+    if (mode > HM_DIRECT)
+        shutdown("Invalid heater control mode");
+    if (mode != hc->mode)
+        // Restart the control algorithm on a mode change
+        hc->integ = 0;
+    hc->mode = mode;
+    hc->target = args[2];
+    hc->direct_value = args[3] > hc->max_value ? hc->max_value : args[3];
+    uint32_t curtime = timer_read_time();
+    irq_disable();
+    if (hc->max_duration) {
+        hc->end_time = curtime + hc->max_duration;
+        hc->flags |= HF_CHECK_END;
+    }
+    if (!(hc->flags & HF_ACTIVE)) {
+        hc->flags |= HF_ACTIVE;
+        hc->timer.waketime = curtime + hc->cycle_time;
+        sched_add_timer(&hc->timer);
+    }
+    irq_enable();
+}
+DECL_COMMAND(command_heater_control_update,
+             "heater_control_update oid=%c mode=%c target=%i value=%u");
+
+// Convert an adc reading to a temperature using the lookup table
+static int32_t
+calc_temp(struct heater_control *hc, uint16_t adc)
+{
+    struct heater_table_entry *t = hc->table;
+    uint_fast8_t i, size = hc->table_size;
+    if (!size)
+        return 0;
+    if (adc <= t[0].adc)
+        return t[0].temp;
+    for (i = 1; i < size; i++) {
+        if (adc <= t[i].adc) {
+            int32_t adc_diff = t[i].adc - t[i-1].adc;
+            int32_t temp_diff = t[i].temp - t[i-1].temp;
+            return (t[i-1].temp + (int32_t)((int64_t)temp_diff
+                                            * (adc - t[i-1].adc) / adc_diff));
+        }
+    }
+    return t[size-1].temp;
+}
+
+// Determine the next heater output value from a new temperature
+static uint32_t
+calc_value(struct heater_control *hc, int32_t temp)
+{
+    // Track the rate of change of temperature (per sample)
+    if (!(hc->control_flags & HC_HAVE_TEMP)) {
+        hc->control_flags |= HC_HAVE_TEMP;
+        hc->prev_temp = temp;
+    }
+    int32_t temp_diff = (temp - hc->prev_temp) << DERIV_SHIFT;
+    hc->deriv += ((int64_t)(temp_diff - hc->deriv) * hc->deriv_alpha
+                  >> VALUE_SHIFT);
+    hc->prev_temp = temp;
+
+    switch (hc->mode) {
+    case HM_PID: {
+        int32_t err = hc->target - temp;
+        int32_t integ = hc->integ + err;
+        if (integ < 0)
+            integ = 0;
+        else if (integ > hc->integ_max)
+            integ = hc->integ_max;
+        int64_t co = ((int64_t)hc->kp * err + (int64_t)hc->ki * integ
+                      - (int64_t)hc->kd * hc->deriv) >> hc->gain_shift;
+        if (co < 0)
+            return 0;
+        if (co > hc->max_value)
+            return hc->max_value;
+        hc->integ = integ;
+        return co;
+    }
+    case HM_WATERMARK:
+        if (hc->control_flags & HC_HEATING
+            && temp >= hc->target + hc->max_delta)
+            hc->control_flags &= ~HC_HEATING;
+        else if (!(hc->control_flags & HC_HEATING)
+                 && temp <= hc->target - hc->max_delta)
+            hc->control_flags |= HC_HEATING;
+        return hc->control_flags & HC_HEATING ? hc->max_value : 0;
+    case HM_DIRECT:
+        return hc->direct_value;
+    }
+    return 0;
+}
+
+void
+heater_control_task(void)
+{
+    if (!sched_check_wake(&heater_control_wake))
+        return;
+    uint8_t oid;
+    struct heater_control *hc;
+    foreach_oid(oid, hc, command_config_heater_control) {
+        if (!(hc->flags & HF_SAMPLE_PENDING))
+            continue;
+        irq_disable();
+        uint32_t sample_time = hc->sample_time;
+        uint16_t sample_value = hc->sample_value;
+        hc->flags &= ~HF_SAMPLE_PENDING;
+        irq_enable();
+
+        int32_t temp = calc_temp(hc, sample_value);
+        uint32_t value = calc_value(hc, temp);
+        uint32_t on_duration = ((uint64_t)value * hc->cycle_time
+                                >> VALUE_SHIFT);
+        if (!(hc->flags & HF_ACTIVE))
+            on_duration = 0;
+        irq_disable();
+        hc->next_on_duration = on_duration;
+        irq_enable();
+
+        // Periodically report the state to the host
+        hc->value_sum += value;
+        if (++hc->report_pos < hc->report_count)
+            continue;
+        uint32_t avg_value = hc->value_sum / hc->report_pos;
+        hc->value_sum = hc->report_pos = 0;
+        sendf("heater_control_state oid=%c clock=%u temp=%i deriv=%i"
+              " value=%u", oid, sample_time, temp, hc->deriv, avg_value);
+    }
+}
+DECL_TASK(heater_control_task);
+
+void
+heater_control_shutdown(void)
+{
+    uint8_t i;
+    struct heater_control *hc;
+    foreach_oid(i, hc, command_config_heater_control) {
+        gpio_out_write(hc->pin, !!(hc->flags & HF_INVERT));
+        hc->flags &= ~HF_ACTIVE;
+        hc->mode = HM_OFF;
+        hc->next_on_duration = hc->on_duration = 0;
+    }
+}
+DECL_SHUTDOWN(heater_control_shutdown);
@@ -4,6 +4,7 @@
 //
 // This file may be distributed under the terms of the GNU GPLv3 license.
 
+#include <string.h> // memcpy
 #include "autoconf.h" // CONFIG_MACH_AVR
 #include "basecmd.h" // oid_alloc
 #include "board/gpio.h" // gpio_out_write
@@ -12,12 +13,24 @@
 #include "command.h" // DECL_COMMAND
 #include "sched.h" // DECL_SHUTDOWN
 
+// Updates may be queued for transmission in the background.  The
+// queue holds a series of segments - each starting with a header byte
+// containing the segment length and a flag indicating data or command
+// bytes.
+#define QUEUE_SIZE 128
+#define SEG_DATA 0x80
+#define SEG_LEN_MASK 0x7f
+
 struct hd44780 {
     uint32_t last_cmd_time, cmd_wait_ticks;
     uint8_t last;
     struct gpio_out rs, e, d4, d5, d6, d7;
+    uint8_t queue_pos, queue_count, seg_remaining;
+    uint8_t queue[QUEUE_SIZE];
 };
 
+static struct task_wake hd44780_wake;
+
 
 /****************************************************************
  * Transmit functions
@@ -84,6 +97,32 @@ hd44780_xmit(struct hd44780 *h, uint8_t len, uint8_t *data)
     h->last_cmd_time = last_cmd_time;
 }
 
+// Transmit up to 'max' bytes from the update queue
+static void
+hd44780_xmit_queue(struct hd44780 *h, uint_fast8_t max)
+{
+    while (max-- && h->queue_count) {
+        uint8_t b = h->queue[h->queue_pos];
+        h->queue_pos = (h->queue_pos + 1) % QUEUE_SIZE;
+        h->queue_count--;
+        if (!h->seg_remaining) {
+            // Start of a new segment
+            h->seg_remaining = b & SEG_LEN_MASK;
+            gpio_out_write(h->rs, !!(b & SEG_DATA));
+            continue;
+        }
+        hd44780_xmit(h, 1, &b);
+        h->seg_remaining--;
+    }
+}
+
+// Complete all queued updates
+static void
+hd44780_flush_queue(struct hd44780 *h)
+{
+    hd44780_xmit_queue(h, QUEUE_SIZE);
+}
+
 
 /****************************************************************
  * Interface
@@ -123,6 +162,7 @@ void
 command_hd44780_send_cmds(uint32_t *args)
 {
     struct hd44780 *h = oid_lookup(args[0], command_config_hd44780);
+    hd44780_flush_queue(h);
     gpio_out_write(h->rs, 0);
     uint8_t len = args[1], *cmds = command_decode_ptr(args[2]);
     hd44780_xmit(h, len, cmds);
@@ -133,12 +173,56 @@ void
 command_hd44780_send_data(uint32_t *args)
 {
     struct hd44780 *h = oid_lookup(args[0], command_config_hd44780);
+    hd44780_flush_queue(h);
     gpio_out_write(h->rs, 1);
     uint8_t len = args[1], *data = command_decode_ptr(args[2]);
     hd44780_xmit(h, len, data);
 }
 DECL_COMMAND(command_hd44780_send_data, "hd44780_send_data oid=%c data=%*s");
 
+// Add a series of segments to the background update queue
+void
+command_hd44780_queue(uint32_t *args)
+{
+    struct hd44780 *h = oid_lookup(args[0], command_config_hd44780);
+    uint8_t len = args[1], *data = command_decode_ptr(args[2]);
+    uint_fast8_t pos = 0;
+    while (pos < len)
+        pos += (data[pos] & SEG_LEN_MASK) + 1;
+    if (pos != len)
+        shutdown("Invalid hd44780 queue segments");
+    if (h->queue_count + len > QUEUE_SIZE)
+        // Queue is full - send pending updates now
+        hd44780_flush_queue(h);
+    uint_fast8_t wpos = (h->queue_pos + h->queue_count) % QUEUE_SIZE;
+    uint_fast8_t first = QUEUE_SIZE - wpos;
+    if (first > len)
+        first = len;
+    memcpy(&h->queue[wpos], data, first);
+    memcpy(h->queue, &data[first], len - first);
+    h->queue_count += len;
+    sched_wake_task(&hd44780_wake);
+}
+DECL_COMMAND(command_hd44780_queue, "hd44780_queue oid=%c data=%*s");
+
+// Transmit queued updates a few bytes at a time
+void
+hd44780_task(void)
+{
+    if (!sched_check_wake(&hd44780_wake))
+        return;
+    uint8_t oid;
+    struct hd44780 *h;
+    foreach_oid(oid, h, command_config_hd44780) {
+        if (!h->queue_count)
+            continue;
+        hd44780_xmit_queue(h, 4);
+        if (h->queue_count)
+            sched_wake_task(&hd44780_wake);
+    }
+}
+DECL_TASK(hd44780_task);
+
 void
 hd44780_shutdown(void)
 {
@@ -152,6 +236,7 @@ hd44780_shutdown(void)
         gpio_out_write(h->d6, 0);
         gpio_out_write(h->d7, 0);
         h->last = 0;
+        h->queue_count = h->seg_remaining = 0;
     }
 }
 DECL_SHUTDOWN(hd44780_shutdown);
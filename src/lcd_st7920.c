@@ -4,6 +4,7 @@
 //
 // This file may be distributed under the terms of the GNU GPLv3 license.
 
+#include <string.h> // memcpy
 #include "autoconf.h" // CONFIG_MACH_AVR
 #include "basecmd.h" // oid_alloc
 #include "board/gpio.h" // gpio_out_write
@@ -12,11 +13,23 @@
 #include "command.h" // DECL_COMMAND
 #include "sched.h" // DECL_SHUTDOWN
 
+// Updates may be queued for transmission in the background.  The
+// queue holds a series of segments - each starting with a header byte
+// containing the segment length and a flag indicating data or command
+// bytes.
+#define QUEUE_SIZE 128
+#define SEG_DATA 0x80
+#define SEG_LEN_MASK 0x7f
+
 struct st7920 {
     uint32_t last_cmd_time, sync_wait_ticks, cmd_wait_ticks;
     struct gpio_out sclk, sid;
+    uint8_t queue_pos, queue_count, seg_remaining, seg_started;
+    uint8_t queue[QUEUE_SIZE];
 };
 
+static struct task_wake st7920_wake;
+
 
 /****************************************************************
  * Transmit functions
@@ -61,6 +74,19 @@ st7920_xmit_byte(struct st7920 *s, uint8_t data)
     }
 }
 
+// Transmit a command (or data) byte to the chip
+static void
+st7920_xmit_cmd(struct st7920 *s, uint8_t cmd, uint32_t wait_ticks)
+{
+    st7920_xmit_byte(s, cmd & 0xf0);
+    uint32_t last_cmd_time = s->last_cmd_time;
+    while (timer_read_time() - last_cmd_time < wait_ticks)
+        // Can't complete transfer until delay complete
+        irq_poll();
+    st7920_xmit_byte(s, cmd << 4);
+    s->last_cmd_time = timer_read_time();
+}
+
 // Transmit a series of command bytes to the chip
 static void
 st7920_xmit(struct st7920 *s, uint8_t count, uint8_t *cmds)
@@ -69,28 +95,40 @@ st7920_xmit(struct st7920 *s, uint8_t count, uint8_t *cmds)
         return;
 
     // Send first byte (with longer delay)
-    uint32_t last_cmd_time = s->last_cmd_time, wait_ticks = s->sync_wait_ticks;
-    uint8_t cmd = *cmds++;
-    st7920_xmit_byte(s, cmd & 0xf0);
-    while (timer_read_time() - last_cmd_time < wait_ticks)
-        // Can't complete transfer until delay complete
-        irq_poll();
-    st7920_xmit_byte(s, cmd << 4);
-    last_cmd_time = timer_read_time();
+    st7920_xmit_cmd(s, *cmds++, s->sync_wait_ticks);
 
     // Send subsequent bytes
-    wait_ticks = s->cmd_wait_ticks;
-    while (--count) {
-        uint8_t cmd = *cmds++;
-        st7920_xmit_byte(s, cmd & 0xf0);
-        while (timer_read_time() - last_cmd_time < wait_ticks)
-            // Can't complete transfer until delay complete
-            irq_poll();
-        st7920_xmit_byte(s, cmd << 4);
-        last_cmd_time = timer_read_time();
+    while (--count)
+        st7920_xmit_cmd(s, *cmds++, s->cmd_wait_ticks);
+}
+
+// Transmit up to 'max' bytes from the update queue
+static void
+st7920_xmit_queue(struct st7920 *s, uint_fast8_t max)
+{
+    while (max-- && s->queue_count) {
+        uint8_t b = s->queue[s->queue_pos];
+        s->queue_pos = (s->queue_pos + 1) % QUEUE_SIZE;
+        s->queue_count--;
+        if (!s->seg_remaining) {
+            // Start of a new segment
+            s->seg_remaining = b & SEG_LEN_MASK;
+            s->seg_started = 0;
+            st7920_xmit_byte(s, b & SEG_DATA ? SYNC_DATA : SYNC_CMD);
+            continue;
+        }
+        st7920_xmit_cmd(s, b, s->seg_started ? s->cmd_wait_ticks
+                                             : s->sync_wait_ticks);
+        s->seg_started = 1;
+        s->seg_remaining--;
     }
+}
 
-    s->last_cmd_time = last_cmd_time;
+// Complete all queued updates
+static void
+st7920_flush_queue(struct st7920 *s)
+{
+    st7920_xmit_queue(s, QUEUE_SIZE);
 }
 
 
@@ -136,6 +174,7 @@ void
 command_st7920_send_cmds(uint32_t *args)
 {
     struct st7920 *s = oid_lookup(args[0], command_config_st7920);
+    st7920_flush_queue(s);
     st7920_xmit_byte(s, SYNC_CMD);
     uint8_t len = args[1], *cmds = command_decode_ptr(args[2]);
     st7920_xmit(s, len, cmds);
@@ -146,12 +185,56 @@ void
 command_st7920_send_data(uint32_t *args)
 {
     struct st7920 *s = oid_lookup(args[0], command_config_st7920);
+    st7920_flush_queue(s);
     st7920_xmit_byte(s, SYNC_DATA);
     uint8_t len = args[1], *data = command_decode_ptr(args[2]);
     st7920_xmit(s, len, data);
 }
 DECL_COMMAND(command_st7920_send_data, "st7920_send_data oid=%c data=%*s");
 
+// Add a series of segments to the background update queue
+void
+command_st7920_queue(uint32_t *args)
+{
+    struct st7920 *s = oid_lookup(args[0], command_config_st7920);
+    uint8_t len = args[1], *data = command_decode_ptr(args[2]);
+    uint_fast8_t pos = 0;
+    while (pos < len)
+        pos += (data[pos] & SEG_LEN_MASK) + 1;
+    if (pos != len)
+        shutdown("Invalid st7920 queue segments");
+    if (s->queue_count + len > QUEUE_SIZE)
+        // Queue is full - send pending updates now
+        st7920_flush_queue(s);
+    uint_fast8_t wpos = (s->queue_pos + s->queue_count) % QUEUE_SIZE;
+    uint_fast8_t first = QUEUE_SIZE - wpos;
+    if (first > len)
+        first = len;
+    memcpy(&s->queue[wpos], data, first);
+    memcpy(s->queue, &data[first], len - first);
+    s->queue_count += len;
+    sched_wake_task(&st7920_wake);
+}
+DECL_COMMAND(command_st7920_queue, "st7920_queue oid=%c data=%*s");
+
+// Transmit queued updates a few bytes at a time
+void
+st7920_task(void)
+{
+    if (!sched_check_wake(&st7920_wake))
+        return;
+    uint8_t oid;
+    struct st7920 *s;
+    foreach_oid(oid, s, command_config_st7920) {
+        if (!s->queue_count)
+            continue;
+        st7920_xmit_queue(s, 4);
+        if (s->queue_count)
+            sched_wake_task(&st7920_wake);
+    }
+}
+DECL_TASK(st7920_task);
+
 void
 st7920_shutdown(void)
 {
@@ -160,6 +243,7 @@ st7920_shutdown(void)
     foreach_oid(i, s, command_config_st7920) {
         gpio_out_write(s->sclk, 0);
         gpio_out_write(s->sid, 0);
+        s->queue_count = s->seg_remaining = 0;
     }
 }
 DECL_SHUTDOWN(st7920_shutdown);
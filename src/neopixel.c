@@ -83,14 +83,19 @@ neopixel_delay(neopixel_time_t start, neopixel_time_t ticks)
  * Neopixel interface
  ****************************************************************/
 
+struct neopixel_effects;
+
 struct neopixel_s {
     struct gpio_out pin;
     neopixel_time_t bit_max_ticks;
     uint32_t last_req_time, reset_min_ticks;
+    struct neopixel_effects *effects;
     uint16_t data_size;
     uint8_t data[0];
 };
 
+static void neopixel_render(struct neopixel_s *n, uint8_t advance);
+
 void
 command_config_neopixel(uint32_t *args)
 {
@@ -194,7 +199,219 @@ command_neopixel_send(uint32_t *args)
 {
     uint8_t oid = args[0];
     struct neopixel_s *n = oid_lookup(oid, command_config_neopixel);
+    neopixel_render(n, 0);
     int ret = send_data(n);
     sendf("neopixel_result oid=%c success=%c", oid, ret ? 0 : 1);
 }
 DECL_COMMAND(command_neopixel_send, "neopixel_send oid=%c");
+
+
+/****************************************************************
+ * Effects
+ ****************************************************************/
+
+// The mcu can generate simple LED patterns on a range of the chain.
+// Effects are rendered into the color data before each transmission
+// (overriding any data sent by the host for that range) and animated
+// effects are periodically advanced and transmitted by the mcu.
+
+#define NEOPIXEL_MAX_ELEM 4
+
+enum { NE_OFF, NE_GRADIENT, NE_CHASE, NE_PROGRESS, NE_PULSE };
+
+struct neopixel_effect {
+    uint16_t pos, count, param, phase, step;
+    uint8_t type, elem_size;
+    uint8_t color1[NEOPIXEL_MAX_ELEM], color2[NEOPIXEL_MAX_ELEM];
+};
+
+struct neopixel_effects {
+    struct timer timer;
+    uint32_t frame_ticks;
+    uint8_t effect_count, flags;
+    struct neopixel_effect effect[0];
+};
+
+enum { NEF_TIMER=1<<0, NEF_ANIMATE=1<<1, NEF_FRAME=1<<2 };
+
+static struct task_wake neopixel_wake;
+
+// Periodic timer that requests the next animation frame
+static uint_fast8_t
+neopixel_effect_event(struct timer *timer)
+{
+    struct neopixel_effects *ne = container_of(
+        timer, struct neopixel_effects, timer);
+    if (!(ne->flags & NEF_ANIMATE)) {
+        ne->flags &= ~NEF_TIMER;
+        return SF_DONE;
+    }
+    ne->flags |= NEF_FRAME;
+    sched_wake_task(&neopixel_wake);
+    ne->timer.waketime += ne->frame_ticks;
+    return SF_RESCHEDULE;
+}
+
+void
+command_neopixel_setup_effects(uint32_t *args)
+{
+    struct neopixel_s *n = oid_lookup(args[0], command_config_neopixel);
+    uint8_t effect_count = args[1];
+    if (n->effects)
+        shutdown("Neopixel effects already configured");
+    struct neopixel_effects *ne = alloc_chunk(
+        sizeof(*ne) + effect_count * sizeof(ne->effect[0]));
+    ne->timer.func = neopixel_effect_event;
+    ne->frame_ticks = args[2];
+    ne->effect_count = effect_count;
+    n->effects = ne;
+}
+DECL_COMMAND(command_neopixel_setup_effects,
+             "neopixel_setup_effects oid=%c count=%c frame_ticks=%u");
+
+void
+command_neopixel_effect(uint32_t *args)
+{
+    struct neopixel_s *n = oid_lookup(args[0], command_config_neopixel);
+    struct neopixel_effects *ne = n->effects;
+    uint8_t slot = args[1];
+    if (!ne || slot >= ne->effect_count)
+        shutdown("Invalid neopixel effect");
+    struct neopixel_effect *e = &ne->effect[slot];
+    uint8_t type = args[2], elem_size = args[5];
+    uint8_t *color1 = command_decode_ptr(args[6]);
+    uint8_t *color2 = command_decode_ptr(args[8]);
+    uint_fast16_t pos = args[3], count = args[4];
+    if (type > NE_PULSE || elem_size > NEOPIXEL_MAX_ELEM
+        || args[7] != elem_size || pos & 0x8000 || count & 0x8000
+        || pos + (uint32_t)count * elem_size > n->data_size)
+        shutdown("Invalid neopixel effect");
+    e->type = type;
+    e->pos = pos;
+    e->count = count;
+    e->elem_size = elem_size;
+    memcpy(e->color1, color1, elem_size);
+    memcpy(e->color2, color2, elem_size);
+    e->param = args[9];
+    e->step = args[10];
+    e->phase = 0;
+
+    // Start or stop the animation timer
+    uint_fast8_t i, animate = 0;
+    for (i = 0; i < ne->effect_count; i++)
+        if (ne->effect[i].type && ne->effect[i].step)
+            animate = 1;
+    irq_disable();
+    if (!animate) {
+        ne->flags &= ~NEF_ANIMATE;
+    } else {
+        ne->flags |= NEF_ANIMATE;
+        if (!(ne->flags & NEF_TIMER)) {
+            ne->flags |= NEF_TIMER;
+            ne->timer.waketime = timer_read_time() + ne->frame_ticks;
+            sched_add_timer(&ne->timer);
+        }
+    }
+    irq_enable();
+}
+DECL_COMMAND(command_neopixel_effect,
+             "neopixel_effect oid=%c slot=%c type=%c pos=%hu count=%hu"
+             " color1=%*s color2=%*s param=%hu step=%hu");
+
+// Fill in a color that is 'weight'/256 of the way from color1 to color2
+static void
+effect_blend(struct neopixel_effect *e, uint8_t *out, uint_fast16_t weight)
+{
+    uint_fast8_t i;
+    for (i = 0; i < e->elem_size; i++) {
+        int_fast16_t c1 = e->color1[i], c2 = e->color2[i];
+        out[i] = c1 + (((c2 - c1) * (int32_t)weight) >> 8);
+    }
+}
+
+// Generate the color data for an effect
+static void
+effect_render(struct neopixel_s *n, struct neopixel_effect *e)
+{
+    uint8_t *out = &n->data[e->pos];
+    uint_fast16_t i, count = e->count, weight = 0;
+    uint_fast16_t head = ((uint32_t)e->phase * count) >> 16;
+    uint32_t fill = (uint32_t)e->param * count;
+    if (e->type == NE_PULSE)
+        // Triangle wave between color1 and color2
+        weight = (e->phase & 0x8000 ? 0xffff - e->phase : e->phase) >> 7;
+    for (i = 0; i < count; i++, out += e->elem_size) {
+        switch (e->type) {
+        case NE_GRADIENT:
+            weight = count > 1 ? (uint32_t)i * 256 / (count - 1) : 0;
+            break;
+        case NE_CHASE:
+            // 'param' leds of color1 starting at the current position
+            weight = (i >= head ? i - head : i + count - head) < e->param
+                      ? 0 : 256;
+            break;
+        case NE_PROGRESS:
+            // 'param' is the fraction (out of 65536) filled with color1
+            if (i < fill >> 16)
+                weight = 0;
+            else if (i == fill >> 16)
+                weight = 256 - ((fill >> 8) & 0xff);
+            else
+                weight = 256;
+            break;
+        }
+        effect_blend(e, out, weight);
+    }
+}
+
+// Apply all active effects to the color data
+static void
+neopixel_render(struct neopixel_s *n, uint8_t advance)
+{
+    struct neopixel_effects *ne = n->effects;
+    if (!ne)
+        return;
+    uint_fast8_t i;
+    for (i = 0; i < ne->effect_count; i++) {
+        struct neopixel_effect *e = &ne->effect[i];
+        if (!e->type)
+            continue;
+        if (advance)
+            e->phase += e->step;
+        effect_render(n, e);
+    }
+}
+
+// Transmit new animation frames
+void
+neopixel_task(void)
+{
+    if (!sched_check_wake(&neopixel_wake))
+        return;
+    uint8_t oid;
+    struct neopixel_s *n;
+    foreach_oid(oid, n, command_config_neopixel) {
+        struct neopixel_effects *ne = n->effects;
+        if (!ne || !(ne->flags & NEF_FRAME))
+            continue;
+        irq_disable();
+        ne->flags &= ~NEF_FRAME;
+        irq_enable();
+        neopixel_render(n, 1);
+        // A failed transmission is corrected by the next frame
+        send_data(n);
+    }
+}
+DECL_TASK(neopixel_task);
+
+void
+neopixel_shutdown(void)
+{
+    uint8_t oid;
+    struct neopixel_s *n;
+    foreach_oid(oid, n, command_config_neopixel) {
+        if (n->effects)
+            n->effects->flags = 0;
+    }
+}
+DECL_SHUTDOWN(neopixel_shutdown);
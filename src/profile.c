@@ -0,0 +1,144 @@
+// Timer and command handler profiling statistics
+//
+// Copyright (C) 2026  agent <agent@local>
+//
+// This file may be distributed under the terms of the GNU GPLv3 license.
+
+#include <string.h> // memset
+#include "basecmd.h" // move_queue_peak
+#include "board/irq.h" // irq_disable
+#include "board/misc.h" // timer_read_time
+#include "command.h" // DECL_COMMAND
+#include "profile.h" // profile_timer_start
+#include "sched.h" // struct timer
+
+// The time of each timer callback and command handler is measured
+// with timer_read_time() - on ARM Cortex-M chips this is the DWT
+// cycle counter.  Statistics are kept per timer callback function and
+// per command id.  The last slot of each table collects all entries
+// that do not fit.
+
+#define PROFILE_TIMERS 16
+#define PROFILE_COMMANDS 24
+#define PROFILE_BUCKETS 16
+
+enum { PT_END, PT_TIMER, PT_COMMAND, PT_LATENCY };
+
+#define PROFILE_KEY_OTHER 0xffffffff
+
+struct profile_slot {
+    uint32_t key, count, max;
+    uint64_t sum;
+};
+
+static struct profile_slot timer_slots[PROFILE_TIMERS];
+static struct profile_slot command_slots[PROFILE_COMMANDS];
+static uint32_t latency_counts[PROFILE_BUCKETS];
+
+// Add a measurement to the slot associated with 'key'
+static void
+slot_note(struct profile_slot *slots, uint_fast8_t count, uint32_t key
+          , uint32_t ticks)
+{
+    struct profile_slot *s = slots, *end = &slots[count - 1];
+    for (; s < end; s++) {
+        if (s->key == key)
+            break;
+        if (!s->count) {
+            s->key = key;
+            break;
+        }
+    }
+    if (s == end)
+        s->key = PROFILE_KEY_OTHER;
+    s->count++;
+    s->sum += ticks;
+    if (ticks > s->max)
+        s->max = ticks;
+}
+
+// Note the start of a timer callback - caller must disable irqs
+uint32_t
+profile_timer_start(struct timer *t)
+{
+    // Track how late the timer is being dispatched (log2 histogram)
+    uint32_t now = timer_read_time();
+    int32_t late = now - t->waketime;
+    uint_fast8_t bucket = 0;
+    while (late > 0 && bucket < PROFILE_BUCKETS - 1) {
+        late >>= 1;
+        bucket++;
+    }
+    latency_counts[bucket]++;
+    return now;
+}
+
+// Note the end of a timer callback - caller must disable irqs
+void
+profile_timer_end(void *func, uint32_t start)
+{
+    slot_note(timer_slots, PROFILE_TIMERS, (uintptr_t)func
+              , timer_read_time() - start);
+}
+
+// Note the end of a command handler
+void
+profile_command_end(uint_fast16_t cmdid, uint32_t start)
+{
+    slot_note(command_slots, PROFILE_COMMANDS, cmdid
+              , timer_read_time() - start);
+}
+
+// Report the next non-empty profile entry at or after 'index'
+void
+command_profile_query(uint32_t *args)
+{
+    uint_fast8_t index = args[0], type = PT_END;
+    struct profile_slot s;
+    memset(&s, 0, sizeof(s));
+    for (;; index++) {
+        if (index < PROFILE_TIMERS) {
+            type = PT_TIMER;
+            irq_disable();
+            s = timer_slots[index];
+            irq_enable();
+        } else if (index < PROFILE_TIMERS + PROFILE_COMMANDS) {
+            type = PT_COMMAND;
+            s = command_slots[index - PROFILE_TIMERS];
+        } else if (index < PROFILE_TIMERS + PROFILE_COMMANDS
+                   + PROFILE_BUCKETS) {
+            type = PT_LATENCY;
+            s.key = index - PROFILE_TIMERS - PROFILE_COMMANDS;
+            s.sum = s.max = 0;
+            irq_disable();
+            s.count = latency_counts[s.key];
+            irq_enable();
+        } else {
+            // End of list - report peak move queue usage
+            type = PT_END;
+            s.key = move_queue_peak(0);
+            s.count = s.sum = s.max = 0;
+            break;
+        }
+        if (s.count)
+            break;
+    }
+    uint32_t avg = s.count ? s.sum / s.count : 0;
+    sendf("profile_item index=%c type=%c key=%u count=%u avg=%u max=%u"
+          , index, type, s.key, s.count, avg, s.max);
+}
+DECL_COMMAND_FLAGS(command_profile_query, HF_IN_SHUTDOWN,
+                   "profile_query index=%c");
+
+// Clear all profile statistics
+void
+command_profile_reset(uint32_t *args)
+{
+    irq_disable();
+    memset(timer_slots, 0, sizeof(timer_slots));
+    memset(latency_counts, 0, sizeof(latency_counts));
+    irq_enable();
+    memset(command_slots, 0, sizeof(command_slots));
+    move_queue_peak(1);
+}
+DECL_COMMAND_FLAGS(command_profile_reset, HF_IN_SHUTDOWN, "profile_reset");
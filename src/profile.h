@@ -0,0 +1,11 @@
+#ifndef __PROFILE_H
+#define __PROFILE_H
+
+#include <stdint.h> // uint32_t
+
+struct timer;
+uint32_t profile_timer_start(struct timer *t);
+void profile_timer_end(void *func, uint32_t start);
+void profile_command_end(uint_fast16_t cmdid, uint32_t start);
+
+#endif // profile.h
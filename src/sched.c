@@ -12,6 +12,7 @@
 #include "board/misc.h" // timer_from_us
 #include "board/pgm.h" // READP
 #include "command.h" // shutdown
+#include "profile.h" // profile_timer_start
 #include "sched.h" // sched_check_periodic
 #include "stepper.h" // stepper_event
 
@@ -150,6 +151,10 @@ sched_timer_dispatch(void)
     struct timer *t = SchedStatus.timer_list;
     uint_fast8_t res;
     uint32_t updated_waketime;
+    void *prof_func = t->func;
+    uint32_t prof_start = 0;
+    if (CONFIG_WANT_PROFILE)
+        prof_start = profile_timer_start(t);
     if (CONFIG_INLINE_STEPPER_HACK && likely(!t->func)) {
         res = stepper_event(t);
         updated_waketime = t->waketime;
@@ -157,6 +162,8 @@ sched_timer_dispatch(void)
         res = t->func(t);
         updated_waketime = t->waketime;
     }
+    if (CONFIG_WANT_PROFILE)
+        profile_timer_end(prof_func, prof_start);
 
     // Update timer_list (rescheduling current timer if necessary)
     unsigned int next_waketime = updated_waketime;
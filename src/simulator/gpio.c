@@ -4,18 +4,91 @@
 //
 // This file may be distributed under the terms of the GNU GPLv3 license.
 
+#include "autoconf.h" // CONFIG_CLOCK_FREQ
 #include "board/gpio.h" // gpio_out_write
+#include "board/misc.h" // timer_read_time
+#include "command.h" // DECL_CONSTANT
+
+DECL_CONSTANT("ADC_MAX", 4095);
+DECL_ENUMERATION_RANGE("pin", "gpio0", 0, 32);
+
+
+/****************************************************************
+ * Simulated thermal plant
+ ****************************************************************/
+
+// Each of the output pins gpio0 to gpio7 drives a simulated heater.
+// The temperature of that heater may be read from the adc on the
+// corresponding pin gpio8 to gpio15.  The adc reports 10 units per
+// degree Celsius (0C to 409.5C).
+#define PLANT_COUNT 8
+#define PLANT_ADC_START PLANT_COUNT
+#define PLANT_AMBIENT 25.
+#define PLANT_HEAT_RATE 20.     // degrees per second at full power
+#define PLANT_COOL_TIME 10.     // time constant of heat loss (in seconds)
+
+static struct {
+    double temp;
+    uint32_t last_clock;
+    uint8_t is_on;
+} plants[PLANT_COUNT];
+
+// Advance the simulated temperature to the current time
+static void
+plant_update(uint8_t pin)
+{
+    uint32_t now = timer_read_time();
+    double dt = (double)(now - plants[pin].last_clock) / CONFIG_CLOCK_FREQ;
+    plants[pin].last_clock = now;
+    if (!plants[pin].temp)
+        plants[pin].temp = PLANT_AMBIENT;
+    double heat = plants[pin].is_on ? PLANT_HEAT_RATE * PLANT_COOL_TIME : 0.;
+    double target = PLANT_AMBIENT + heat, temp = plants[pin].temp;
+    // Integrate dT/dt = (target - T) / PLANT_COOL_TIME (implicit euler)
+    plants[pin].temp = target + (temp - target) / (1. + dt / PLANT_COOL_TIME);
+}
+
+static void
+plant_set_heater(uint8_t pin, uint8_t val)
+{
+    if (pin >= PLANT_COUNT)
+        return;
+    plant_update(pin);
+    plants[pin].is_on = !!val;
+}
+
+static uint16_t
+plant_read_adc(uint8_t pin)
+{
+    if (pin < PLANT_ADC_START || pin >= PLANT_ADC_START + PLANT_COUNT)
+        return 0;
+    pin -= PLANT_ADC_START;
+    plant_update(pin);
+    int adc = plants[pin].temp * 10. + .5;
+    return adc < 0 ? 0 : (adc > 4095 ? 4095 : adc);
+}
+
+
+/****************************************************************
+ * GPIO functions
+ ****************************************************************/
 
 struct gpio_out gpio_out_setup(uint8_t pin, uint8_t val) {
+    plant_set_heater(pin, val);
     return (struct gpio_out){.pin=pin};
 }
 void gpio_out_reset(struct gpio_out g, uint8_t val) {
+    plant_set_heater(g.pin, val);
 }
 void gpio_out_toggle_noirq(struct gpio_out g) {
+    if (g.pin < PLANT_COUNT)
+        plant_set_heater(g.pin, !plants[g.pin].is_on);
 }
 void gpio_out_toggle(struct gpio_out g) {
+    gpio_out_toggle_noirq(g);
 }
 void gpio_out_write(struct gpio_out g, uint8_t val) {
+    plant_set_heater(g.pin, val);
 }
 struct gpio_in gpio_in_setup(uint8_t pin, int8_t pull_up) {
     return (struct gpio_in){.pin=pin};
@@ -37,7 +110,7 @@ uint32_t gpio_adc_sample(struct gpio_adc g) {
     return 0;
 }
 uint16_t gpio_adc_read(struct gpio_adc g) {
-    return 0;
+    return plant_read_adc(g.pin);
 }
 void gpio_adc_cancel_sample(struct gpio_adc g) {
 }
@@ -0,0 +1,7 @@
+#ifndef __SIMULATOR_INTERNAL_H
+#define __SIMULATOR_INTERNAL_H
+// Local definitions for simulator code
+
+void serial_poll(void);
+
+#endif // internal.h
@@ -7,6 +7,7 @@
 #include <fcntl.h> // fcntl
 #include <unistd.h> // STDIN_FILENO
 #include "board/serial_irq.h" // serial_get_tx_byte
+#include "internal.h" // serial_poll
 #include "sched.h" // DECL_INIT
 
 void
@@ -35,9 +36,21 @@ do_uart(void)
             break;
         else
             write(STDOUT_FILENO, &data, sizeof(data));
+    }
+}
 
-        // XXX - Normally the code would check if input data is
-        // available and call serial_rx_byte()
+// Check for input data on stdin - called from irq_poll()
+void
+serial_poll(void)
+{
+    for (;;) {
+        uint8_t data[64];
+        int ret = read(STDIN_FILENO, data, sizeof(data));
+        if (ret <= 0)
+            break;
+        int i;
+        for (i=0; i<ret; i++)
+            serial_rx_byte(data[i]);
     }
 }
 
@@ -11,16 +11,35 @@
 #include "board/misc.h" // timer_from_us
 #include "board/timer_irq.h" // timer_dispatch_many
 #include "command.h" // DECL_CONSTANT
+#include "internal.h" // serial_poll
 #include "sched.h" // DECL_INIT
 
-// Helper function that returns the system time as a 32bit counter
-static uint32_t
-get_system_time(void)
+// The simulator is not run with real-time priority, so the host may
+// not run it for several milliseconds at a time.  Any such gap is
+// removed from the simulated clock (by advancing 'start_time') so
+// that the firmware does not see its timers run late.
+#define MAX_GAP .000500
+
+static double start_time, last_time;
+
+// Helper function that returns the system time in seconds
+static double
+get_system_seconds(void)
 {
     struct timespec ts;
     clock_gettime(CLOCK_MONOTONIC, &ts);
-    double t = (double)ts.tv_sec + (double)ts.tv_nsec * .000000001;
-    return (uint32_t)(t * CONFIG_CLOCK_FREQ);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * .000000001;
+}
+
+// Helper function that returns the simulated time as a 32bit counter
+static uint32_t
+get_system_time(void)
+{
+    double t = get_system_seconds();
+    if (t - last_time > MAX_GAP)
+        start_time += t - last_time - MAX_GAP;
+    last_time = t;
+    return (uint64_t)((t - start_time) * CONFIG_CLOCK_FREQ);
 }
 
 
@@ -54,6 +73,8 @@ do_timer_dispatch(void)
 void
 timer_init(void)
 {
+    // The scheduler expects the clock to start near zero
+    start_time = last_time = get_system_seconds();
     timer_kick();
 }
 DECL_INIT(timer_init);
@@ -103,6 +124,7 @@ irq_wait(void)
 void
 irq_poll(void)
 {
+    serial_poll();
     uint32_t now = timer_read_time();
     if (!timer_is_before(now, next_wake_time))
         do_timer_dispatch();
@@ -48,6 +48,7 @@ struct stepper {
     struct gpio_out step_pin, dir_pin;
     uint32_t position;
     struct move_queue_head mq;
+    uint16_t queue_count, queue_peak;
     struct trsync_signal stop_signal;
     // gcc (pre v6) does better optimization when uint8_t are bitfields
     uint8_t flags : 8;
@@ -73,6 +74,7 @@ stepper_load_next(struct stepper *s)
     // Load next 'struct stepper_move' into 'struct stepper'
     struct move_node *mn = move_queue_pop(&s->mq);
     struct stepper_move *m = container_of(mn, struct stepper_move, node);
+    s->queue_count--;
     s->add = m->add;
     s->interval = m->interval + m->add;
     if (HAVE_SINGLE_SCHEDULE && s->flags & SF_SINGLE_SCHED) {
@@ -216,17 +218,26 @@ stepper_oid_lookup(uint8_t oid)
     return oid_lookup(oid, command_config_stepper);
 }
 
+// Add a move to the stepper's queue (caller must disable irqs)
+static void
+stepper_queue_push(struct stepper *s, struct stepper_move *m)
+{
+    move_queue_push(&m->node, &s->mq);
+    if (++s->queue_count > s->queue_peak)
+        s->queue_peak = s->queue_count;
+}
+
 // Schedule a set of steps with a given timing
-void
-command_queue_step(uint32_t *args)
+static void
+stepper_queue_move(struct stepper *s, uint32_t interval, uint16_t count
+                   , int16_t add)
 {
-    struct stepper *s = stepper_oid_lookup(args[0]);
     struct stepper_move *m = move_alloc();
-    m->interval = args[1];
-    m->count = args[2];
+    m->interval = interval;
+    m->count = count;
     if (!m->count)
         shutdown("Invalid count parameter");
-    m->add = args[3];
+    m->add = add;
     m->flags = 0;
 
     irq_disable();
@@ -237,20 +248,61 @@ command_queue_step(uint32_t *args)
     }
     if (s->count) {
         s->flags = flags;
-        move_queue_push(&m->node, &s->mq);
+        stepper_queue_push(s, m);
     } else if (flags & SF_NEED_RESET) {
         move_free(m);
     } else {
         s->flags = flags;
-        move_queue_push(&m->node, &s->mq);
+        stepper_queue_push(s, m);
         stepper_load_next(s);
         sched_add_timer(&s->time);
     }
     irq_enable();
 }
+
+void
+command_queue_step(uint32_t *args)
+{
+    struct stepper *s = stepper_oid_lookup(args[0]);
+    stepper_queue_move(s, args[1], args[2], args[3]);
+}
 DECL_COMMAND(command_queue_step,
              "queue_step oid=%c interval=%u count=%hu add=%hi");
 
+static uint32_t multi_messages, multi_moves;
+
+// Schedule several sets of steps - the data contains a series of
+// "interval, count, add" parameters (each encoded as a vlq)
+void
+command_queue_step_multi(uint32_t *args)
+{
+    struct stepper *s = stepper_oid_lookup(args[0]);
+    uint8_t data_len = args[1];
+    uint8_t *data = command_decode_ptr(args[2]), *end = &data[data_len];
+    multi_messages++;
+    while (data < end) {
+        uint32_t interval = command_parse_int(&data);
+        uint16_t count = command_parse_int(&data);
+        int16_t add = command_parse_int(&data);
+        if (data > end)
+            shutdown("Invalid queue_step_multi data");
+        stepper_queue_move(s, interval, count, add);
+        multi_moves++;
+    }
+}
+DECL_COMMAND(command_queue_step_multi, "queue_step_multi oid=%c data=%*s");
+
+// Report the total number of queue_step_multi commands received (and
+// the number of moves they contained)
+void
+command_stepper_get_multi_stats(uint32_t *args)
+{
+    sendf("stepper_multi_stats messages=%u moves=%u"
+          , multi_messages, multi_moves);
+}
+DECL_COMMAND_FLAGS(command_stepper_get_multi_stats, HF_IN_SHUTDOWN,
+                   "stepper_get_multi_stats");
+
 // Set the direction of the next queued step
 void
 command_set_next_step_dir(uint32_t *args)
@@ -307,6 +359,21 @@ command_stepper_get_position(uint32_t *args)
 }
 DECL_COMMAND(command_stepper_get_position, "stepper_get_position oid=%c");
 
+// Report the number of moves queued for the stepper (and the peak
+// number queued since the last report)
+void
+command_stepper_get_queue(uint32_t *args)
+{
+    uint8_t oid = args[0];
+    struct stepper *s = stepper_oid_lookup(oid);
+    irq_disable();
+    uint16_t count = s->queue_count, peak = s->queue_peak;
+    s->queue_peak = count;
+    irq_enable();
+    sendf("stepper_queue oid=%c count=%hu peak=%hu", oid, count, peak);
+}
+DECL_COMMAND(command_stepper_get_queue, "stepper_get_queue oid=%c");
+
 // Stop all moves for a given stepper (caller must disable IRQs)
 static void
 stepper_stop(struct trsync_signal *tss, uint8_t reason)
@@ -325,6 +392,7 @@ stepper_stop(struct trsync_signal *tss, uint8_t reason)
         struct stepper_move *m = container_of(mn, struct stepper_move, node);
         move_free(m);
     }
+    s->queue_count = 0;
 }
 
 // Set the stepper to stop on a "trigger event" (used in homing)
@@ -12,6 +12,13 @@
 #include "command.h" // DECL_COMMAND
 #include "sched.h" // DECL_SHUTDOWN
 
+// A request may contain several transfers that are sent one after
+// the other (for example, multiple register reads).  The transmit
+// data of each transfer is stored consecutively in 'tx' and the
+// received data is stored consecutively in 'rx'.
+#define TMCUART_MAX_TRANSFERS 4
+#define TMCUART_MAX_DATA 40
+
 struct tmcuart_s {
     struct timer timer;
     struct gpio_out tx_pin;
@@ -19,7 +26,9 @@ struct tmcuart_s {
     uint8_t flags;
     uint8_t pos, read_count, write_count;
     uint32_t cfg_bit_time, bit_time;
-    uint8_t data[10];
+    uint8_t transfer, transfer_count, write_pos, read_pos;
+    uint8_t lens[TMCUART_MAX_TRANSFERS];
+    uint8_t tx[TMCUART_MAX_DATA], rx[TMCUART_MAX_DATA];
 };
 
 enum {
@@ -29,6 +38,25 @@ enum {
 
 static struct task_wake tmcuart_wake;
 
+static uint_fast8_t tmcuart_send_event(struct timer *timer);
+static uint_fast8_t tmcuart_send_sync_event(struct timer *timer);
+
+// Prepare the timer for the next transfer of a request
+static void
+tmcuart_setup_transfer(struct tmcuart_s *t)
+{
+    uint8_t lens = t->lens[t->transfer];
+    t->pos = 0;
+    t->write_count = (lens >> 4) * 8;
+    t->read_count = (lens & 0x0f) * 8;
+    if (t->write_count && (t->tx[t->write_pos] & 0x3f) == 0x2a) {
+        t->timer.func = tmcuart_send_sync_event;
+    } else {
+        t->bit_time = t->cfg_bit_time;
+        t->timer.func = tmcuart_send_event;
+    }
+}
+
 // Restore uart line to normal "idle" mode
 static void
 tmcuart_reset_line(struct tmcuart_s *t)
@@ -40,11 +68,31 @@ tmcuart_reset_line(struct tmcuart_s *t)
     t->flags = (t->flags & (TU_PULLUP | TU_SINGLE_WIRE)) | TU_LINE_HIGH;
 }
 
-// Helper function to end a transmission and schedule a response
+// Helper function to end a transfer and schedule a response
 static uint_fast8_t
 tmcuart_finalize(struct tmcuart_s *t)
 {
     tmcuart_reset_line(t);
+    uint8_t lens = t->lens[t->transfer], read_len = lens & 0x0f;
+    if (t->read_count < read_len * 8) {
+        // Read timeout
+        if (t->transfer_count == 1)
+            // Report an empty message (as tmcuart_send always has)
+            read_len = 0;
+        else
+            // Report an (invalid) zero filled message so that the data
+            // of later transfers remains at the expected offset
+            memset(&t->rx[t->read_pos], 0, read_len);
+    }
+    t->write_pos += lens >> 4;
+    t->read_pos += read_len;
+    if (++t->transfer < t->transfer_count) {
+        // Start next transfer after a short idle period
+        t->flags |= TU_ACTIVE;
+        tmcuart_setup_transfer(t);
+        t->timer.waketime += t->cfg_bit_time * 12;
+        return SF_RESCHEDULE;
+    }
     t->flags |= TU_REPORT;
     sched_wake_task(&tmcuart_wake);
     return SF_DONE;
@@ -57,12 +105,13 @@ tmcuart_read_event(struct timer *timer)
     struct tmcuart_s *t = container_of(timer, struct tmcuart_s, timer);
     uint8_t v = gpio_in_read(t->rx_pin);
     // Read and store bit
-    uint8_t pos = t->pos, mask = 1 << (pos & 0x07), data = t->data[pos >> 3];
+    uint8_t *rx = &t->rx[t->read_pos];
+    uint8_t pos = t->pos, mask = 1 << (pos & 0x07), data = rx[pos >> 3];
     if (v)
         data |= mask;
     else
         data &= ~mask;
-    t->data[pos >> 3] = data;
+    rx[pos >> 3] = data;
     pos++;
     if (pos >= t->read_count)
         return tmcuart_finalize(t);
@@ -131,7 +180,8 @@ tmcuart_send_event(struct timer *timer)
             t->timer.waketime += next;
             return SF_RESCHEDULE;
         }
-        uint8_t data = t->data[pos >> 3], bit = (data >> (pos & 0x07)) & 0x01;
+        uint8_t data = t->tx[t->write_pos + (pos >> 3)];
+        uint8_t bit = (data >> (pos & 0x07)) & 0x01;
         if (bit != line_state)
             break;
         next += bit_time;
@@ -186,6 +236,22 @@ DECL_COMMAND(command_config_tmcuart,
              "config_tmcuart oid=%c rx_pin=%u pull_up=%c"
              " tx_pin=%u bit_time=%u");
 
+// Schedule a TMC UART request (after the transfers are loaded)
+static void
+tmcuart_start(struct tmcuart_s *t, uint8_t count, uint8_t write_len
+              , uint8_t *write)
+{
+    memcpy(t->tx, write, write_len);
+    t->transfer = t->write_pos = t->read_pos = 0;
+    t->transfer_count = count;
+    t->flags = (t->flags & (TU_LINE_HIGH|TU_PULLUP|TU_SINGLE_WIRE)) | TU_ACTIVE;
+    tmcuart_setup_transfer(t);
+    irq_disable();
+    t->timer.waketime = timer_read_time() + timer_from_us(200);
+    sched_add_timer(&t->timer);
+    irq_enable();
+}
+
 // Parse and schedule a TMC UART transmission request
 void
 command_tmcuart_send(uint32_t *args)
@@ -197,26 +263,46 @@ command_tmcuart_send(uint32_t *args)
     uint8_t write_len = args[1];
     uint8_t *write = command_decode_ptr(args[2]);
     uint8_t read_len = args[3];
-    if (write_len > sizeof(t->data) || read_len > sizeof(t->data))
+    if (write_len > 10 || read_len > 10)
         shutdown("tmcuart data too large");
-    memcpy(t->data, write, write_len);
-    t->pos = 0;
-    t->flags = (t->flags & (TU_LINE_HIGH|TU_PULLUP|TU_SINGLE_WIRE)) | TU_ACTIVE;
-    t->write_count = write_len * 8;
-    t->read_count = read_len * 8;
-    if (write_len >= 1 && (t->data[0] & 0x3f) == 0x2a) {
-        t->timer.func = tmcuart_send_sync_event;
-    } else {
-        t->bit_time = t->cfg_bit_time;
-        t->timer.func = tmcuart_send_event;
-    }
-    irq_disable();
-    t->timer.waketime = timer_read_time() + timer_from_us(200);
-    sched_add_timer(&t->timer);
-    irq_enable();
+    t->lens[0] = (write_len << 4) | read_len;
+    tmcuart_start(t, 1, write_len, write);
 }
 DECL_COMMAND(command_tmcuart_send, "tmcuart_send oid=%c write=%*s read=%c");
 
+// Schedule several back-to-back TMC UART transfers.  Each entry in
+// 'lens' contains the write length (upper nibble) and read length
+// (lower nibble) of a transfer.
+void
+command_tmcuart_send_multi(uint32_t *args)
+{
+    struct tmcuart_s *t = oid_lookup(args[0], command_config_tmcuart);
+    if (t->flags & TU_ACTIVE)
+        // Uart is busy - silently drop this request (host should retransmit)
+        return;
+    uint8_t count = args[1];
+    uint8_t *lens = command_decode_ptr(args[2]);
+    uint8_t write_len = args[3];
+    uint8_t *write = command_decode_ptr(args[4]);
+    if (!count || count > ARRAY_SIZE(t->lens))
+        shutdown("tmcuart too many transfers");
+    uint_fast8_t i, total_write = 0, total_read = 0;
+    for (i = 0; i < count; i++) {
+        uint8_t wlen = lens[i] >> 4, rlen = lens[i] & 0x0f;
+        if (wlen > 10 || rlen > 10)
+            shutdown("tmcuart data too large");
+        total_write += wlen;
+        total_read += rlen;
+    }
+    if (total_write != write_len || total_write > sizeof(t->tx)
+        || total_read > sizeof(t->rx))
+        shutdown("tmcuart data too large");
+    memcpy(t->lens, lens, count);
+    tmcuart_start(t, count, write_len, write);
+}
+DECL_COMMAND(command_tmcuart_send_multi,
+             "tmcuart_send_multi oid=%c lens=%*s write=%*s");
+
 // Report completed response message back to host
 void
 tmcuart_task(void)
@@ -231,8 +317,7 @@ tmcuart_task(void)
         irq_disable();
         t->flags &= ~TU_REPORT;
         irq_enable();
-        sendf("tmcuart_response oid=%c read=%*s"
-              , oid, t->read_count / 8, t->data);
+        sendf("tmcuart_response oid=%c read=%*s", oid, t->read_pos, t->rx);
     }
 }
 DECL_TASK(tmcuart_task);